@@ -25,5 +25,18 @@
 #include "arch/fpu/fpu_cmp_un_32.h"
 #include "arch/fpu/fpu_cmp_un_64.h"
 
+// The qcmp kernels are for the quiet compares: they only raise invalid
+// for a signalling NaN, where the cmp ones raise it for any NaN.
+#include "arch/fpu/fpu_qcmp_eq_32.h"
+#include "arch/fpu/fpu_qcmp_eq_64.h"
+#include "arch/fpu/fpu_qcmp_f_32.h"
+#include "arch/fpu/fpu_qcmp_f_64.h"
+#include "arch/fpu/fpu_qcmp_ole_32.h"
+#include "arch/fpu/fpu_qcmp_ole_64.h"
+#include "arch/fpu/fpu_qcmp_olt_32.h"
+#include "arch/fpu/fpu_qcmp_olt_64.h"
+#include "arch/fpu/fpu_qcmp_un_32.h"
+#include "arch/fpu/fpu_qcmp_un_64.h"
+
 #endif
 
@@ -0,0 +1,116 @@
+//
+// arch/x86_64/fpu/dispatch.c
+//
+// Rounding conversions picked at load time for the host CPU.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#include "common.h"
+#include "arch/fpu/fpu.h"
+#include <immintrin.h>
+#include <string.h>
+
+// SSE2: switch the host into the rounding mode we need around an
+// ordinary conversion, keeping any exception flags it raises.
+#define FPU_KERNEL_SSE2(op, ibits, fbits, mode) \
+  void fpu_##op##_i##ibits##_f##fbits##_sse2( \
+    const uint##fbits##_t *fs, uint##ibits##_t *fd) { \
+    fpu_state_t saved_state = fpu_get_state(); \
+    fpu_set_state((saved_state & ~FPU_ROUND_MASK) | mode); \
+    fpu_cvt_i##ibits##_f##fbits(fs, fd); \
+    fpu_set_state((saved_state & FPU_ROUND_MASK) | \
+      (fpu_get_state() & ~FPU_ROUND_MASK)); \
+  }
+
+// SSE4.1 and AVX: round in place, then convert.
+#define FPU_KERNEL_F32(op, ibits, mode, isa, suffix) \
+  __attribute__((target(isa))) \
+  void fpu_##op##_i##ibits##_f32_##suffix( \
+    const uint32_t *fs, uint##ibits##_t *fd) { \
+    float fs_float; \
+    __m128 fs_reg; \
+    memcpy(&fs_float, fs, sizeof(fs_float)); \
+    fs_reg = _mm_set_ss(fs_float); \
+    fs_reg = _mm_round_ss(fs_reg, fs_reg, mode); \
+    *fd = _mm_cvtss_si##ibits(fs_reg); \
+  }
+
+#define FPU_KERNEL_F64(op, ibits, mode, isa, suffix) \
+  __attribute__((target(isa))) \
+  void fpu_##op##_i##ibits##_f64_##suffix( \
+    const uint64_t *fs, uint##ibits##_t *fd) { \
+    double fs_double; \
+    __m128d fs_reg; \
+    memcpy(&fs_double, fs, sizeof(fs_double)); \
+    fs_reg = _mm_set_sd(fs_double); \
+    fs_reg = _mm_round_sd(fs_reg, fs_reg, mode); \
+    *fd = _mm_cvtsd_si##ibits(fs_reg); \
+  }
+
+#define FPU_KERNEL(op, ibits, fbits, round, mode) \
+  FPU_KERNEL_SSE2(op, ibits, fbits, round) \
+  FPU_KERNEL_F##fbits(op, ibits, mode, "sse4.1", sse41) \
+  FPU_KERNEL_F##fbits(op, ibits, mode, "avx", avx)
+
+#define FPU_KERNELS(op, round, mode) \
+  FPU_KERNEL(op, 32, 32, round, mode) \
+  FPU_KERNEL(op, 32, 64, round, mode) \
+  FPU_KERNEL(op, 64, 32, round, mode) \
+  FPU_KERNEL(op, 64, 64, round, mode)
+
+FPU_KERNELS(ceil, FPU_ROUND_POSINF, _MM_FROUND_CEIL)
+FPU_KERNELS(floor, FPU_ROUND_NEGINF, _MM_FROUND_FLOOR)
+FPU_KERNELS(round, FPU_ROUND_NEAREST, _MM_FROUND_TO_NEAREST_INT)
+
+enum fpu_dispatch_level {
+  FPU_DISPATCH_SSE2,
+  FPU_DISPATCH_SSE41,
+  FPU_DISPATCH_AVX,
+};
+
+// Runs from the ifunc resolvers, before constructors do, so the
+// CPU model has to be initialized here.
+static enum fpu_dispatch_level fpu_get_dispatch_level(void) {
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx"))
+    return FPU_DISPATCH_AVX;
+
+  if (__builtin_cpu_supports("sse4.1"))
+    return FPU_DISPATCH_SSE41;
+
+  return FPU_DISPATCH_SSE2;
+}
+
+const char *fpu_dispatch_level(void) {
+  static const char *names[] = {"sse2", "sse4.1", "avx"};
+  return names[fpu_get_dispatch_level()];
+}
+
+#ifndef __SSE4_1__
+#define FPU_DISPATCH(op, ibits, fbits) \
+  static void (*fpu_resolve_##op##_i##ibits##_f##fbits(void)) \
+    (const uint##fbits##_t *, uint##ibits##_t *) { \
+    switch (fpu_get_dispatch_level()) { \
+      case FPU_DISPATCH_AVX: return fpu_##op##_i##ibits##_f##fbits##_avx; \
+      case FPU_DISPATCH_SSE41: return fpu_##op##_i##ibits##_f##fbits##_sse41; \
+      default: return fpu_##op##_i##ibits##_f##fbits##_sse2; \
+    } \
+  } \
+  void fpu_##op##_i##ibits##_f##fbits( \
+    const uint##fbits##_t *fs, uint##ibits##_t *fd) \
+    __attribute__((ifunc("fpu_resolve_" #op "_i" #ibits "_f" #fbits)));
+
+#define FPU_DISPATCHES(op) \
+  FPU_DISPATCH(op, 32, 32) \
+  FPU_DISPATCH(op, 32, 64) \
+  FPU_DISPATCH(op, 64, 32) \
+  FPU_DISPATCH(op, 64, 64)
+
+FPU_DISPATCHES(ceil)
+FPU_DISPATCHES(floor)
+FPU_DISPATCHES(round)
+#endif
+
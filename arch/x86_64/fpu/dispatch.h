@@ -0,0 +1,56 @@
+//
+// arch/x86_64/fpu/dispatch.h
+//
+// Rounding conversions picked at load time for the host CPU.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#ifndef __arch_fpu_dispatch_h__
+#define __arch_fpu_dispatch_h__
+#include "common.h"
+
+// Each kernel comes in SSE2 (switches the rounding mode around a
+// plain conversion), SSE4.1 (ROUNDSS/ROUNDSD) and AVX (the same, VEX
+// encoded) flavours. Unless the build already assumes SSE4.1, the
+// fpu_{ceil,floor,round}_* names resolve to the best one the host
+// supports when the binary is loaded.
+#define FPU_DISPATCH_KERNEL(op, ibits, fbits) \
+  void fpu_##op##_i##ibits##_f##fbits##_sse2( \
+    const uint##fbits##_t *fs, uint##ibits##_t *fd); \
+  void fpu_##op##_i##ibits##_f##fbits##_sse41( \
+    const uint##fbits##_t *fs, uint##ibits##_t *fd); \
+  void fpu_##op##_i##ibits##_f##fbits##_avx( \
+    const uint##fbits##_t *fs, uint##ibits##_t *fd);
+
+#define FPU_DISPATCH_KERNELS(op) \
+  FPU_DISPATCH_KERNEL(op, 32, 32) \
+  FPU_DISPATCH_KERNEL(op, 32, 64) \
+  FPU_DISPATCH_KERNEL(op, 64, 32) \
+  FPU_DISPATCH_KERNEL(op, 64, 64)
+
+FPU_DISPATCH_KERNELS(ceil)
+FPU_DISPATCH_KERNELS(floor)
+FPU_DISPATCH_KERNELS(round)
+
+#ifndef __SSE4_1__
+void fpu_ceil_i32_f32(const uint32_t *fs, uint32_t *fd);
+void fpu_ceil_i32_f64(const uint64_t *fs, uint32_t *fd);
+void fpu_ceil_i64_f32(const uint32_t *fs, uint64_t *fd);
+void fpu_ceil_i64_f64(const uint64_t *fs, uint64_t *fd);
+void fpu_floor_i32_f32(const uint32_t *fs, uint32_t *fd);
+void fpu_floor_i32_f64(const uint64_t *fs, uint32_t *fd);
+void fpu_floor_i64_f32(const uint32_t *fs, uint64_t *fd);
+void fpu_floor_i64_f64(const uint64_t *fs, uint64_t *fd);
+void fpu_round_i32_f32(const uint32_t *fs, uint32_t *fd);
+void fpu_round_i32_f64(const uint64_t *fs, uint32_t *fd);
+void fpu_round_i64_f32(const uint32_t *fs, uint64_t *fd);
+void fpu_round_i64_f64(const uint64_t *fs, uint64_t *fd);
+#endif
+
+// "sse2", "sse4.1" or "avx": whichever flavour the host gets.
+cen64_cold const char *fpu_dispatch_level(void);
+
+#endif
+
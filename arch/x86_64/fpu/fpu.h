@@ -14,6 +14,7 @@
 typedef uint32_t fpu_state_t;
 
 #define FPU_MASK_EXCPS    0x1F80
+#define FPU_FLAG_EXCPS    0x003F
 
 #define FPU_ROUND_MASK    0x6000
 #define FPU_ROUND_NEAREST 0x0000
@@ -29,10 +30,14 @@ static inline void fpu_set_state(fpu_state_t state) {
   _mm_setcsr(state);
 }
 
-#ifdef __SSE4_1__
+// Builds that assume SSE4.1 get these inlined; others pick the best
+// version for the host when the binary is loaded (see dispatch.c).
 #define CEN64_ARCH_HAS_CEIL
 #define CEN64_ARCH_HAS_FLOOR
 #define CEN64_ARCH_HAS_ROUND
+#include "arch/x86_64/fpu/dispatch.h"
+
+#ifdef __SSE4_1__
 #include "arch/x86_64/fpu/ceil_i64_f32.h"
 #include "arch/x86_64/fpu/ceil_i64_f64.h"
 #include "arch/x86_64/fpu/ceil_i32_f32.h"
@@ -73,6 +78,12 @@ static inline void fpu_set_state(fpu_state_t state) {
 #include "arch/x86_64/fpu/mul_64.h"
 #include "arch/x86_64/fpu/neg_32.h"
 #include "arch/x86_64/fpu/neg_64.h"
+#include "arch/x86_64/fpu/qcmp_ueq_32.h"
+#include "arch/x86_64/fpu/qcmp_ueq_64.h"
+#include "arch/x86_64/fpu/qcmp_ule_32.h"
+#include "arch/x86_64/fpu/qcmp_ule_64.h"
+#include "arch/x86_64/fpu/qcmp_ult_32.h"
+#include "arch/x86_64/fpu/qcmp_ult_64.h"
 #include "arch/x86_64/fpu/sqrt_32.h"
 #include "arch/x86_64/fpu/sqrt_64.h"
 #include "arch/x86_64/fpu/sub_32.h"
@@ -0,0 +1,430 @@
+//
+// bench/fpu_bench.c: Host FPU kernel and CP1 throughput/latency benchmark.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#include "common.h"
+#include "fpu/fpu.h"
+#include "bus/controller.h"
+#include "vr4300/cp1.h"
+#include "vr4300/cpu.h"
+#include "vr4300/opcodes.h"
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+// Inputs cycle through a table this big (a power of two), which is
+// small enough to stay in L1 and large enough not to be predictable.
+#define BENCH_INPUTS 1024
+
+// Throughput runs independent ops back to back. Latency runs feed
+// each op's result into the next op's input (through an AND with a
+// zero the compiler can't see), so ops can't overlap.
+enum bench_measure {
+  BENCH_THROUGHPUT,
+  BENCH_LATENCY,
+  NUM_BENCH_MEASURES
+};
+
+enum bench_class {
+  BENCH_NORMAL,
+  BENCH_DENORMAL,
+  BENCH_NAN,
+  BENCH_INF,
+  BENCH_INT,
+  NUM_BENCH_CLASSES
+};
+
+enum bench_type {
+  BENCH_F32,
+  BENCH_F64,
+  BENCH_I32,
+  BENCH_I64,
+};
+
+static const char *bench_measure_names[NUM_BENCH_MEASURES] = {
+  "throughput", "latency"
+};
+
+static const char *bench_class_names[NUM_BENCH_CLASSES] = {
+  "normal", "denormal", "nan", "inf", "int"
+};
+
+// Every table is kept as 64-bit words (low half for 32-bit types),
+// so kernels and CP1 handlers can share them.
+static uint64_t bench_inputs[4][NUM_BENCH_CLASSES][BENCH_INPUTS];
+static volatile uint64_t bench_zero;
+static volatile uint64_t bench_sink;
+
+typedef void (*bench_fn)(const uint64_t *fs, const uint64_t *ft,
+  unsigned long n, enum bench_measure measure);
+
+// Kernels get wrapped so that each one is inlined into its own loop.
+#define BENCH_UNARY(name, ti, to) \
+  static void bench_##name(const uint64_t *fs, const uint64_t *unused, \
+    unsigned long n, enum bench_measure measure) { \
+    uint64_t zero = bench_zero, acc = 0; \
+    unsigned long i; \
+    (void) unused; \
+    for (i = 0; i < n; i++) { \
+      ti x = fs[i & (BENCH_INPUTS - 1)]; \
+      to fd; \
+      if (measure == BENCH_LATENCY) \
+        x ^= (ti) (acc & zero); \
+      name(&x, &fd); \
+      acc ^= fd; \
+    } \
+    bench_sink = acc; \
+  }
+
+#define BENCH_BINARY(name, t) \
+  static void bench_##name(const uint64_t *fs, const uint64_t *ft, \
+    unsigned long n, enum bench_measure measure) { \
+    uint64_t zero = bench_zero, acc = 0; \
+    unsigned long i; \
+    for (i = 0; i < n; i++) { \
+      t x = fs[i & (BENCH_INPUTS - 1)]; \
+      t y = ft[(i + 1) & (BENCH_INPUTS - 1)]; \
+      t fd; \
+      if (measure == BENCH_LATENCY) \
+        x ^= (t) (acc & zero); \
+      name(&x, &y, &fd); \
+      acc ^= fd; \
+    } \
+    bench_sink = acc; \
+  }
+
+BENCH_BINARY(fpu_add_32, uint32_t)
+BENCH_BINARY(fpu_add_64, uint64_t)
+BENCH_BINARY(fpu_sub_32, uint32_t)
+BENCH_BINARY(fpu_sub_64, uint64_t)
+BENCH_BINARY(fpu_mul_32, uint32_t)
+BENCH_BINARY(fpu_mul_64, uint64_t)
+BENCH_BINARY(fpu_div_32, uint32_t)
+BENCH_BINARY(fpu_div_64, uint64_t)
+BENCH_UNARY(fpu_sqrt_32, uint32_t, uint32_t)
+BENCH_UNARY(fpu_sqrt_64, uint64_t, uint64_t)
+BENCH_UNARY(fpu_abs_32, uint32_t, uint32_t)
+BENCH_UNARY(fpu_abs_64, uint64_t, uint64_t)
+BENCH_UNARY(fpu_neg_32, uint32_t, uint32_t)
+BENCH_UNARY(fpu_neg_64, uint64_t, uint64_t)
+BENCH_UNARY(fpu_cvt_f32_f64, uint64_t, uint32_t)
+BENCH_UNARY(fpu_cvt_f32_i32, uint32_t, uint32_t)
+BENCH_UNARY(fpu_cvt_f32_i64, uint64_t, uint32_t)
+BENCH_UNARY(fpu_cvt_f64_f32, uint32_t, uint64_t)
+BENCH_UNARY(fpu_cvt_f64_i32, uint32_t, uint64_t)
+BENCH_UNARY(fpu_cvt_f64_i64, uint64_t, uint64_t)
+BENCH_UNARY(fpu_cvt_i32_f32, uint32_t, uint32_t)
+BENCH_UNARY(fpu_cvt_i32_f64, uint64_t, uint32_t)
+BENCH_UNARY(fpu_cvt_i64_f32, uint32_t, uint64_t)
+BENCH_UNARY(fpu_cvt_i64_f64, uint64_t, uint64_t)
+BENCH_UNARY(fpu_trunc_i32_f32, uint32_t, uint32_t)
+BENCH_UNARY(fpu_trunc_i32_f64, uint64_t, uint32_t)
+BENCH_UNARY(fpu_trunc_i64_f32, uint32_t, uint64_t)
+BENCH_UNARY(fpu_trunc_i64_f64, uint64_t, uint64_t)
+
+// The rounding kernels, as the build calls them and in each flavour.
+#define BENCH_ROUNDING(op, ibits, fbits) \
+  BENCH_UNARY(fpu_##op##_i##ibits##_f##fbits, \
+    uint##fbits##_t, uint##ibits##_t) \
+  BENCH_UNARY(fpu_##op##_i##ibits##_f##fbits##_sse2, \
+    uint##fbits##_t, uint##ibits##_t) \
+  BENCH_UNARY(fpu_##op##_i##ibits##_f##fbits##_sse41, \
+    uint##fbits##_t, uint##ibits##_t) \
+  BENCH_UNARY(fpu_##op##_i##ibits##_f##fbits##_avx, \
+    uint##fbits##_t, uint##ibits##_t)
+
+#define BENCH_ROUNDINGS(op) \
+  BENCH_ROUNDING(op, 32, 32) \
+  BENCH_ROUNDING(op, 32, 64) \
+  BENCH_ROUNDING(op, 64, 32) \
+  BENCH_ROUNDING(op, 64, 64)
+
+BENCH_ROUNDINGS(ceil)
+BENCH_ROUNDINGS(floor)
+BENCH_ROUNDINGS(round)
+
+struct bench_kernel {
+  const char *name;
+  const char *flavour;
+  const char *isa; // host feature needed, if any
+  enum bench_type type;
+  bench_fn run;
+};
+
+#define KERNEL(name, type) {#name, "default", NULL, type, bench_##name}
+
+#define ROUNDING(op, ibits, fbits) \
+  {"fpu_" #op "_i" #ibits "_f" #fbits, "default", NULL, \
+    BENCH_F##fbits, bench_fpu_##op##_i##ibits##_f##fbits}, \
+  {"fpu_" #op "_i" #ibits "_f" #fbits, "sse2", NULL, \
+    BENCH_F##fbits, bench_fpu_##op##_i##ibits##_f##fbits##_sse2}, \
+  {"fpu_" #op "_i" #ibits "_f" #fbits, "sse4.1", "sse4.1", \
+    BENCH_F##fbits, bench_fpu_##op##_i##ibits##_f##fbits##_sse41}, \
+  {"fpu_" #op "_i" #ibits "_f" #fbits, "avx", "avx", \
+    BENCH_F##fbits, bench_fpu_##op##_i##ibits##_f##fbits##_avx}
+
+#define ROUNDINGS(op) \
+  ROUNDING(op, 32, 32), ROUNDING(op, 32, 64), \
+  ROUNDING(op, 64, 32), ROUNDING(op, 64, 64)
+
+static const struct bench_kernel bench_kernels[] = {
+  KERNEL(fpu_add_32, BENCH_F32), KERNEL(fpu_add_64, BENCH_F64),
+  KERNEL(fpu_sub_32, BENCH_F32), KERNEL(fpu_sub_64, BENCH_F64),
+  KERNEL(fpu_mul_32, BENCH_F32), KERNEL(fpu_mul_64, BENCH_F64),
+  KERNEL(fpu_div_32, BENCH_F32), KERNEL(fpu_div_64, BENCH_F64),
+  KERNEL(fpu_sqrt_32, BENCH_F32), KERNEL(fpu_sqrt_64, BENCH_F64),
+  KERNEL(fpu_abs_32, BENCH_F32), KERNEL(fpu_abs_64, BENCH_F64),
+  KERNEL(fpu_neg_32, BENCH_F32), KERNEL(fpu_neg_64, BENCH_F64),
+  KERNEL(fpu_cvt_f32_f64, BENCH_F64), KERNEL(fpu_cvt_f64_f32, BENCH_F32),
+  KERNEL(fpu_cvt_f32_i32, BENCH_I32), KERNEL(fpu_cvt_f32_i64, BENCH_I64),
+  KERNEL(fpu_cvt_f64_i32, BENCH_I32), KERNEL(fpu_cvt_f64_i64, BENCH_I64),
+  KERNEL(fpu_cvt_i32_f32, BENCH_F32), KERNEL(fpu_cvt_i32_f64, BENCH_F64),
+  KERNEL(fpu_cvt_i64_f32, BENCH_F32), KERNEL(fpu_cvt_i64_f64, BENCH_F64),
+  KERNEL(fpu_trunc_i32_f32, BENCH_F32), KERNEL(fpu_trunc_i32_f64, BENCH_F64),
+  KERNEL(fpu_trunc_i64_f32, BENCH_F32), KERNEL(fpu_trunc_i64_f64, BENCH_F64),
+  ROUNDINGS(ceil),
+  ROUNDINGS(floor),
+  ROUNDINGS(round),
+};
+
+// The CP1 handlers, called through the function table as the EX
+// stage does, so they pay for the MCI interlock and FPE checks too.
+struct bench_cp1_op {
+  const char *name;
+  enum vr4300_opcode_id opcode;
+  enum bench_type type;
+};
+
+#define CP1_OP(op, fmt) \
+  {#op "." #fmt, VR4300_OPCODE_CP1_##op, BENCH_CP1_##fmt}
+
+#define BENCH_CP1_S BENCH_F32
+#define BENCH_CP1_D BENCH_F64
+
+static const struct bench_cp1_op bench_cp1_ops[] = {
+  CP1_OP(ADD, S), CP1_OP(ADD, D), CP1_OP(SUB, S), CP1_OP(SUB, D),
+  CP1_OP(MUL, S), CP1_OP(MUL, D), CP1_OP(DIV, S), CP1_OP(DIV, D),
+  CP1_OP(SQRT, S), CP1_OP(SQRT, D), CP1_OP(CVT_D, S), CP1_OP(CVT_S, D),
+  CP1_OP(CVT_W, S), CP1_OP(CVT_W, D), CP1_OP(CVT_L, S), CP1_OP(CVT_L, D),
+  CP1_OP(CEIL_W, S), CP1_OP(CEIL_W, D), CP1_OP(FLOOR_W, S),
+  CP1_OP(FLOOR_W, D), CP1_OP(ROUND_W, S), CP1_OP(ROUND_W, D),
+  CP1_OP(TRUNC_W, S), CP1_OP(TRUNC_W, D),
+};
+
+static double bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t bench_random(void) {
+  static uint64_t x = 0x9E3779B97F4A7C15ULL;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return x;
+}
+
+// Fills every input table: normals in [1, 1024) with either sign,
+// random denormals, quiet NaNs, infinities and integers that fit
+// (exactly or not) in either float format.
+static void bench_init_inputs(void) {
+  unsigned i;
+
+  for (i = 0; i < BENCH_INPUTS; i++) {
+    uint64_t r = bench_random();
+    uint32_t sign32 = (r >> 63) << 31;
+    uint64_t sign64 = (r >> 63) << 63;
+
+    bench_inputs[BENCH_F32][BENCH_NORMAL][i] =
+      sign32 | (127 + r % 10) << 23 | (r >> 8 & 0x7FFFFF);
+    bench_inputs[BENCH_F32][BENCH_DENORMAL][i] =
+      sign32 | ((r >> 8 & 0x7FFFFF) | 1);
+    bench_inputs[BENCH_F32][BENCH_NAN][i] =
+      sign32 | 0x7FC00000 | (r >> 8 & 0x3FFFFF);
+    bench_inputs[BENCH_F32][BENCH_INF][i] = sign32 | 0x7F800000;
+
+    bench_inputs[BENCH_F64][BENCH_NORMAL][i] =
+      sign64 | (1023 + r % 10) << 52 | (r >> 8 & 0xFFFFFFFFFFFFFULL);
+    bench_inputs[BENCH_F64][BENCH_DENORMAL][i] =
+      sign64 | ((r >> 8 & 0xFFFFFFFFFFFFFULL) | 1);
+    bench_inputs[BENCH_F64][BENCH_NAN][i] =
+      sign64 | 0x7FF8000000000000ULL | (r >> 8 & 0x7FFFFFFFFFFFFULL);
+    bench_inputs[BENCH_F64][BENCH_INF][i] = sign64 | 0x7FF0000000000000ULL;
+
+    bench_inputs[BENCH_I32][BENCH_INT][i] = (uint32_t) (int32_t) (r >> 32);
+    bench_inputs[BENCH_I64][BENCH_INT][i] = r >> (r & 0x1F);
+  }
+}
+
+static bool bench_type_has_class(enum bench_type type, enum bench_class c) {
+  return (type == BENCH_I32 || type == BENCH_I64) == (c == BENCH_INT);
+}
+
+static bool bench_match(const char *filter, const char *name) {
+  return !filter || strstr(name, filter);
+}
+
+static void bench_report(const char *path, const char *name,
+  const char *flavour, enum bench_class c, enum bench_measure measure,
+  unsigned long n, double elapsed) {
+  printf("%s,%s,%s,%s,%s,%lu,%.3f\n", path, name, flavour,
+    bench_class_names[c], bench_measure_names[measure], n,
+    elapsed * 1e9 / n);
+}
+
+// Runs once to warm up, then keeps the best of a few runs.
+static double bench_time(bench_fn run, const uint64_t *fs,
+  const uint64_t *ft, unsigned long n, enum bench_measure measure) {
+  double best = 0;
+  unsigned i;
+
+  run(fs, ft, BENCH_INPUTS, measure);
+
+  for (i = 0; i < 3; i++) {
+    double start = bench_now(), elapsed;
+
+    run(fs, ft, n, measure);
+    elapsed = bench_now() - start;
+
+    if (i == 0 || elapsed < best)
+      best = elapsed;
+  }
+
+  return best;
+}
+
+static void bench_run_kernels(unsigned long n, const char *filter) {
+  unsigned i, c, m;
+
+  for (i = 0; i < sizeof(bench_kernels) / sizeof(*bench_kernels); i++) {
+    const struct bench_kernel *k = bench_kernels + i;
+
+    if (!bench_match(filter, k->name))
+      continue;
+
+    if (k->isa && !(__builtin_cpu_init(), (!strcmp(k->isa, "avx")
+      ? __builtin_cpu_supports("avx") : __builtin_cpu_supports("sse4.1"))))
+      continue;
+
+    for (c = 0; c < NUM_BENCH_CLASSES; c++) {
+      const uint64_t *inputs = bench_inputs[k->type][c];
+
+      if (!bench_type_has_class(k->type, c))
+        continue;
+
+      for (m = 0; m < NUM_BENCH_MEASURES; m++) {
+        double elapsed = bench_time(k->run, inputs, inputs, n, m);
+        bench_report("kernel", k->name, k->flavour, c, m, n, elapsed);
+      }
+    }
+  }
+}
+
+static struct vr4300 *bench_cp1_vr4300;
+static vr4300_function bench_cp1_function;
+static uint32_t bench_cp1_iw;
+
+static void bench_cp1(const uint64_t *fs, const uint64_t *ft,
+  unsigned long n, enum bench_measure measure) {
+  struct vr4300 *vr4300 = bench_cp1_vr4300;
+  vr4300_function function = bench_cp1_function;
+  uint64_t zero = bench_zero, acc = 0;
+  uint32_t iw = bench_cp1_iw;
+  unsigned long i;
+
+  for (i = 0; i < n; i++) {
+    uint64_t x = fs[i & (BENCH_INPUTS - 1)];
+    uint64_t y = ft[(i + 1) & (BENCH_INPUTS - 1)];
+
+    if (measure == BENCH_LATENCY)
+      x ^= acc & zero;
+
+    function(vr4300, iw, x, y);
+    acc ^= vr4300->pipeline.exdc_latch.result;
+  }
+
+  bench_sink = acc;
+}
+
+static int bench_run_cp1(unsigned long n, const char *filter) {
+  struct bus_controller bus;
+  unsigned i, c, m;
+
+  memset(&bus, 0, sizeof(bus));
+
+  if ((bench_cp1_vr4300 = vr4300_alloc()) == NULL)
+    return 1;
+
+  vr4300_init(bench_cp1_vr4300, &bus);
+
+  for (i = 0; i < sizeof(bench_cp1_ops) / sizeof(*bench_cp1_ops); i++) {
+    const struct bench_cp1_op *op = bench_cp1_ops + i;
+    unsigned fmt = op->type == BENCH_F32 ? 16 : 17;
+
+    if (!bench_match(filter, op->name))
+      continue;
+
+    // COP1 S (16) or D (17), ft = $f2, fs = $f0, fd = $f4.
+    bench_cp1_iw = 0x11U << 26 | fmt << 21 | 2 << 16 | 4 << 6;
+    bench_cp1_function = vr4300_function_table[op->opcode];
+
+    for (c = 0; c < NUM_BENCH_CLASSES; c++) {
+      const uint64_t *inputs = bench_inputs[op->type][c];
+
+      if (!bench_type_has_class(op->type, c))
+        continue;
+
+      for (m = 0; m < NUM_BENCH_MEASURES; m++) {
+        double elapsed = bench_time(bench_cp1, inputs, inputs, n, m);
+        bench_report("cp1", op->name, "default", c, m, n, elapsed);
+      }
+    }
+  }
+
+  vr4300_free(bench_cp1_vr4300);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long n = 1UL << 22;
+  const char *filter = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "f:n:")) != -1) {
+    switch (opt) {
+      case 'f':
+        filter = optarg;
+        break;
+
+      case 'n':
+        n = strtoul(optarg, NULL, 0);
+        break;
+
+      default:
+        printf("Usage: %s [-n ops] [-f name filter]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (n == 0)
+    return 1;
+
+  bench_init_inputs();
+
+  // One CSV row per kernel/flavour, input class and measurement.
+  printf("# dispatch: %s\n", fpu_dispatch_level());
+  printf("path,name,flavour,inputs,measure,ops,ns_per_op\n");
+
+  bench_run_kernels(n, filter);
+  return bench_run_cp1(n, filter);
+}
+
@@ -0,0 +1,248 @@
+//
+// bench/vr4300_bench.c: VR4300 host cache behaviour benchmark.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#include "common.h"
+#include "common/perf.h"
+#include "common/ram.h"
+#include "bus/controller.h"
+#include "vr4300/cpu.h"
+#include "mips.h"
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_ENTRY_POINT 0x801E4B10U
+#define BENCH_MEM_SIZE (64 * 1024 * 1024)
+#define BENCH_BATCH 10000
+
+#define I_TYPE(op, rs, rt, imm) \
+  (((op) << 26) | ((rs) << 21) | ((rt) << 16) | ((imm) & 0xFFFF))
+#define R_TYPE(rs, rt, rd, funct) \
+  (((rs) << 21) | ((rt) << 16) | ((rd) << 11) | (funct))
+#define SHIFT(rt, rd, sa, funct) \
+  (((rt) << 16) | ((rd) << 11) | ((sa) << 6) | (funct))
+
+enum { ZERO = 0, T0 = 8, T1 = 9, T2 = 10, S0 = 16, S1 = 17, S2 = 18, S3 = 19 };
+
+// Walks a 16 KiB buffer (twice the size of the dcache) doing
+// read-modify-writes with some ALU work and a backwards branch.
+static const uint32_t bench_stream_program[] = {
+  I_TYPE(0x0F, ZERO, S0, 0x8010),       // lui   s0, 0x8010
+  I_TYPE(0x0D, ZERO, S1, 0x0000),       // ori   s1, zero, 0
+  R_TYPE(S0, S1, T0, 0x21),             // loop: addu t0, s0, s1
+  I_TYPE(0x23, T0, T1, 0x0000),         // lw    t1, 0(t0)
+  I_TYPE(0x09, T1, T1, 0x0001),         // addiu t1, t1, 1
+  I_TYPE(0x2B, T0, T1, 0x0000),         // sw    t1, 0(t0)
+  R_TYPE(T1, S1, T2, 0x26),             // xor   t2, t1, s1
+  R_TYPE(S2, T2, S2, 0x21),             // addu  s2, s2, t2
+  I_TYPE(0x09, S1, S1, 0x0010),         // addiu s1, s1, 16
+  I_TYPE(0x0C, S1, S1, 0x3FF0),         // andi  s1, s1, 0x3FF0
+  I_TYPE(0x04, ZERO, ZERO, -9),         // beq   zero, zero, loop
+  0x00000000,                           // nop
+};
+
+// Loads from all over RAM, at addresses from a xorshift generator,
+// so nearly every dcache miss lands on a different host page.
+static const uint32_t bench_random_program[] = {
+  I_TYPE(0x0F, ZERO, S0, 0x03FF),       // lui   s0, 0x03FF
+  I_TYPE(0x0D, S0, S0, 0xFFFC),         // ori   s0, s0, 0xFFFC
+  I_TYPE(0x0F, ZERO, S3, 0x8000),       // lui   s3, 0x8000
+  I_TYPE(0x0F, ZERO, S1, 0x2545),       // lui   s1, 0x2545
+  I_TYPE(0x0D, S1, S1, 0xF491),         // ori   s1, s1, 0xF491
+  SHIFT(S1, T0, 13, 0x00),              // loop: sll t0, s1, 13
+  R_TYPE(S1, T0, S1, 0x26),             // xor   s1, s1, t0
+  SHIFT(S1, T0, 17, 0x02),              // srl   t0, s1, 17
+  R_TYPE(S1, T0, S1, 0x26),             // xor   s1, s1, t0
+  SHIFT(S1, T0, 5, 0x00),               // sll   t0, s1, 5
+  R_TYPE(S1, T0, S1, 0x26),             // xor   s1, s1, t0
+  R_TYPE(S1, S0, T0, 0x24),             // and   t0, s1, s0
+  R_TYPE(T0, S3, T0, 0x25),             // or    t0, t0, s3
+  I_TYPE(0x23, T0, T1, 0x0000),         // lw    t1, 0(t0)
+  R_TYPE(S2, T1, S2, 0x21),             // addu  s2, s2, t1
+  I_TYPE(0x04, ZERO, ZERO, -11),        // beq   zero, zero, loop
+  0x00000000,                           // nop
+};
+
+struct bench_workload {
+  const char *name;
+  const uint32_t *program;
+  size_t size;
+};
+
+static const struct bench_workload bench_workloads[] = {
+  {"stream", bench_stream_program, sizeof(bench_stream_program)},
+  {"random", bench_random_program, sizeof(bench_random_program)},
+};
+
+struct bench_machine {
+  struct bus_controller bus;
+  struct vr4300 *vr4300;
+  Mips *emu;
+  uint8_t *mem;
+  enum ram_pages pages;
+};
+
+static double bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Maps RAM the way the emulator does (or with huge pages), loads the
+// program and primes the pipeline at the entry point.
+static int bench_machine_init(struct bench_machine *machine,
+  const struct ram_image *image, const struct bench_workload *workload,
+  bool huge_pages) {
+  uint32_t entry = BENCH_ENTRY_POINT & 0x1FFFFFFF;
+  struct vr4300 *vr4300;
+
+  machine->pages = RAM_PAGES_SMALL;
+  machine->mem = huge_pages
+    ? ram_image_map_huge(image, &machine->pages)
+    : ram_image_map(image);
+
+  if (machine->mem == NULL ||
+    (machine->emu = new_mips(BENCH_MEM_SIZE)) == NULL ||
+    (machine->vr4300 = vr4300 = vr4300_alloc()) == NULL ||
+    bus_init(&machine->bus, machine->mem, BENCH_MEM_SIZE, machine->emu))
+    return 1;
+
+  memcpy(machine->mem + entry, workload->program, workload->size);
+
+  vr4300_init(vr4300, &machine->bus);
+  vr4300->pipeline.icrf_latch.pc = (int32_t) BENCH_ENTRY_POINT;
+
+  while (vr4300->pipeline.dcwb_latch.common.pc != (int32_t) BENCH_ENTRY_POINT ||
+    (vr4300->pipeline.dcwb_latch.common.fault ||
+    vr4300->pipeline.dcwb_latch.common.killed))
+    vr4300_cycle(vr4300);
+
+  return 0;
+}
+
+static void bench_machine_destroy(struct bench_machine *machine) {
+  if (machine->vr4300)
+    vr4300_free(machine->vr4300);
+
+  if (machine->emu)
+    free_mips(machine->emu);
+
+  bus_destroy(&machine->bus);
+  ram_unmap(machine->mem, BENCH_MEM_SIZE);
+}
+
+int main(int argc, char *argv[]) {
+  const struct bench_workload *workload = bench_workloads;
+  unsigned long long pcycles = 100000000ULL, done;
+  struct bench_machine *machines;
+  struct perf_counters counters;
+  unsigned i, instances = 1;
+  struct ram_image image;
+  bool huge_pages = false;
+  double start, elapsed;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:i:Lw:")) != -1) {
+    switch (opt) {
+      case 'c':
+        pcycles = strtoull(optarg, NULL, 0);
+        break;
+
+      case 'i':
+        instances = strtoul(optarg, NULL, 0);
+        break;
+
+      case 'L':
+        huge_pages = true;
+        break;
+
+      case 'w':
+        for (i = 0; i < sizeof(bench_workloads) /
+          sizeof(*bench_workloads); i++) {
+          if (!strcmp(optarg, bench_workloads[i].name))
+            break;
+        }
+
+        if (i < sizeof(bench_workloads) / sizeof(*bench_workloads)) {
+          workload = bench_workloads + i;
+          break;
+        }
+
+        // Fall through.
+
+      default:
+        printf("Usage: %s [-c pcycles] [-i instances] [-L] "
+          "[-w stream|random]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (instances == 0 || (machines = calloc(
+    instances, sizeof(*machines))) == NULL)
+    return 1;
+
+  if (ram_image_create(&image, BENCH_MEM_SIZE)) {
+    printf("Failed to create a RAM image.\n");
+    return 1;
+  }
+
+  for (i = 0; i < instances; i++) {
+    if (bench_machine_init(machines + i, &image, workload, huge_pages)) {
+      printf("Failed to create machine %u.\n", i);
+      return 1;
+    }
+  }
+
+  ram_image_close(&image);
+
+  if (perf_counters_open(&counters) == 0)
+    printf("No host performance counters; reporting time only.\n");
+
+  // Round-robin the machines a batch at a time, like a pool worker.
+  perf_counters_start(&counters);
+  start = bench_now();
+
+  for (done = 0; done < pcycles; done += BENCH_BATCH) {
+    struct vr4300 *vr4300 = machines[(done / BENCH_BATCH) % instances].vr4300;
+
+    for (i = 0; i < BENCH_BATCH; i++)
+      vr4300_cycle(vr4300);
+  }
+
+  elapsed = bench_now() - start;
+  perf_counters_stop(&counters);
+
+  printf("sizeof(struct vr4300): %zu bytes\n", sizeof(struct vr4300));
+  printf("instances: %u\n", instances);
+  printf("workload: %s\n", workload->name);
+  printf("ram: %s\n", huge_pages
+    ? ram_pages_names[machines[0].pages] : "copy-on-write view");
+  printf("pcycles: %llu\n", done);
+  printf("ns/pcycle: %.3f\n", elapsed * 1e9 / done);
+
+  for (i = 0; i < NUM_PERF_COUNTERS; i++) {
+    if (!perf_counter_available(&counters, i))
+      printf("%s/pcycle: n/a\n", perf_counter_names[i]);
+
+    else
+      printf("%s/pcycle: %.4f\n", perf_counter_names[i],
+        (double) counters.values[i] / done);
+  }
+
+  perf_counters_close(&counters);
+
+  for (i = 0; i < instances; i++)
+    bench_machine_destroy(machines + i);
+
+  free(machines);
+  return 0;
+}
+
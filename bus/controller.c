@@ -12,11 +12,10 @@
 #include "bus/address.h"
 #include "bus/controller.h"
 #include "bus/memorymap.h"
+#include "common/snapshot.h"
 #include "mips.h"
 #include "vr4300/cpu.h"
 
-#define NUM_MAPPINGS 1
-
 static int read_uart(void *opaque, uint32_t address, uint32_t *word) {
   Mips * mips = (Mips *) opaque;
 
@@ -31,6 +30,81 @@ static int write_uart(void *opaque, uint32_t address, uint32_t word, uint32_t dq
   return 0;
 }
 
+static int read_blkdev(void *opaque, uint32_t address, uint32_t *word) {
+  Mips * mips = (Mips *) opaque;
+
+  *word = blkdev_read(mips, address - BLKDEVBASE);
+  return 0;
+}
+
+// Device registers are word-only: byte and halfword stores are dropped,
+// as merging them would need a read with side effects.
+static int write_blkdev(void *opaque, uint32_t address, uint32_t word, uint32_t dqm) {
+  Mips * mips = (Mips *) opaque;
+
+  if (dqm != ~0U)
+    return 0;
+
+  blkdev_write(mips, address - BLKDEVBASE, word);
+  return 0;
+}
+
+// The console reads its ring out of the bus's RAM, not the cmips one.
+static int read_console(void *opaque, uint32_t address, uint32_t *word) {
+  struct bus_controller *bus = (struct bus_controller *) opaque;
+
+  *word = console_read(bus->emu, address - CONSBASE);
+  return 0;
+}
+
+static int write_console(void *opaque, uint32_t address, uint32_t word, uint32_t dqm) {
+  struct bus_controller *bus = (struct bus_controller *) opaque;
+
+  if (dqm != ~0U)
+    return 0;
+
+  console_write(bus->emu, (const uint32_t *) bus->mem, address - CONSBASE, word);
+  return 0;
+}
+
+// The DMA engine works on the bus's RAM, not the cmips one.
+static int read_dma(void *opaque, uint32_t address, uint32_t *word) {
+  struct bus_controller *bus = (struct bus_controller *) opaque;
+
+  *word = dma_read(bus->emu, address - DMABASE);
+  return 0;
+}
+
+static int write_dma(void *opaque, uint32_t address, uint32_t word, uint32_t dqm) {
+  struct bus_controller *bus = (struct bus_controller *) opaque;
+
+  if (dqm != ~0U)
+    return 0;
+
+  dma_write(bus->emu, (uint32_t *) bus->mem, address - DMABASE, word);
+  return 0;
+}
+
+static int read_power(void *opaque, uint32_t address, uint32_t *word) {
+  (void) opaque;
+  (void) address;
+
+  *word = 0;
+  return 0;
+}
+
+static int write_power(void *opaque, uint32_t address, uint32_t word, uint32_t dqm) {
+  Mips * mips = (Mips *) opaque;
+
+  (void) address;
+  (void) word;
+  (void) dqm;
+
+  uart_flush(mips);
+  mips->shutdown = 1;
+  return 0;
+}
+
 // Initializes the bus component.
 int bus_init(struct bus_controller *bus,
   uint8_t *mem, size_t mem_size, Mips *emu) {
@@ -42,21 +116,96 @@ int bus_init(struct bus_controller *bus,
   uart_Reset(bus->emu);
 
   create_memory_map(&bus->map);
-  map_address_range(&bus->map, UARTBASE, UARTSIZE,
-    emu, read_uart, write_uart);
 
+  if (map_ram_range(&bus->map, 0, mem_size, mem) ||
+    map_address_range(&bus->map, UARTBASE, UARTSIZE,
+    emu, read_uart, write_uart) ||
+    map_address_range(&bus->map, BLKDEVBASE, BLKDEVSIZE,
+    emu, read_blkdev, write_blkdev) ||
+    map_address_range(&bus->map, CONSBASE, CONSSIZE,
+    bus, read_console, write_console) ||
+    map_address_range(&bus->map, DMABASE, DMASIZE,
+    bus, read_dma, write_dma) ||
+    map_address_range(&bus->map, POWERBASE, POWERSIZE,
+    emu, read_power, write_power)) {
+    destroy_memory_map(&bus->map);
+    return 1;
+  }
+
+  return 0;
+}
+
+// Releases anything the bus component allocated.
+void bus_destroy(struct bus_controller *bus) {
+  destroy_memory_map(&bus->map);
+}
+
+// Writes guest RAM and device state out to a snapshot.
+int bus_save_snapshot(const struct bus_controller *bus,
+  struct snapshot_writer *writer) {
+  if (snapshot_write_section(writer, SNAPSHOT_SECTION_UART,
+    &bus->emu->serial, sizeof(bus->emu->serial)) ||
+    snapshot_write_section(writer, SNAPSHOT_SECTION_BLKDEV,
+    &bus->emu->blk, sizeof(bus->emu->blk)) ||
+    snapshot_write_section(writer, SNAPSHOT_SECTION_CONSOLE,
+    &bus->emu->cons, sizeof(bus->emu->cons)) ||
+    snapshot_write_section(writer, SNAPSHOT_SECTION_DMA,
+    &bus->emu->dma, sizeof(bus->emu->dma)))
+    return 1;
+
+  return snapshot_write_section(writer,
+    SNAPSHOT_SECTION_RAM, bus->mem, bus->mem_size);
+}
+
+// Restores guest RAM and device state from a snapshot.
+int bus_load_snapshot(struct bus_controller *bus,
+  const struct snapshot *snapshot) {
+  const void *mem, *uart, *blk, *cons, *dma;
+  size_t mem_size, uart_size, blk_size, cons_size, dma_size;
+
+  if ((mem = snapshot_get_section(snapshot,
+    SNAPSHOT_SECTION_RAM, &mem_size)) == NULL || mem_size != bus->mem_size)
+    return 1;
+
+  if ((uart = snapshot_get_section(snapshot,
+    SNAPSHOT_SECTION_UART, &uart_size)) == NULL ||
+    uart_size != sizeof(bus->emu->serial))
+    return 1;
+
+  if ((blk = snapshot_get_section(snapshot,
+    SNAPSHOT_SECTION_BLKDEV, &blk_size)) == NULL ||
+    blk_size != sizeof(bus->emu->blk))
+    return 1;
+
+  if ((cons = snapshot_get_section(snapshot,
+    SNAPSHOT_SECTION_CONSOLE, &cons_size)) == NULL ||
+    cons_size != sizeof(bus->emu->cons))
+    return 1;
+
+  if ((dma = snapshot_get_section(snapshot,
+    SNAPSHOT_SECTION_DMA, &dma_size)) == NULL ||
+    dma_size != sizeof(bus->emu->dma))
+    return 1;
+
+  memcpy(bus->mem, mem, mem_size);
+  memcpy(&bus->emu->serial, uart, uart_size);
+  memcpy(&bus->emu->blk, blk, blk_size);
+  memcpy(&bus->emu->cons, cons, cons_size);
+  memcpy(&bus->emu->dma, dma, dma_size);
   return 0;
 }
 
 // Issues a read request to the bus.
 int bus_read_word(void *component, uint32_t address, uint32_t *word) {
+  const struct memory_map_page *page;
   const struct memory_mapping *node;
   struct bus_controller *bus;
 
   memcpy(&bus, component, sizeof(bus));
+  page = resolve_mapped_page(&bus->map, address);
 
-  if (address < bus->mem_size) {
-    memcpy(word, bus->mem + address, sizeof(*word));
+  if (likely(page != NULL && page->ram != NULL)) {
+    memcpy(word, page->ram + (address & MEMORY_MAP_PAGE_MASK), sizeof(*word));
     //*word = byteswap_32(*word);
     return 0;
   }
@@ -75,20 +224,23 @@ int bus_read_word(void *component, uint32_t address, uint32_t *word) {
 // Issues a write request to the bus.
 int bus_write_word(void *component,
   uint32_t address, uint32_t word, uint32_t dqm) {
+  const struct memory_map_page *page;
   const struct memory_mapping *node;
   struct bus_controller *bus;
 
   memcpy(&bus, component, sizeof(bus));
+  page = resolve_mapped_page(&bus->map, address);
 
-  if (address < bus->mem_size) {
+  if (likely(page != NULL && page->ram != NULL)) {
+    uint8_t *ram = page->ram + (address & MEMORY_MAP_PAGE_MASK);
     uint32_t orig_word;
 
-    memcpy(&orig_word, bus->mem + address, sizeof(orig_word));
+    memcpy(&orig_word, ram, sizeof(orig_word));
     //orig_word = byteswap_32(orig_word) & ~dqm;
     //word = byteswap_32(orig_word | word);
     orig_word = orig_word & ~dqm;
     word = orig_word | (word & dqm);
-    memcpy(bus->mem + address, &word, sizeof(word));
+    memcpy(ram, &word, sizeof(word));
     return 0;
   }
 
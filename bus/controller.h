@@ -15,6 +15,9 @@
 #include "mips.h"
 #include <setjmp.h>
 
+struct snapshot;
+struct snapshot_writer;
+
 struct bus_controller {
   Mips * emu;
   size_t mem_size;
@@ -31,6 +34,12 @@ struct bus_controller {
 
 cen64_cold int bus_init(struct bus_controller *bus,
   uint8_t *mem, size_t mem_size, Mips * emu);
+cen64_cold void bus_destroy(struct bus_controller *bus);
+
+cen64_cold int bus_save_snapshot(const struct bus_controller *bus,
+  struct snapshot_writer *writer);
+cen64_cold int bus_load_snapshot(struct bus_controller *bus,
+  const struct snapshot *snapshot);
 
 // General-purpose accesssor functions.
 cen64_flatten cen64_hot int bus_read_word(void *component,
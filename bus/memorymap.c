@@ -11,205 +11,158 @@
 #include "common.h"
 #include "memorymap.h"
 
-static void fixup(struct memory_map *, struct memory_map_node *);
-static void rotate_left(struct memory_map *, struct memory_map_node *);
-static void rotate_right(struct memory_map *, struct memory_map_node *);
-
 // Creates a new memory map.
 void create_memory_map(struct memory_map *map) {
-  map->next_map_index = 1;
-  map->nil = map->mappings;
-  map->root = map->nil;
+  memset(map, 0, sizeof(*map));
 }
 
-// Rebalances the tree after a node is inserted.
-void fixup(struct memory_map *map, struct memory_map_node *node) {
-  struct memory_map_node *cur;
-
-  // Rebalance the whole tree as needed. 
-  while (node->parent->color == MEMORY_MAP_RED) {
-    if (node->parent == node->parent->parent->left) {
-      cur = node->parent->parent->right;
-
-      // Case 1: We only need to update colors.
-      if (cur->color == MEMORY_MAP_RED) {
-        node->parent->color = MEMORY_MAP_BLACK;
-        cur->color = MEMORY_MAP_BLACK;
-        node->parent->parent->color = MEMORY_MAP_RED;
-        node = node->parent->parent;
-      }
-
-      else {
-
-        // Case 2: We need to perform a left rotation.
-        if (node == node->parent->right) {
-          node = node->parent;
-          rotate_left(map, node);
-        }
-
-        // Case 3: We need to perform a right rotation.
-        node->parent->color = MEMORY_MAP_BLACK;
-        node->parent->parent->color = MEMORY_MAP_RED;
-        rotate_right(map, node->parent->parent);
-      }
-    }
+// Releases the tables and mappings of a memory map.
+void destroy_memory_map(struct memory_map *map) {
+  struct memory_mapping *mapping, *next;
+  unsigned i;
 
-    else {
-      cur = node->parent->parent->left;
-
-      // Case 1: We only need to update colors.
-      if (cur->color == MEMORY_MAP_RED) {
-        node->parent->color = MEMORY_MAP_BLACK;
-        cur->color = MEMORY_MAP_BLACK;
-        node->parent->parent->color = MEMORY_MAP_RED;
-        node = node->parent->parent;
-      }
-
-      else {
-
-        // Case 2: We need to perform a right rotation.
-        if (node == node->parent->left) {
-          node = node->parent;
-          rotate_right(map, node);
-        }
-
-        // Case 3: We need to perform a left rotation.
-        node->parent->color = MEMORY_MAP_BLACK;
-        node->parent->parent->color = MEMORY_MAP_RED;
-        rotate_left(map, node->parent->parent);
-      }
-    }
+  for (mapping = map->mappings; mapping != NULL; mapping = next) {
+    next = mapping->next;
+    free(mapping);
   }
 
-  // When we rebalanced the tree, we might have accidentally colored
-  // the root red, so unconditionally color if back after rebalancing.
-  map->root->color = MEMORY_MAP_BLACK;
+  for (i = 0; i < MEMORY_MAP_NUM_TABLES; i++)
+    free(map->tables[i]);
+
+  memset(map, 0, sizeof(*map));
+}
+
+// Returns the page holding an address, allocating its table if needed.
+static struct memory_map_page *get_page(
+  struct memory_map *map, uint32_t address) {
+  unsigned table = address >> (MEMORY_MAP_PAGE_BITS + MEMORY_MAP_TABLE_BITS);
+  unsigned page = address >> MEMORY_MAP_PAGE_BITS & (MEMORY_MAP_TABLE_SIZE - 1);
+
+  if (map->tables[table] == NULL && (map->tables[table] = calloc(
+    MEMORY_MAP_TABLE_SIZE, sizeof(*map->tables[table]))) == NULL)
+    return NULL;
+
+  return map->tables[table] + page;
 }
 
-// Inserts a mapping into the tree.
+// Maps a device over a range of addresses. Devices can share pages
+// with other devices (but not with RAM), but not addresses.
 int map_address_range(struct memory_map *map, uint32_t start, uint32_t length,
   void *instance, memory_rd_function on_read, memory_wr_function on_write) {
-  struct memory_map_node *check = map->root;
-  struct memory_map_node *cur = map->nil;
   uint32_t end = start + length - 1;
+  uint32_t first = start & ~MEMORY_MAP_PAGE_MASK;
+  uint32_t last = end & ~MEMORY_MAP_PAGE_MASK;
+  struct memory_mapping *mapping;
+  uint32_t address;
 
-  struct memory_map_node *new_node;
-  struct memory_mapping mapping;
-
-  // Make sure we have enough space in the map.
-  const unsigned num_mappings = sizeof(map->mappings) /
-    sizeof(map->mappings[0]) - 1;
-
-  if (unlikely(map->next_map_index >= num_mappings)) {
-    debug("map_address_range: Out of free mappings.");
+  if (unlikely(length == 0 || end < start)) {
+    debug("map_address_range: Invalid range.");
     return 1;
   }
 
-  new_node =  &map->mappings[map->next_map_index++];
-
-  // Walk down the tree.
-  while (check != map->nil) {
-    cur = check;
-
-    check = (start < cur->mapping.start)
-      ? check->left : check->right;
+  for (mapping = map->mappings; mapping != NULL; mapping = mapping->next) {
+    if (start <= mapping->end && end >= mapping->start) {
+      debug("map_address_range: Range overlaps another device.");
+      return 1;
+    }
   }
 
-  // Insert the entry.
-  if (cur == map->nil)
-    map->root = new_node;
+  // Check every page before touching any, so a failure leaves the
+  // map as it was.
+  for (address = first; ; address += MEMORY_MAP_PAGE_SIZE) {
+    struct memory_map_page *page = get_page(map, address);
+
+    if (page == NULL || page->ram != NULL) {
+      debug("map_address_range: Range overlaps RAM or out of memory.");
+      return 1;
+    }
 
-  else if (start < cur->mapping.start)
-    cur->left = new_node;
-  else
-    cur->right = new_node;
+    if (address == last)
+      break;
+  }
 
-  new_node->left = map->nil;
-  new_node->right = map->nil;
-  new_node->parent = cur;
+  if ((mapping = malloc(sizeof(*mapping))) == NULL) {
+    debug("map_address_range: Out of memory.");
+    return 1;
+  }
 
   // Initialize the entry.
-  mapping.instance = instance;
-  mapping.on_read = on_read;
-  mapping.on_write = on_write;
+  mapping->instance = instance;
+  mapping->on_read = on_read;
+  mapping->on_write = on_write;
 
-  mapping.end = end;
-  mapping.length = length;
-  mapping.start = start;
+  mapping->end = end;
+  mapping->length = length;
+  mapping->start = start;
 
-  new_node->mapping = mapping;
-
-  // Rebalance the tree.
-  new_node->color = MEMORY_MAP_RED;
-  fixup(map, new_node);
-  return 0;
-}
+  mapping->next = map->mappings;
+  map->mappings = mapping;
 
-// Returns a pointer to a region given an address.
-const struct memory_mapping *resolve_mapped_address(
-  const struct memory_map *map, uint32_t address) {
-  const struct memory_map_node *cur = map->root;
+  // Point every page it touches at it; the tables all exist by now.
+  for (address = first; ; address += MEMORY_MAP_PAGE_SIZE) {
+    struct memory_map_page *page = get_page(map, address);
 
-  do {
-    if (address < cur->mapping.start)
-      cur = cur->left;
-    else if (address > cur->mapping.end)
-      cur = cur->right;
+    if (page->mapping != NULL || page->shared) {
+      page->mapping = NULL;
+      page->shared = true;
+    }
 
     else
-      return &cur->mapping;
-  } while (cur != map->nil);
+      page->mapping = mapping;
 
-  return NULL;
+    if (address == last)
+      break;
+  }
+
+  return 0;
 }
 
-// Performs a left rotation centered at n.
-static void rotate_left(struct memory_map *map, struct memory_map_node *n) {
-  struct memory_map_node *y = n->right;
+// Maps host memory as RAM over a page-aligned range of addresses.
+int map_ram_range(struct memory_map *map,
+  uint32_t start, uint32_t length, uint8_t *ram) {
+  uint32_t offset;
 
-  // Turn y's left subtree into n's right subtree.
-  n->right = y->left;
+  if (unlikely((start | length) & MEMORY_MAP_PAGE_MASK)) {
+    debug("map_ram_range: Range is not page aligned.");
+    return 1;
+  }
 
-  if (y->left != map->nil)
-    y->left->parent = n;
+  for (offset = 0; offset < length; offset += MEMORY_MAP_PAGE_SIZE) {
+    struct memory_map_page *page = get_page(map, start + offset);
 
-  // Link n's parent to y.
-  y->parent = n->parent;
+    if (page == NULL || page->mapping != NULL || page->shared) {
+      debug("map_ram_range: Range overlaps a device or out of memory.");
+      return 1;
+    }
+  }
 
-  if (n->parent == map->nil)
-    map->root = y;
-  else if (n == n->parent->left)
-    n->parent->left = y;
-  else
-    n->parent->right = y;
+  for (offset = 0; offset < length; offset += MEMORY_MAP_PAGE_SIZE)
+    get_page(map, start + offset)->ram = ram + offset;
 
-  // Put n on y's left.
-  y->left = n;
-  n->parent = y;
+  return 0;
 }
 
-// Performs a right rotation centered at n.
-static void rotate_right(struct memory_map *map, struct memory_map_node *n) {
-  struct memory_map_node *y = n->left;
+// Returns a pointer to a region given an address.
+const struct memory_mapping *resolve_mapped_address(
+  const struct memory_map *map, uint32_t address) {
+  const struct memory_map_page *page = resolve_mapped_page(map, address);
+  const struct memory_mapping *mapping;
 
-  // Turn y's right subtree into n's left subtree.
-  n->left = y->right;
+  if (page == NULL)
+    return NULL;
 
-  if (y->right != map->nil)
-    y->right->parent = n;
+  if (likely(!page->shared)) {
+    mapping = page->mapping;
 
-  // Link n's parent to y.
-  y->parent = n->parent;
+    return mapping != NULL && address >= mapping->start &&
+      address <= mapping->end ? mapping : NULL;
+  }
 
-  if (n->parent == map->nil)
-    map->root = y;
-  else if (n == n->parent->left)
-    n->parent->left = y;
-  else
-    n->parent->right = y;
+  for (mapping = map->mappings; mapping != NULL; mapping = mapping->next) {
+    if (address >= mapping->start && address <= mapping->end)
+      return mapping;
+  }
 
-  // Put n on y's right.
-  y->right = n;
-  n->parent = y;
+  return NULL;
 }
 
@@ -12,15 +12,23 @@
 #define __bus_memory_map_h__
 #include "common.h"
 
+// The physical address space is split into 4KiB pages, found through
+// a two-level table: the top 10 bits of an address pick a table (which
+// is only allocated once something is mapped in it), the next 10 bits
+// pick the page within it.
+#define MEMORY_MAP_PAGE_BITS 12
+#define MEMORY_MAP_PAGE_SIZE (1U << MEMORY_MAP_PAGE_BITS)
+#define MEMORY_MAP_PAGE_MASK (MEMORY_MAP_PAGE_SIZE - 1)
+
+#define MEMORY_MAP_TABLE_BITS 10
+#define MEMORY_MAP_NUM_TABLES (1U << (32 - MEMORY_MAP_PAGE_BITS - \
+  MEMORY_MAP_TABLE_BITS))
+#define MEMORY_MAP_TABLE_SIZE (1U << MEMORY_MAP_TABLE_BITS)
+
 // Callback functions to handle reads/writes.
 typedef int (*memory_rd_function)(void *, uint32_t, uint32_t *);
 typedef int (*memory_wr_function)(void *, uint32_t, uint32_t, uint32_t);
 
-enum memory_map_color {
-  MEMORY_MAP_BLACK,
-  MEMORY_MAP_RED
-};
-
 struct memory_mapping {
   void *instance;
 
@@ -30,33 +38,49 @@ struct memory_mapping {
   uint32_t length;
   uint32_t start;
   uint32_t end;
-};
 
-struct memory_map_node {
-  struct memory_map_node *left;
-  struct memory_map_node *parent;
-  struct memory_map_node *right;
+  struct memory_mapping *next;
+};
 
-  struct memory_mapping mapping;
-  enum memory_map_color color;
+// A page is backed by RAM (ram points at its first byte), by one
+// device, or by several devices that share it (which get searched).
+struct memory_map_page {
+  uint8_t *ram;
+  const struct memory_mapping *mapping;
+  bool shared;
 };
 
 struct memory_map {
-  struct memory_map_node mappings[3];
+  struct memory_map_page *tables[MEMORY_MAP_NUM_TABLES];
 
-  struct memory_map_node *nil;
-  struct memory_map_node *root;
-  unsigned next_map_index;
+  // Every device mapping, most recently mapped first.
+  struct memory_mapping *mappings;
 };
 
 cen64_cold void create_memory_map(struct memory_map *map);
+cen64_cold void destroy_memory_map(struct memory_map *map);
 
 cen64_cold int map_address_range(struct memory_map *memory_map,
   uint32_t start, uint32_t length, void *instance,
   memory_rd_function on_read, memory_wr_function on_write);
 
+cen64_cold int map_ram_range(struct memory_map *memory_map,
+  uint32_t start, uint32_t length, uint8_t *ram);
+
 cen64_hot const struct memory_mapping* resolve_mapped_address(
   const struct memory_map *memory_map, uint32_t address);
 
+// Returns the page holding an address, or NULL if nothing is mapped
+// anywhere near it.
+static inline const struct memory_map_page *resolve_mapped_page(
+  const struct memory_map *memory_map, uint32_t address) {
+  const struct memory_map_page *table = memory_map->tables[
+    address >> (MEMORY_MAP_PAGE_BITS + MEMORY_MAP_TABLE_BITS)];
+
+  return likely(table != NULL)
+    ? table + (address >> MEMORY_MAP_PAGE_BITS & (MEMORY_MAP_TABLE_SIZE - 1))
+    : NULL;
+}
+
 #endif
 
@@ -0,0 +1,242 @@
+//
+// common/callgraph.c: Guest call-graph profiler.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#include "common.h"
+#include "common/callgraph.h"
+#include "common/symbols.h"
+#include <inttypes.h>
+#include <stdio.h>
+
+static unsigned callgraph_hash(uint32_t parent, uint32_t function) {
+  uint64_t key = (uint64_t) parent << 32 | function;
+  return (key * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+// Rebuilds the child lookup table at twice the size.
+static int callgraph_grow_children(struct callgraph *callgraph) {
+  unsigned size = (callgraph->children_mask + 1) * 2, mask = size - 1;
+  uint32_t *children;
+  unsigned i, j;
+
+  if ((children = calloc(size, sizeof(*children))) == NULL)
+    return 1;
+
+  for (i = 1; i < callgraph->num_nodes; i++) {
+    const struct callgraph_node *node = callgraph->nodes + i;
+
+    for (j = callgraph_hash(node->parent, node->function) & mask;
+      children[j]; j = (j + 1) & mask);
+
+    children[j] = i;
+  }
+
+  free(callgraph->children);
+  callgraph->children = children;
+  callgraph->children_mask = mask;
+  return 0;
+}
+
+// Finds (or adds) the node for a function called from another.
+// Returns the parent itself if we've run out of memory.
+static uint32_t callgraph_child(struct callgraph *callgraph,
+  uint32_t parent, uint32_t function) {
+  struct callgraph_node *node;
+  unsigned i;
+
+  for (i = callgraph_hash(parent, function) & callgraph->children_mask;
+    callgraph->children[i]; i = (i + 1) & callgraph->children_mask) {
+    node = callgraph->nodes + callgraph->children[i];
+
+    if (node->parent == parent && node->function == function)
+      return callgraph->children[i];
+  }
+
+  // Keep the lookup table at most half full.
+  if (callgraph->num_nodes * 2 > callgraph->children_mask) {
+    if (callgraph_grow_children(callgraph) &&
+      callgraph->num_nodes >= callgraph->children_mask / 8 * 7)
+      return parent;
+
+    for (i = callgraph_hash(parent, function) & callgraph->children_mask;
+      callgraph->children[i]; i = (i + 1) & callgraph->children_mask);
+  }
+
+  if (callgraph->num_nodes == callgraph->nodes_capacity) {
+    unsigned capacity = callgraph->nodes_capacity * 2;
+
+    if ((node = realloc(callgraph->nodes,
+      capacity * sizeof(*node))) == NULL)
+      return parent;
+
+    callgraph->nodes = node;
+    callgraph->nodes_capacity = capacity;
+  }
+
+  node = callgraph->nodes + callgraph->num_nodes;
+  node->parent = parent;
+  node->function = function;
+  node->weight = 0;
+
+  callgraph->children[i] = callgraph->num_nodes;
+  return callgraph->num_nodes++;
+}
+
+static void callgraph_push(struct callgraph *callgraph,
+  uint32_t function, uint32_t return_address, bool exception) {
+  struct callgraph_frame *frame;
+
+  if (callgraph->depth == CALLGRAPH_MAX_DEPTH) {
+    callgraph->overflow++;
+    return;
+  }
+
+  frame = callgraph->stack + callgraph->depth++;
+  frame->node = callgraph_child(callgraph, callgraph->current, function);
+  frame->return_address = return_address;
+  frame->exception = exception;
+
+  callgraph->current = frame->node;
+}
+
+static void callgraph_pop_to(struct callgraph *callgraph, unsigned depth) {
+  callgraph->depth = depth;
+  callgraph->current = depth ? callgraph->stack[depth - 1].node : 0;
+}
+
+struct callgraph *callgraph_create(void) {
+  struct callgraph *callgraph;
+
+  if ((callgraph = calloc(1, sizeof(*callgraph))) == NULL)
+    return NULL;
+
+  callgraph->nodes_capacity = 4096;
+  callgraph->children_mask = 8192 - 1;
+
+  if ((callgraph->nodes = calloc(callgraph->nodes_capacity,
+    sizeof(*callgraph->nodes))) == NULL ||
+    (callgraph->children = calloc(callgraph->children_mask + 1,
+    sizeof(*callgraph->children))) == NULL) {
+    callgraph_destroy(callgraph);
+    return NULL;
+  }
+
+  callgraph->num_nodes = 1;
+  return callgraph;
+}
+
+void callgraph_destroy(struct callgraph *callgraph) {
+  free(callgraph->nodes);
+  free(callgraph->children);
+  free(callgraph);
+}
+
+// JAL, JALR: a call to target which returns to return_address.
+void callgraph_call(struct callgraph *callgraph,
+  uint32_t target, uint32_t return_address) {
+  callgraph_push(callgraph, target, return_address, false);
+}
+
+// JR $ra: pops back to the frame that returns to target. Frames
+// skipped on the way are longjmps, tail calls or calls that were
+// replayed after an exception. Returns that match nothing (within
+// the current exception level) are ignored.
+void callgraph_return(struct callgraph *callgraph, uint32_t target) {
+  unsigned i, limit;
+
+  if (callgraph->overflow) {
+    callgraph->overflow--;
+    return;
+  }
+
+  limit = callgraph->depth > CALLGRAPH_RETURN_SEARCH
+    ? callgraph->depth - CALLGRAPH_RETURN_SEARCH : 0;
+
+  for (i = callgraph->depth; i-- > limit; ) {
+    const struct callgraph_frame *frame = callgraph->stack + i;
+
+    if (frame->exception)
+      break;
+
+    if (frame->return_address == target) {
+      callgraph_pop_to(callgraph, i);
+      return;
+    }
+  }
+}
+
+// An exception: the vector runs as if called from wherever we were.
+void callgraph_exception(struct callgraph *callgraph, uint32_t vector) {
+  callgraph_push(callgraph, vector, 0, true);
+}
+
+// ERET: drops everything down to, and including, the innermost
+// exception frame.
+void callgraph_eret(struct callgraph *callgraph) {
+  unsigned i;
+
+  if (callgraph->overflow) {
+    callgraph->overflow--;
+    return;
+  }
+
+  for (i = callgraph->depth; i-- > 0; ) {
+    if (callgraph->stack[i].exception) {
+      callgraph_pop_to(callgraph, i);
+      return;
+    }
+  }
+}
+
+// Writes one "caller;callee;... weight" line per node with any weight,
+// which is what flame graph tools take as input.
+int callgraph_write_folded(const struct callgraph *callgraph,
+  const char *path, const struct symbol_table *symbols) {
+  uint32_t path_nodes[CALLGRAPH_MAX_DEPTH];
+  unsigned i, j, length;
+  FILE *f;
+
+  if ((f = fopen(path, "w")) == NULL)
+    return 1;
+
+  for (i = 0; i < callgraph->num_nodes; i++) {
+    const struct callgraph_node *node = callgraph->nodes + i;
+    uint32_t n;
+
+    if (!node->weight)
+      continue;
+
+    if (i == 0) {
+      fprintf(f, "[unknown] %" PRIu64 "\n", node->weight);
+      continue;
+    }
+
+    for (length = 0, n = i; n && length < CALLGRAPH_MAX_DEPTH;
+      n = callgraph->nodes[n].parent)
+      path_nodes[length++] = n;
+
+    for (j = length; j-- > 0; ) {
+      uint32_t function = callgraph->nodes[path_nodes[j]].function;
+      const char *name = symbols ? symbols_lookup(symbols, function) : NULL;
+
+      if (name)
+        fprintf(f, "%s", name);
+
+      else
+        fprintf(f, "0x%08" PRIx32, function);
+
+      fputc(j ? ';' : ' ', f);
+    }
+
+    fprintf(f, "%" PRIu64 "\n", node->weight);
+  }
+
+  return fclose(f) != 0;
+}
+
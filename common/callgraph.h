@@ -0,0 +1,73 @@
+//
+// common/callgraph.h: Guest call-graph profiler.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#ifndef __common_callgraph_h__
+#define __common_callgraph_h__
+#include "common.h"
+
+// Deepest shadow stack we track; calls past it are only counted.
+#define CALLGRAPH_MAX_DEPTH 512
+
+// Frames searched for a return address before a return is ignored.
+#define CALLGRAPH_RETURN_SEARCH 32
+
+struct symbol_table;
+
+// Node 0 is the root: whatever ran before the first call we saw.
+struct callgraph_node {
+  uint32_t parent;
+  uint32_t function;
+  uint64_t weight;
+};
+
+struct callgraph_frame {
+  uint32_t node;
+  uint32_t return_address;
+  bool exception;
+};
+
+// A call tree built from a shadow call stack. Calls push a frame
+// (and find or add the callee's node under the caller's); returns
+// pop back to the frame they return to. Exceptions push a frame for
+// the vector which ERET pops, along with anything left above it.
+struct callgraph {
+  struct callgraph_node *nodes;
+  unsigned num_nodes, nodes_capacity;
+
+  uint32_t *children;
+  unsigned children_mask;
+
+  struct callgraph_frame stack[CALLGRAPH_MAX_DEPTH];
+  unsigned depth, overflow;
+  uint32_t current;
+};
+
+cen64_cold struct callgraph *callgraph_create(void);
+cen64_cold void callgraph_destroy(struct callgraph *callgraph);
+
+cen64_cold void callgraph_call(struct callgraph *callgraph,
+  uint32_t target, uint32_t return_address);
+cen64_cold void callgraph_return(struct callgraph *callgraph,
+  uint32_t target);
+cen64_cold void callgraph_exception(struct callgraph *callgraph,
+  uint32_t vector);
+cen64_cold void callgraph_eret(struct callgraph *callgraph);
+
+cen64_cold int callgraph_write_folded(const struct callgraph *callgraph,
+  const char *path, const struct symbol_table *symbols);
+
+// Charges instructions or cycles to whatever is running now.
+static inline void callgraph_tick(struct callgraph *callgraph,
+  unsigned weight) {
+  callgraph->nodes[callgraph->current].weight += weight;
+}
+
+#endif
+
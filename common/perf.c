@@ -0,0 +1,184 @@
+//
+// common/perf.c: Host performance counters.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#include "common.h"
+#include "common/perf.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PERF_CACHE_MISS(cache, op) (PERF_COUNT_HW_CACHE_##cache | \
+  (PERF_COUNT_HW_CACHE_OP_##op << 8) | \
+  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const uint32_t perf_counter_types[NUM_PERF_COUNTERS] = {
+  PERF_TYPE_HARDWARE,
+  PERF_TYPE_HARDWARE,
+  PERF_TYPE_HARDWARE,
+  PERF_TYPE_HW_CACHE,
+  PERF_TYPE_HW_CACHE,
+  PERF_TYPE_HW_CACHE,
+  PERF_TYPE_HW_CACHE,
+  PERF_TYPE_SOFTWARE,
+  PERF_TYPE_SOFTWARE,
+  PERF_TYPE_SOFTWARE,
+};
+
+static const uint64_t perf_counter_configs[NUM_PERF_COUNTERS] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_BRANCH_MISSES,
+  PERF_CACHE_MISS(L1D, READ),
+  PERF_CACHE_MISS(L1D, WRITE),
+  PERF_CACHE_MISS(LL, READ),
+  PERF_CACHE_MISS(DTLB, READ),
+  PERF_COUNT_SW_TASK_CLOCK,
+  PERF_COUNT_SW_PAGE_FAULTS,
+  PERF_COUNT_SW_CONTEXT_SWITCHES,
+};
+
+// Each counter's group leader.
+static const uint8_t perf_counter_groups[NUM_PERF_COUNTERS] = {
+  PERF_COUNTER_CYCLES,
+  PERF_COUNTER_CYCLES,
+  PERF_COUNTER_CYCLES,
+  PERF_COUNTER_CYCLES,
+  PERF_COUNTER_CYCLES,
+  PERF_COUNTER_CYCLES,
+  PERF_COUNTER_DTLB_READ_MISSES,
+  PERF_COUNTER_TASK_CLOCK,
+  PERF_COUNTER_TASK_CLOCK,
+  PERF_COUNTER_TASK_CLOCK,
+};
+#endif
+
+const char *perf_counter_names[NUM_PERF_COUNTERS] = {
+  "cycles",
+  "instructions",
+  "branch misses",
+  "L1D read misses",
+  "L1D write misses",
+  "LLC read misses",
+  "dTLB read misses",
+  "task clock (ns)",
+  "page faults",
+  "context switches",
+};
+
+// Opens whatever counters the host supports, initially disabled.
+// Members whose leader couldn't be opened get opened on their own.
+// Returns the number of counters which could be opened.
+unsigned perf_counters_open(struct perf_counters *counters) {
+  unsigned i, opened = 0;
+
+  memset(counters, 0, sizeof(*counters));
+
+  for (i = 0; i < NUM_PERF_COUNTERS; i++) {
+    counters->fds[i] = -1;
+
+#ifdef __linux__
+    struct perf_event_attr attr;
+    int group_fd = counters->fds[perf_counter_groups[i]];
+
+    if (perf_counter_groups[i] == i)
+      group_fd = -1;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = perf_counter_types[i];
+    attr.config = perf_counter_configs[i];
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+      PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = group_fd < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    if ((counters->fds[i] = syscall(SYS_perf_event_open,
+      &attr, 0, -1, group_fd, 0)) >= 0) {
+      counters->leaders[i] = group_fd < 0;
+      opened++;
+    }
+#endif
+  }
+
+  return opened;
+}
+
+// Closes all counters.
+void perf_counters_close(struct perf_counters *counters) {
+#ifdef __linux__
+  unsigned i;
+
+  // Members go before their leaders.
+  for (i = NUM_PERF_COUNTERS; i-- > 0; ) {
+    if (counters->fds[i] >= 0)
+      close(counters->fds[i]);
+
+    counters->fds[i] = -1;
+  }
+#endif
+}
+
+// Zeroes and enables the counters, a group at a time.
+void perf_counters_start(struct perf_counters *counters) {
+#ifdef __linux__
+  unsigned i;
+
+  for (i = 0; i < NUM_PERF_COUNTERS; i++) {
+    if (counters->fds[i] < 0 || !counters->leaders[i])
+      continue;
+
+    ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+#endif
+}
+
+// Latches the current counter values without stopping them. Values
+// are scaled up if the kernel had to multiplex the PMU.
+void perf_counters_read(struct perf_counters *counters) {
+#ifdef __linux__
+  unsigned i;
+
+  for (i = 0; i < NUM_PERF_COUNTERS; i++) {
+    uint64_t data[3];
+
+    counters->values[i] = 0;
+
+    if (counters->fds[i] < 0)
+      continue;
+
+    if (read(counters->fds[i], data, sizeof(data)) != sizeof(data) ||
+      data[2] == 0)
+      continue;
+
+    counters->values[i] = data[2] < data[1]
+      ? (uint64_t) ((double) data[0] * data[1] / data[2]) : data[0];
+  }
+#endif
+}
+
+// Disables the counters and latches their values.
+void perf_counters_stop(struct perf_counters *counters) {
+#ifdef __linux__
+  unsigned i;
+
+  for (i = 0; i < NUM_PERF_COUNTERS; i++) {
+    if (counters->fds[i] >= 0 && counters->leaders[i])
+      ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  }
+#endif
+
+  perf_counters_read(counters);
+}
+
@@ -0,0 +1,57 @@
+//
+// common/perf.h: Host performance counters.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#ifndef __common_perf_h__
+#define __common_perf_h__
+#include "common.h"
+
+// Counters come in groups, each scheduled onto the PMU as a unit and
+// led by its first member: hardware events, dTLB misses (on their own,
+// so the first group still fits a four-counter PMU), and the software
+// events the kernel can always provide.
+enum perf_counter {
+  PERF_COUNTER_CYCLES,
+  PERF_COUNTER_INSTRUCTIONS,
+  PERF_COUNTER_BRANCH_MISSES,
+  PERF_COUNTER_L1D_READ_MISSES,
+  PERF_COUNTER_L1D_WRITE_MISSES,
+  PERF_COUNTER_LLC_MISSES,
+  PERF_COUNTER_DTLB_READ_MISSES,
+  PERF_COUNTER_TASK_CLOCK,
+  PERF_COUNTER_PAGE_FAULTS,
+  PERF_COUNTER_CONTEXT_SWITCHES,
+  NUM_PERF_COUNTERS
+};
+
+// Counters for the calling thread (user mode only). Counters the host
+// can't provide (no PMU, restrictive perf_event_paranoid) stay closed
+// and read back as unavailable; the software group still works then.
+struct perf_counters {
+  int fds[NUM_PERF_COUNTERS];
+  bool leaders[NUM_PERF_COUNTERS];
+  uint64_t values[NUM_PERF_COUNTERS];
+};
+
+extern const char *perf_counter_names[NUM_PERF_COUNTERS];
+
+cen64_cold unsigned perf_counters_open(struct perf_counters *counters);
+cen64_cold void perf_counters_close(struct perf_counters *counters);
+
+cen64_cold void perf_counters_start(struct perf_counters *counters);
+cen64_cold void perf_counters_read(struct perf_counters *counters);
+cen64_cold void perf_counters_stop(struct perf_counters *counters);
+
+static inline bool perf_counter_available(
+  const struct perf_counters *counters, enum perf_counter counter) {
+  return counters->fds[counter] >= 0;
+}
+
+#endif
+
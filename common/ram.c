@@ -0,0 +1,184 @@
+//
+// common/ram.c: Copy-on-write guest RAM images.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#define _GNU_SOURCE
+#include "common.h"
+#include "common/ram.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RAM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+const char *ram_pages_names[] = {
+  "4KiB pages", "transparent huge pages", "hugetlbfs pages"
+};
+
+// Creates an all-zero image in memory, to be filled in through a
+// shared view (which doesn't use any memory until it's written).
+int ram_image_create(struct ram_image *image, size_t size) {
+  if ((image->fd = memfd_create("guest-ram", MFD_CLOEXEC)) < 0)
+    return 1;
+
+  if (ftruncate(image->fd, size)) {
+    close(image->fd);
+    return 1;
+  }
+
+  image->size = size;
+  image->file_size = size;
+  return 0;
+}
+
+// Opens a file as the image for a RAM of the given size. The file
+// itself is never written.
+int ram_image_open(struct ram_image *image, const char *path, size_t size) {
+  struct stat sb;
+
+  if ((image->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    return 1;
+
+  if (fstat(image->fd, &sb)) {
+    close(image->fd);
+    return 1;
+  }
+
+  image->size = size;
+  image->file_size = (size_t) sb.st_size < size ? (size_t) sb.st_size : size;
+  return 0;
+}
+
+// Views stay valid after their image is closed.
+void ram_image_close(struct ram_image *image) {
+  close(image->fd);
+  image->fd = -1;
+}
+
+// Maps a view of the image. The whole range is reserved anonymously
+// first (without committing swap, so untouched RAM costs nothing),
+// and whatever the file covers is mapped over the top of it.
+static uint8_t *ram_image_map_view(const struct ram_image *image, int flags) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t file_size = (image->file_size + page_size - 1) & ~(page_size - 1);
+  void *ram;
+
+  if ((ram = mmap(NULL, image->size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED)
+    return NULL;
+
+  if (file_size > 0 && mmap(ram, file_size, PROT_READ | PROT_WRITE,
+    flags | MAP_FIXED, image->fd, 0) == MAP_FAILED) {
+    munmap(ram, image->size);
+    return NULL;
+  }
+
+  return ram;
+}
+
+// A private view: writes are copied on to pages of its own.
+uint8_t *ram_image_map(const struct ram_image *image) {
+  return ram_image_map_view(image, MAP_PRIVATE);
+}
+
+// A shared view of an image from ram_image_create: writes go into
+// the image, and are seen by any private view mapped afterwards.
+uint8_t *ram_image_map_shared(const struct ram_image *image) {
+  return ram_image_map_view(image, MAP_SHARED);
+}
+
+// Copies whatever the image holds into a view, skipping holes (which
+// read as zero anyway) where the file system can tell us about them.
+static int ram_image_fill(const struct ram_image *image, uint8_t *ram) {
+  off_t data = 0, hole;
+
+  while ((size_t) data < image->file_size) {
+    if ((data = lseek(image->fd, data, SEEK_DATA)) < 0) {
+      if (errno == ENXIO)
+        break;
+
+      data = 0;
+      hole = image->file_size;
+    }
+
+    else if ((hole = lseek(image->fd, data, SEEK_HOLE)) < 0 ||
+      (size_t) hole > image->file_size)
+      hole = image->file_size;
+
+    while (data < hole) {
+      ssize_t got = pread(image->fd, ram + data, hole - data, data);
+
+      if (got <= 0)
+        return 1;
+
+      data += got;
+    }
+  }
+
+  return 0;
+}
+
+// Reserves anonymous memory for a view, aligned to a huge page so
+// that transparent huge pages can back all of it.
+static uint8_t *ram_map_aligned(size_t size) {
+  size_t slack = RAM_HUGE_PAGE_SIZE;
+  uint8_t *ram, *aligned;
+
+  if ((ram = mmap(NULL, size + slack, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED)
+    return NULL;
+
+  aligned = (uint8_t *) (((uintptr_t) ram + slack - 1) & ~(slack - 1));
+
+  if (aligned != ram)
+    munmap(ram, aligned - ram);
+
+  munmap(aligned + size, ram + slack - aligned);
+  return aligned;
+}
+
+// A private view backed by huge pages, so that guests roaming all
+// over RAM miss in the host's dTLB less often. Uses hugetlbfs pages
+// if enough are reserved, else transparent huge pages, else (if the
+// host has neither) ordinary pages. Either way it's anonymous memory
+// with the image copied in, so it shares no pages with the image.
+uint8_t *ram_image_map_huge(const struct ram_image *image,
+  enum ram_pages *pages) {
+  uint8_t *ram = MAP_FAILED;
+
+  if (image->size % RAM_HUGE_PAGE_SIZE == 0)
+    ram = mmap(NULL, image->size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+  if (ram != MAP_FAILED)
+    *pages = RAM_PAGES_HUGETLB;
+
+  else {
+    if ((ram = ram_map_aligned(image->size)) == NULL)
+      return NULL;
+
+    *pages = madvise(ram, image->size, MADV_HUGEPAGE)
+      ? RAM_PAGES_SMALL : RAM_PAGES_TRANSPARENT;
+  }
+
+  if (ram_image_fill(image, ram)) {
+    munmap(ram, image->size);
+    return NULL;
+  }
+
+  return ram;
+}
+
+void ram_unmap(uint8_t *ram, size_t size) {
+  if (ram != NULL)
+    munmap(ram, size);
+}
+
@@ -0,0 +1,47 @@
+//
+// common/ram.h: Copy-on-write guest RAM images.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#ifndef __common_ram_h__
+#define __common_ram_h__
+#include "common.h"
+
+// A RAM image holds the initial contents of guest RAM: either a file
+// (opened read-only) or an anonymous in-memory file to load into.
+// Each backend gets its own private, copy-on-write view of the image,
+// so views start out sharing every page and only the pages a guest
+// writes get copied. Past the end of a short file, RAM reads as zero.
+struct ram_image {
+  int fd;
+  size_t size;
+  size_t file_size;
+};
+
+// What backs a view from ram_image_map_huge.
+enum ram_pages {
+  RAM_PAGES_SMALL,
+  RAM_PAGES_TRANSPARENT,
+  RAM_PAGES_HUGETLB,
+};
+
+extern const char *ram_pages_names[];
+
+cen64_cold int ram_image_create(struct ram_image *image, size_t size);
+cen64_cold int ram_image_open(struct ram_image *image,
+  const char *path, size_t size);
+cen64_cold void ram_image_close(struct ram_image *image);
+
+cen64_cold uint8_t *ram_image_map(const struct ram_image *image);
+cen64_cold uint8_t *ram_image_map_shared(const struct ram_image *image);
+cen64_cold uint8_t *ram_image_map_huge(const struct ram_image *image,
+  enum ram_pages *pages);
+cen64_cold void ram_unmap(uint8_t *ram, size_t size);
+
+#endif
+
@@ -0,0 +1,185 @@
+//
+// common/snapshot.c: Machine state snapshot files.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#include "common.h"
+#include "common/snapshot.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Checks if a page is entirely zero (so it can be left as a hole).
+static bool snapshot_page_is_zero(const uint8_t *page, size_t length) {
+  uint64_t accum = 0, word;
+  size_t i;
+
+  for (i = 0; i + sizeof(word) <= length; i += sizeof(word)) {
+    memcpy(&word, page + i, sizeof(word));
+    accum |= word;
+  }
+
+  for (; i < length; i++)
+    accum |= page[i];
+
+  return accum == 0;
+}
+
+// Writes out a buffer in its entirety.
+static int snapshot_pwrite(int fd, const uint8_t *data,
+  size_t length, uint64_t offset) {
+  while (length > 0) {
+    ssize_t written = pwrite(fd, data, length, offset);
+
+    if (written <= 0)
+      return 1;
+
+    data += written;
+    length -= written;
+    offset += written;
+  }
+
+  return 0;
+}
+
+// Creates a new snapshot file; sections get appended to it.
+int snapshot_create(struct snapshot_writer *writer,
+  const char *path, uint64_t steps) {
+  memset(writer, 0, sizeof(*writer));
+
+  if ((writer->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+    return 1;
+
+  memcpy(writer->header.magic, SNAPSHOT_MAGIC, sizeof(writer->header.magic));
+  writer->header.version = SNAPSHOT_VERSION;
+  writer->header.steps = steps;
+
+  writer->offset = (sizeof(writer->header) + SNAPSHOT_ALIGNMENT - 1) &
+    ~(uint64_t) (SNAPSHOT_ALIGNMENT - 1);
+
+  return 0;
+}
+
+// Appends a section to the snapshot. All-zero pages are skipped
+// and left as holes, so mostly-empty guest RAM costs little disk.
+int snapshot_write_section(struct snapshot_writer *writer,
+  enum snapshot_section_id id, const void *data, size_t length) {
+  struct snapshot_section *section;
+  const uint8_t *bytes = data;
+  size_t i;
+
+  if (writer->header.num_sections == SNAPSHOT_MAX_SECTIONS)
+    return 1;
+
+  section = writer->header.sections + writer->header.num_sections++;
+  section->id = id;
+  section->offset = writer->offset;
+  section->length = length;
+
+  for (i = 0; i < length; i += SNAPSHOT_ALIGNMENT) {
+    size_t chunk = length - i < SNAPSHOT_ALIGNMENT
+      ? length - i : SNAPSHOT_ALIGNMENT;
+
+    if (snapshot_page_is_zero(bytes + i, chunk))
+      continue;
+
+    if (snapshot_pwrite(writer->fd, bytes + i, chunk, writer->offset + i))
+      return 1;
+  }
+
+  writer->offset += (length + SNAPSHOT_ALIGNMENT - 1) &
+    ~(uint64_t) (SNAPSHOT_ALIGNMENT - 1);
+
+  return 0;
+}
+
+// Writes out the header and closes the snapshot.
+int snapshot_finish(struct snapshot_writer *writer) {
+  int status = 0;
+
+  if (ftruncate(writer->fd, writer->offset) ||
+    snapshot_pwrite(writer->fd, (const uint8_t *) &writer->header,
+    sizeof(writer->header), 0))
+    status = 1;
+
+  if (close(writer->fd))
+    status = 1;
+
+  return status;
+}
+
+// Maps a snapshot into memory and validates its header.
+int snapshot_open(struct snapshot *snapshot, const char *path) {
+  const struct snapshot_header *header;
+  struct stat sb;
+  unsigned i;
+  void *data;
+
+  memset(snapshot, 0, sizeof(*snapshot));
+
+  if ((snapshot->fd = open(path, O_RDONLY)) < 0)
+    return 1;
+
+  if (fstat(snapshot->fd, &sb) || (size_t) sb.st_size < sizeof(*header)) {
+    close(snapshot->fd);
+    return 1;
+  }
+
+  if ((data = mmap(NULL, sb.st_size, PROT_READ,
+    MAP_PRIVATE, snapshot->fd, 0)) == MAP_FAILED) {
+    close(snapshot->fd);
+    return 1;
+  }
+
+  snapshot->data = data;
+  snapshot->size = sb.st_size;
+  snapshot->header = header = data;
+
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+    header->version != SNAPSHOT_VERSION ||
+    header->num_sections > SNAPSHOT_MAX_SECTIONS)
+    goto invalid;
+
+  for (i = 0; i < header->num_sections; i++) {
+    const struct snapshot_section *section = header->sections + i;
+
+    if (section->offset > snapshot->size ||
+      section->length > snapshot->size - section->offset)
+      goto invalid;
+  }
+
+  return 0;
+
+invalid:
+  snapshot_close(snapshot);
+  return 1;
+}
+
+// Returns a pointer to the contents of a section, if present.
+const void *snapshot_get_section(const struct snapshot *snapshot,
+  enum snapshot_section_id id, size_t *length) {
+  const struct snapshot_header *header = snapshot->header;
+  unsigned i;
+
+  for (i = 0; i < header->num_sections; i++) {
+    if (header->sections[i].id == id) {
+      *length = header->sections[i].length;
+      return snapshot->data + header->sections[i].offset;
+    }
+  }
+
+  return NULL;
+}
+
+// Unmaps a snapshot.
+void snapshot_close(struct snapshot *snapshot) {
+  munmap((void *) snapshot->data, snapshot->size);
+  close(snapshot->fd);
+}
+
@@ -0,0 +1,79 @@
+//
+// common/snapshot.h: Machine state snapshot files.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#ifndef __common_snapshot_h__
+#define __common_snapshot_h__
+#include "common.h"
+
+// Snapshots are a fixed header followed by page-aligned sections,
+// so they can be mmap'd and large sections (i.e., guest RAM) used
+// in place. Sections hold raw host structures: a snapshot is only
+// good for the build (and host) which produced it. Bump the version
+// whenever a section's contents change meaning.
+#define SNAPSHOT_MAGIC "CMIPSNAP"
+#define SNAPSHOT_VERSION 11
+
+#define SNAPSHOT_ALIGNMENT 4096
+#define SNAPSHOT_MAX_SECTIONS 16
+
+enum snapshot_section_id {
+  SNAPSHOT_SECTION_NONE,
+  SNAPSHOT_SECTION_VR4300,
+  SNAPSHOT_SECTION_MIPS,
+  SNAPSHOT_SECTION_UART,
+  SNAPSHOT_SECTION_RAM,
+  SNAPSHOT_SECTION_BLKDEV,
+  SNAPSHOT_SECTION_CONSOLE,
+  SNAPSHOT_SECTION_DMA,
+  NUM_SNAPSHOT_SECTIONS
+};
+
+struct snapshot_section {
+  uint32_t id;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t length;
+};
+
+struct snapshot_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_sections;
+  uint64_t steps;
+
+  struct snapshot_section sections[SNAPSHOT_MAX_SECTIONS];
+};
+
+struct snapshot_writer {
+  struct snapshot_header header;
+  uint64_t offset;
+  int fd;
+};
+
+struct snapshot {
+  const struct snapshot_header *header;
+  const uint8_t *data;
+  size_t size;
+  int fd;
+};
+
+cen64_cold int snapshot_create(struct snapshot_writer *writer,
+  const char *path, uint64_t steps);
+cen64_cold int snapshot_write_section(struct snapshot_writer *writer,
+  enum snapshot_section_id id, const void *data, size_t length);
+cen64_cold int snapshot_finish(struct snapshot_writer *writer);
+
+cen64_cold int snapshot_open(struct snapshot *snapshot, const char *path);
+cen64_cold const void *snapshot_get_section(const struct snapshot *snapshot,
+  enum snapshot_section_id id, size_t *length);
+cen64_cold void snapshot_close(struct snapshot *snapshot);
+
+#endif
+
@@ -0,0 +1,245 @@
+//
+// common/symbols.c: Guest symbol tables.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#include "common.h"
+#include "common/symbols.h"
+#include <stdio.h>
+
+#define ELF_SHT_SYMTAB 2
+#define ELF_STT_NOTYPE 0
+#define ELF_STT_FUNC 2
+
+// Appends a symbol, growing the arrays as needed.
+static int symbols_add(struct symbol_table *table, size_t *capacity,
+  size_t *names_capacity, uint32_t address, const char *name, size_t len) {
+  if (table->num_symbols == *capacity) {
+    size_t size = *capacity ? *capacity * 2 : 1024;
+    struct symbol *symbols;
+
+    if ((symbols = realloc(table->symbols, size * sizeof(*symbols))) == NULL)
+      return 1;
+
+    table->symbols = symbols;
+    *capacity = size;
+  }
+
+  if (table->names_size + len + 1 > *names_capacity) {
+    size_t size = *names_capacity ? *names_capacity * 2 : 16384;
+    char *names;
+
+    while (size < table->names_size + len + 1)
+      size *= 2;
+
+    if ((names = realloc(table->names, size)) == NULL)
+      return 1;
+
+    table->names = names;
+    *names_capacity = size;
+  }
+
+  table->symbols[table->num_symbols].address = address;
+  table->symbols[table->num_symbols].name = table->names_size;
+  table->num_symbols++;
+
+  memcpy(table->names + table->names_size, name, len);
+  table->names[table->names_size + len] = '\0';
+  table->names_size += len + 1;
+  return 0;
+}
+
+// Reads a 16, 32 or 64-bit field of either byte order.
+static uint64_t symbols_elf_field(const uint8_t *p, unsigned size, bool be) {
+  uint64_t value = 0;
+  unsigned i;
+
+  for (i = 0; i < size; i++)
+    value |= (uint64_t) p[be ? size - 1 - i : i] << (i * 8);
+
+  return value;
+}
+
+// Pulls function symbols out of an ELF32/ELF64 .symtab.
+static int symbols_load_elf(struct symbol_table *table,
+  const uint8_t *data, size_t size) {
+  size_t capacity = 0, names_capacity = 0;
+  bool is64 = data[4] == 2, be = data[5] == 2;
+  uint64_t shoff, i;
+  unsigned shentsize, shnum;
+
+#define FIELD(p, n) symbols_elf_field(p, n, be)
+
+  if (size < (is64 ? 64u : 52u))
+    return 1;
+
+  shoff = FIELD(data + (is64 ? 0x28 : 0x20), is64 ? 8 : 4);
+  shentsize = FIELD(data + (is64 ? 0x3A : 0x2E), 2);
+  shnum = FIELD(data + (is64 ? 0x3C : 0x30), 2);
+
+  // Headers and symbols are read at fixed offsets, so entries smaller
+  // than the ELF ones would run off the end of the table.
+  if (shentsize < (is64 ? 0x40u : 0x28u) ||
+    shoff > size || (uint64_t) shentsize * shnum > size - shoff)
+    return 1;
+
+  for (i = 0; i < shnum; i++) {
+    const uint8_t *sh = data + shoff + i * shentsize;
+    uint64_t offset, length, entsize, link, stroff, strsize, j;
+    const uint8_t *strsh;
+
+    if (FIELD(sh + 4, 4) != ELF_SHT_SYMTAB)
+      continue;
+
+    offset = FIELD(sh + (is64 ? 0x18 : 0x10), is64 ? 8 : 4);
+    length = FIELD(sh + (is64 ? 0x20 : 0x14), is64 ? 8 : 4);
+    link = FIELD(sh + (is64 ? 0x28 : 0x18), 4);
+    entsize = FIELD(sh + (is64 ? 0x38 : 0x24), is64 ? 8 : 4);
+
+    if (link >= shnum || entsize < (is64 ? 24u : 16u) ||
+      offset > size || length > size - offset)
+      return 1;
+
+    strsh = data + shoff + link * shentsize;
+    stroff = FIELD(strsh + (is64 ? 0x18 : 0x10), is64 ? 8 : 4);
+    strsize = FIELD(strsh + (is64 ? 0x20 : 0x14), is64 ? 8 : 4);
+
+    if (stroff > size || strsize > size - stroff)
+      return 1;
+
+    for (j = 0; j + entsize <= length; j += entsize) {
+      const uint8_t *sym = data + offset + j;
+      uint64_t name = FIELD(sym, 4);
+      uint64_t value, shndx;
+      unsigned type;
+
+      if (is64) {
+        type = sym[4] & 0xF;
+        shndx = FIELD(sym + 6, 2);
+        value = FIELD(sym + 8, 8);
+      } else {
+        value = FIELD(sym + 4, 4);
+        type = sym[12] & 0xF;
+        shndx = FIELD(sym + 14, 2);
+      }
+
+      if ((type != ELF_STT_FUNC && type != ELF_STT_NOTYPE) ||
+        shndx == 0 || name == 0 || name >= strsize)
+        continue;
+
+      if (symbols_add(table, &capacity, &names_capacity, value,
+        (const char *) data + stroff + name,
+        strnlen((const char *) data + stroff + name, strsize - name)))
+        return 1;
+    }
+  }
+
+#undef FIELD
+
+  return 0;
+}
+
+// Reads a System.map ("address type name" per line); only text
+// symbols are kept.
+static int symbols_load_map(struct symbol_table *table, FILE *f) {
+  size_t capacity = 0, names_capacity = 0;
+  char line[512];
+
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long long address;
+    char type, name[256];
+
+    if (sscanf(line, "%llx %c %255s", &address, &type, name) != 3)
+      continue;
+
+    if (type != 'T' && type != 't' && type != 'W' && type != 'w')
+      continue;
+
+    if (symbols_add(table, &capacity, &names_capacity,
+      address, name, strlen(name)))
+      return 1;
+  }
+
+  return 0;
+}
+
+static int symbols_compare(const void *a, const void *b) {
+  const struct symbol *sa = a, *sb = b;
+  return sa->address < sb->address ? -1 : sa->address > sb->address;
+}
+
+// Loads an ELF image or a System.map, whichever the file is.
+int symbols_load(struct symbol_table *table, const char *path) {
+  uint8_t *data = NULL;
+  int status;
+  FILE *f;
+
+  memset(table, 0, sizeof(*table));
+
+  if ((f = fopen(path, "rb")) == NULL)
+    return 1;
+
+  if (fgetc(f) == 0x7F) {
+    long length;
+
+    if (fseek(f, 0, SEEK_END) || (length = ftell(f)) < 16 ||
+      fseek(f, 0, SEEK_SET) || (data = malloc(length)) == NULL ||
+      fread(data, 1, length, f) != (size_t) length) {
+      free(data);
+      fclose(f);
+      return 1;
+    }
+
+    status = memcmp(data, "\x7F" "ELF", 4)
+      ? 1 : symbols_load_elf(table, data, length);
+
+    free(data);
+  }
+
+  else {
+    rewind(f);
+    status = symbols_load_map(table, f);
+  }
+
+  fclose(f);
+
+  if (status || table->num_symbols == 0) {
+    symbols_free(table);
+    return 1;
+  }
+
+  qsort(table->symbols, table->num_symbols,
+    sizeof(*table->symbols), symbols_compare);
+
+  return 0;
+}
+
+void symbols_free(struct symbol_table *table) {
+  free(table->symbols);
+  free(table->names);
+  memset(table, 0, sizeof(*table));
+}
+
+// Returns the name of the symbol covering an address, if any.
+const char *symbols_lookup(const struct symbol_table *table,
+  uint32_t address) {
+  unsigned lo = 0, hi = table->num_symbols;
+
+  while (lo < hi) {
+    unsigned mid = lo + (hi - lo) / 2;
+
+    if (table->symbols[mid].address <= address)
+      lo = mid + 1;
+
+    else
+      hi = mid;
+  }
+
+  return lo ? table->names + table->symbols[lo - 1].name : NULL;
+}
+
@@ -0,0 +1,37 @@
+//
+// common/symbols.h: Guest symbol tables.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#ifndef __common_symbols_h__
+#define __common_symbols_h__
+#include "common.h"
+
+// Guests are 32-bit, so addresses are kept as the low 32 bits of
+// the (sign-extended) virtual address.
+struct symbol {
+  uint32_t address;
+  uint32_t name;
+};
+
+struct symbol_table {
+  struct symbol *symbols;
+  unsigned num_symbols;
+
+  char *names;
+  size_t names_size;
+};
+
+cen64_cold int symbols_load(struct symbol_table *table, const char *path);
+cen64_cold void symbols_free(struct symbol_table *table);
+
+cen64_cold const char *symbols_lookup(const struct symbol_table *table,
+  uint32_t address);
+
+#endif
+
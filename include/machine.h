@@ -0,0 +1,90 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include "mips.h"
+#include "statspage.h"
+#include "bus/controller.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+// Everything about a machine lives in its Machine, so any number of
+// them can run side by side in one process (one thread each).
+
+typedef enum {
+    MACHINE_CMIPS,
+    MACHINE_CEN64,
+} MachineType;
+
+typedef struct {
+    MachineType type;
+    const char * image;     // srec to load, optional when resuming
+    const char * ramPath;   // initial RAM contents, zeroes if NULL
+    uint32_t memSize;       // guest RAM bytes, 64MiB if 0
+    int hugePages;          // back the running guest's RAM with huge pages
+    const char * diskPath;  // block device image, none if NULL
+    const char * loadPath;  // snapshot to resume from
+    const char * savePath;  // snapshot to write once saveAt steps are done
+    uint64_t saveAt;
+    uint64_t maxSteps;      // stop after this many steps, 0 for no limit
+    uint64_t statsInterval; // cen64 summary every this many steps, 0 for none
+    uint64_t statsSample;   // cen64 stats sampled every ~this many pcycles
+    uint64_t statsSampleNs; // or about once per this many host ns
+    const char * uartPath;  // UART output file, stdout if NULL
+    UartTxPolicy uartTx;    // how UART output is buffered
+    const char * logPath;   // cen64 execution trace, none if NULL
+    StatsPageSlot * statsSlot; // live counters, none if NULL
+    int hostCounters;       // count host events on the runner thread
+    const char * profilePath; // folded call-graph profile, none if NULL
+    const char * symbolsPath; // System.map or ELF to name functions with
+    int profileCycles;      // weight the profile by cen64 pcycles
+} MachineConfig;
+
+struct callgraph;
+struct perf_counters;
+struct symbol_table;
+struct vr4300;
+struct vr4300_stats;
+
+typedef struct {
+    MachineConfig config;
+    pthread_mutex_t mutex;  // held while the machine is stepping
+
+    Mips * emu;
+    uint64_t steps;         // cmips instructions or cen64 pcycles
+
+    // cen64 only
+    struct bus_controller bus;
+    struct vr4300 * vr4300;
+    struct vr4300_stats * stats; // NULL unless collecting statistics
+    uint64_t nextStats;
+    uint64_t statsBase;     // steps when statistics started
+    uint64_t samplePeriod;  // mean pcycles between samples
+    uint64_t sampleWeight;  // pcycles the next sample stands for
+    uint64_t sampleCountdown;
+    uint64_t sampleSeed;
+    uint64_t clockSteps;    // steps and host time at the last
+    uint64_t clockNs;       // sample period adjustment
+    unsigned statsRequests; // requests seen so far
+    int stopRequested;      // set by stop_machine
+
+    struct perf_counters * perf; // with hostCounters, while running
+    uint64_t perfInsns;     // guest instructions when counting started
+    uint64_t perfSteps;
+
+    struct callgraph * callgraph; // with profilePath
+    struct symbol_table * symbols; // NULL unless symbolsPath loaded
+    uint8_t * mem;
+} Machine;
+
+Machine * new_machine(const MachineConfig * config);
+void free_machine(Machine * m);
+int run_machine(Machine * m);
+void receiveChar_machine(Machine * m, uint8_t c);
+void stop_machine(Machine * m);
+void saveProfile_machine(Machine * m);
+void requestStats_machine(void);
+
+int runPool_machine(const MachineConfig * configs, unsigned count, unsigned threads);
+
+#endif
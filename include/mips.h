@@ -8,6 +8,17 @@
 #define UARTSIZE 20
 #define POWERBASE 0x1fbf0004
 #define POWERSIZE 4
+#define BLKDEVBASE 0x14001000
+#define BLKDEVSIZE 0x200
+#define BLKDEV_IRQ 1
+#define CONSBASE 0x14002000
+#define CONSSIZE 0x20
+#define DMABASE 0x14003000
+#define DMASIZE 0x20
+#define DMA_IRQ 2
+
+// RAM runs from physical address 0 up to the first device.
+#define MEMORY_MAX_LEN 0x14000000
 
 
 typedef struct  {
@@ -47,8 +58,60 @@ typedef struct {
     uint32_t fifoLast;
     uint32_t fifoCount;
     
+    uint32_t rxEvents; // bumped on host input so idle guests can be woken
+    uint64_t txBytes;  // bytes the guest has transmitted
 } Uart;
 
+// How UART output gets to the host (see src/uart.c).
+typedef enum {
+    UART_TX_IMMEDIATE, // written and flushed byte by byte
+    UART_TX_LINE,      // written a line at a time
+    UART_TX_THREAD,    // handed in bulk to a writer thread
+} UartTxPolicy;
+
+struct UartTx;
+
+// Guest visible state of the block device (see src/blkdev.c).
+typedef struct {
+    uint32_t status;
+    uint32_t hostFeaturesSel;
+    uint32_t guestFeatures;
+    uint32_t guestFeaturesSel;
+    uint32_t guestPageSize;
+    uint32_t queueSel;
+    uint32_t queueNum;
+    uint32_t queueAlign;
+    uint32_t queuePfn;
+    uint32_t interruptStatus;
+    uint32_t lastAvail;   // next avail ring entry to serve
+    uint32_t usedIdx;
+    uint32_t completions; // requests completed, so idle guests can be woken
+} Blkdev;
+
+struct BlkdevHost;
+
+// Guest visible state of the ring console (see src/console.c).
+typedef struct {
+    uint32_t ringAddr;
+    uint32_t ringSize;
+    uint32_t head;
+    uint32_t tail;
+} Console;
+
+// Guest visible state of the DMA engine (see src/dma.c).
+typedef struct {
+    uint32_t src;
+    uint32_t dst;
+    uint32_t len;
+    uint32_t fill;
+    uint32_t status;
+    uint32_t irqEnable;
+    uint32_t readsLeft;   // STATUS reads until a busy transfer is done
+    uint32_t completions; // transfers completed, so idle guests can be woken
+} Dma;
+
+struct OutBuf;
+
 
 
 typedef struct {
@@ -81,17 +144,33 @@ typedef struct {
     uint32_t CP0_Count;
     uint32_t CP0_Compare;
 
+    uint32_t fpr[32]; // CP1 registers, doubles in even/odd pairs (FR=0)
+    uint32_t FCR31;   // CP1 control/status
+
     int waiting;    
     
+    uint32_t randomCounter; // fake rand state for tlbwr
+    
     Uart serial;
+    Blkdev blk;
+    Console cons;
+    Dma dma;
+    FILE * uartOut; // where UART output goes, stdout if NULL
+    struct callgraph * callgraph; // call-graph profile, if one is being taken
+    struct BlkdevHost * blkHost; // disk image and I/O thread, if attached
+    struct UartTx * uartTx; // buffered UART output, NULL to write each byte
+    struct OutBuf * out; // writer thread, once the console or UART uses it
     
     TLB tlb;
 } Mips;
 
 
 Mips * new_mips(uint32_t physMemSize);
+Mips * new_mips_on(uint32_t * mem, uint32_t physMemSize);
 void free_mips(Mips * mips);
+void flushOutput_mips(Mips * emu);
 void step_mips(Mips * emu);
+void loadFpuState_mips(Mips * emu);
 
 typedef struct {
     void * userdata;
@@ -99,6 +178,12 @@ typedef struct {
     int (*isEof)(void *);
 } SrecLoader;
 
+struct snapshot;
+struct snapshot_writer;
+
+int saveSnapshot_mips(Mips * emu, struct snapshot_writer * writer);
+int loadSnapshot_mips(Mips * emu, const struct snapshot * snapshot);
+
 int loadSrec_mips(Mips * emu,SrecLoader * s);
 int loadSrecFromFile_mips(Mips * emu,char * fname);
 int loadSrecFromString_mips(Mips * emu,char * srec);
@@ -124,6 +209,11 @@ static void clearExternalInterrupt(Mips * emu,unsigned int intNum) {
     emu->CP0_Cause &= ~(((1 << intNum) & 0x3f ) << 10);  
 }
 
+// Bumped whenever a device changes state on its own.
+static inline uint32_t deviceEvents_mips(const Mips * emu) {
+    return emu->serial.rxEvents + emu->blk.completions + emu->dma.completions;
+}
+
 
 void uart_Reset(Mips * emu);
 
@@ -132,6 +222,31 @@ void uart_write(Mips * emu,uint32_t offset,uint32_t v);
 uint8_t uart_readb(Mips * emu,uint32_t offset);
 void uart_writeb(Mips * emu,uint32_t offset,uint8_t v);
 void uart_RecieveChar(Mips * emu, uint8_t c);
+int uart_open_tx(Mips * emu, UartTxPolicy policy);
+void uart_close_tx(Mips * emu);
+void uart_flush(Mips * emu);
+void uart_poll(Mips * emu);
+
+int blkdev_open(Mips * emu, const char * path, uint32_t * mem);
+void blkdev_close(Mips * emu);
+void blkdev_reset(Mips * emu);
+uint32_t blkdev_read(Mips * emu, uint32_t offset);
+void blkdev_write(Mips * emu, uint32_t offset, uint32_t v);
+void blkdev_poll(Mips * emu);
+void blkdev_drain(Mips * emu);
+
+uint32_t console_read(Mips * emu, uint32_t offset);
+void console_write(Mips * emu, const uint32_t * mem, uint32_t offset, uint32_t v);
+
+void dma_reset(Mips * emu);
+uint32_t dma_read(Mips * emu, uint32_t offset);
+void dma_write(Mips * emu, uint32_t * mem, uint32_t offset, uint32_t v);
+void dma_poll(Mips * emu);
+
+struct OutBuf * new_outbuf(FILE * out);
+void outbuf_write(struct OutBuf * o, const uint8_t * data, size_t len);
+void outbuf_flush(struct OutBuf * o);
+void free_outbuf(struct OutBuf * o);
 
 extern char * regn2o32[];
 
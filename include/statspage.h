@@ -0,0 +1,52 @@
+#ifndef STATSPAGE_H
+#define STATSPAGE_H
+
+#include <stdint.h>
+
+// Live counters, published in a file (normally /dev/shm/emu-<pid>)
+// that tools like emutop can map and read while machines run. The
+// layout is fixed: a header, then one slot per machine. Every field
+// is written with relaxed atomic stores at batch boundaries, so
+// readers see each value whole but not necessarily all from the same
+// batch.
+
+#define STATSPAGE_MAGIC 0x54534d45 // "EMST"
+#define STATSPAGE_VERSION 1
+#define STATSPAGE_MEM_STATS 16
+
+typedef enum {
+    STATSPAGE_EMPTY,
+    STATSPAGE_RUNNING,
+    STATSPAGE_POWERED_OFF,
+    STATSPAGE_STEP_LIMIT,
+} StatsPageState;
+
+typedef struct {
+    uint64_t state;      // StatsPageState
+    uint64_t type;       // MachineType
+    uint64_t steps;      // cmips instructions or cen64 pcycles
+    uint64_t retired;    // retired instructions
+    uint64_t pc;         // guest PC at the last update
+    uint64_t idle;       // cen64 pcycles spent idle
+    uint64_t uartBytes;  // bytes the guest sent to its UART
+    uint64_t hostNs;     // CLOCK_MONOTONIC at the last update
+    uint64_t memStats[STATSPAGE_MEM_STATS]; // enum vr4300_mem_stat order,
+                                            // detailed cen64 builds only
+    char name[64];
+} StatsPageSlot;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotSize;
+    uint32_t numSlots;
+    uint64_t pid;
+    uint64_t pad[5];
+    StatsPageSlot slots[];
+} StatsPage;
+
+StatsPage * new_statspage(const char * path, unsigned numSlots);
+void free_statspage(StatsPage * page, const char * path);
+void claimSlot_statspage(StatsPageSlot * slot, const char * name, unsigned type);
+
+#endif
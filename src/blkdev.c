@@ -0,0 +1,630 @@
+#include "mips.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A paravirtual block device, with the registers and ring layout of a
+// legacy (version 1) virtio-mmio block device and a single virtqueue.
+// As with legacy virtio, everything in the rings is in guest byte
+// order.
+//
+// Requests are served by a host I/O thread with pread/pwrite, which
+// reads and writes guest RAM directly. Like any DMA on a MIPS without
+// coherent caches, guests have to write back and invalidate around it.
+// Completions are picked up by blkdev_poll on the emulation thread,
+// which raises BLKDEV_IRQ.
+
+#define BLK_MAGIC 0x74726976 // "virt"
+#define BLK_VERSION 1
+#define BLK_DEVICE_ID 2
+#define BLK_VENDOR_ID 0x434d4950 // "CMIP"
+#define BLK_QUEUE_NUM_MAX 256
+#define BLK_SECTOR_SIZE 512
+#define BLK_BUFFER_SIZE (64 * 1024)
+
+#define BLK_REG_MAGIC 0x000
+#define BLK_REG_VERSION 0x004
+#define BLK_REG_DEVICE_ID 0x008
+#define BLK_REG_VENDOR_ID 0x00c
+#define BLK_REG_HOST_FEATURES 0x010
+#define BLK_REG_HOST_FEATURES_SEL 0x014
+#define BLK_REG_GUEST_FEATURES 0x020
+#define BLK_REG_GUEST_FEATURES_SEL 0x024
+#define BLK_REG_GUEST_PAGE_SIZE 0x028
+#define BLK_REG_QUEUE_SEL 0x030
+#define BLK_REG_QUEUE_NUM_MAX 0x034
+#define BLK_REG_QUEUE_NUM 0x038
+#define BLK_REG_QUEUE_ALIGN 0x03c
+#define BLK_REG_QUEUE_PFN 0x040
+#define BLK_REG_QUEUE_NOTIFY 0x050
+#define BLK_REG_INTERRUPT_STATUS 0x060
+#define BLK_REG_INTERRUPT_ACK 0x064
+#define BLK_REG_STATUS 0x070
+#define BLK_REG_CAPACITY_HI 0x100 // config space: capacity in sectors
+#define BLK_REG_CAPACITY_LO 0x104
+
+#define BLK_F_RO (1 << 5)
+#define BLK_F_FLUSH (1 << 9)
+
+#define VRING_DESC_F_NEXT 1
+#define VRING_DESC_F_WRITE 2
+
+#define BLK_T_IN 0
+#define BLK_T_OUT 1
+#define BLK_T_FLUSH 4
+#define BLK_T_GET_ID 8
+
+#define BLK_S_OK 0
+#define BLK_S_IOERR 1
+#define BLK_S_UNSUPP 2
+
+#define BLK_ID "cmips-blk"
+#define BLK_ID_BYTES 20
+
+typedef struct {
+    uint32_t desc;
+    uint32_t avail;
+    uint32_t used;
+    uint32_t num;
+} BlkQueue;
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} BlkDesc;
+
+struct BlkdevHost {
+    Mips * emu;
+    uint32_t * mem;     // the RAM the guest is running on
+    uint32_t pmemsz;
+
+    int fd;
+    int readOnly;
+    uint64_t capacity;  // in sectors
+    uint8_t * buffer;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    BlkQueue queue;     // latched at each notify
+    uint32_t kicks;     // notifies not yet taken by the I/O thread
+    int busy;
+    int quit;
+
+    uint32_t completed; // bumped by the I/O thread
+    uint32_t seen;      // completions blkdev_poll has passed on
+};
+
+/* guest RAM access from the I/O thread */
+
+// Guest RAM is an array of host words with the guest's first byte in
+// the top bits, so bytes get shuffled on their way to and from files.
+
+static int inRam(struct BlkdevHost * h, uint64_t addr, uint64_t len) {
+    return addr <= h->pmemsz && len <= h->pmemsz - addr;
+}
+
+static uint32_t loadWord(struct BlkdevHost * h, uint32_t addr) {
+    return __atomic_load_n(&h->mem[addr / 4], __ATOMIC_ACQUIRE);
+}
+
+static uint16_t loadHalf(struct BlkdevHost * h, uint32_t addr) {
+    uint32_t word = loadWord(h, addr & ~3);
+    return (addr & 2) ? word & 0xffff : word >> 16;
+}
+
+static uint8_t loadByte(struct BlkdevHost * h, uint32_t addr) {
+    return h->mem[addr / 4] >> 8 * (3 - (addr & 3));
+}
+
+static void storeWord(struct BlkdevHost * h, uint32_t addr, uint32_t v) {
+    __atomic_store_n(&h->mem[addr / 4], v, __ATOMIC_RELEASE);
+}
+
+// The guest may be writing the rest of the word at the same time.
+static void storeLane(struct BlkdevHost * h, uint32_t addr,
+    uint32_t mask, uint32_t v) {
+    uint32_t * word = &h->mem[addr / 4];
+    uint32_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(word, &old, (old & ~mask) | (v & mask),
+        1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void storeHalf(struct BlkdevHost * h, uint32_t addr, uint16_t v) {
+    int shamt = (addr & 2) ? 0 : 16;
+    storeLane(h, addr & ~3, 0xffff << shamt, (uint32_t)v << shamt);
+}
+
+static void storeByte(struct BlkdevHost * h, uint32_t addr, uint8_t v) {
+    int shamt = 8 * (3 - (addr & 3));
+    storeLane(h, addr & ~3, 0xff << shamt, (uint32_t)v << shamt);
+}
+
+static void copyToGuest(struct BlkdevHost * h, uint32_t addr,
+    const uint8_t * src, uint32_t len) {
+    for (; len && (addr & 3); len--) {
+        storeByte(h, addr++, *src++);
+    }
+
+    for (; len >= 4; len -= 4, addr += 4, src += 4) {
+        h->mem[addr / 4] = (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 |
+            (uint32_t)src[2] << 8 | src[3];
+    }
+
+    for (; len; len--) {
+        storeByte(h, addr++, *src++);
+    }
+}
+
+static void copyFromGuest(struct BlkdevHost * h, uint8_t * dst,
+    uint32_t addr, uint32_t len) {
+    for (; len && (addr & 3); len--) {
+        *dst++ = loadByte(h, addr++);
+    }
+
+    for (; len >= 4; len -= 4, addr += 4, dst += 4) {
+        uint32_t word = h->mem[addr / 4];
+        dst[0] = word >> 24;
+        dst[1] = word >> 16;
+        dst[2] = word >> 8;
+        dst[3] = word;
+    }
+
+    for (; len; len--) {
+        *dst++ = loadByte(h, addr++);
+    }
+}
+
+/* requests */
+
+static void loadDesc(struct BlkdevHost * h, const BlkQueue * q,
+    unsigned i, BlkDesc * d) {
+    uint32_t addr = q->desc + 16 * i;
+    uint32_t word = loadWord(h, addr + 12);
+
+    d->addr = (uint64_t)loadWord(h, addr) << 32 | loadWord(h, addr + 4);
+    d->len = loadWord(h, addr + 8);
+    d->flags = word >> 16;
+    d->next = word & 0xffff;
+}
+
+// Moves one data buffer between the image and guest RAM.
+static int transfer(struct BlkdevHost * h, const BlkDesc * d,
+    uint64_t offset, int toGuest) {
+    uint32_t done = 0;
+
+    if (offset + d->len > h->capacity * BLK_SECTOR_SIZE ||
+        !toGuest != !(d->flags & VRING_DESC_F_WRITE)) {
+        return 1;
+    }
+
+    while (done < d->len) {
+        uint32_t chunk = d->len - done;
+        ssize_t n;
+
+        if (chunk > BLK_BUFFER_SIZE) {
+            chunk = BLK_BUFFER_SIZE;
+        }
+
+        if (toGuest) {
+            n = pread(h->fd, h->buffer, chunk, offset + done);
+            if (n <= 0) {
+                return 1;
+            }
+            copyToGuest(h, d->addr + done, h->buffer, n);
+        } else {
+            copyFromGuest(h, h->buffer, d->addr + done, chunk);
+            n = pwrite(h->fd, h->buffer, chunk, offset + done);
+            if (n <= 0) {
+                return 1;
+            }
+        }
+
+        done += n;
+    }
+
+    return 0;
+}
+
+// Serves the request whose chain starts at head, and returns how many
+// bytes were written into the guest's buffers.
+static uint32_t serveRequest(struct BlkdevHost * h, const BlkQueue * q,
+    uint16_t head) {
+    BlkDesc descs[BLK_QUEUE_NUM_MAX];
+    uint32_t written = 0;
+    uint8_t header[16];
+    uint64_t offset;
+    uint8_t status = BLK_S_OK;
+    unsigned i, n = 0;
+    uint32_t type;
+
+    for (i = head; ; i = descs[n - 1].next) {
+        if (i >= q->num || n == q->num) {
+            return 0;
+        }
+
+        loadDesc(h, q, i, &descs[n]);
+
+        if (!inRam(h, descs[n].addr, descs[n].len)) {
+            return 0;
+        }
+
+        if (!(descs[n++].flags & VRING_DESC_F_NEXT)) {
+            break;
+        }
+    }
+
+    // There has to be a header and somewhere to put the status.
+    if (n < 2 || descs[0].len < sizeof(header) ||
+        !(descs[n - 1].flags & VRING_DESC_F_WRITE) || descs[n - 1].len < 1) {
+        return 0;
+    }
+
+    copyFromGuest(h, header, descs[0].addr, sizeof(header));
+    type = (uint32_t)header[0] << 24 | header[1] << 16 | header[2] << 8 | header[3];
+    offset = 0;
+
+    for (i = 8; i < 16; i++) {
+        offset = offset << 8 | header[i];
+    }
+
+    offset *= BLK_SECTOR_SIZE;
+
+    switch (type) {
+    case BLK_T_IN:
+    case BLK_T_OUT:
+        if (type == BLK_T_OUT && h->readOnly) {
+            status = BLK_S_IOERR;
+            break;
+        }
+
+        for (i = 1; i < n - 1 && status == BLK_S_OK; i++) {
+            if (transfer(h, &descs[i], offset, type == BLK_T_IN)) {
+                status = BLK_S_IOERR;
+            } else if (type == BLK_T_IN) {
+                written += descs[i].len;
+            }
+            offset += descs[i].len;
+        }
+        break;
+    case BLK_T_FLUSH:
+        if (fdatasync(h->fd)) {
+            status = BLK_S_IOERR;
+        }
+        break;
+    case BLK_T_GET_ID:
+        if (n > 2 && (descs[1].flags & VRING_DESC_F_WRITE)) {
+            uint8_t id[BLK_ID_BYTES] = BLK_ID;
+            written = descs[1].len < BLK_ID_BYTES ? descs[1].len : BLK_ID_BYTES;
+            copyToGuest(h, descs[1].addr, id, written);
+        } else {
+            status = BLK_S_IOERR;
+        }
+        break;
+    default:
+        status = BLK_S_UNSUPP;
+    }
+
+    storeByte(h, descs[n - 1].addr, status);
+    return written + 1;
+}
+
+// Serves everything in the avail ring.
+static void serveQueue(struct BlkdevHost * h, const BlkQueue * q) {
+    Blkdev * blk = &h->emu->blk;
+    uint16_t availIdx;
+
+    while ((availIdx = loadHalf(h, q->avail + 2)) != (uint16_t)blk->lastAvail) {
+        do {
+            uint16_t head = loadHalf(h, q->avail + 4 + 2 * (blk->lastAvail % q->num));
+            uint32_t elem = q->used + 4 + 8 * (blk->usedIdx % q->num);
+            uint32_t len = serveRequest(h, q, head);
+
+            storeWord(h, elem, head);
+            storeWord(h, elem + 4, len);
+            blk->lastAvail = (blk->lastAvail + 1) & 0xffff;
+            blk->usedIdx = (blk->usedIdx + 1) & 0xffff;
+            storeHalf(h, q->used + 2, blk->usedIdx);
+            __atomic_add_fetch(&h->completed, 1, __ATOMIC_RELEASE);
+        } while (availIdx != (uint16_t)blk->lastAvail);
+    }
+}
+
+static void * ioThread(void * p) {
+    struct BlkdevHost * h = (struct BlkdevHost *)p;
+
+    pthread_mutex_lock(&h->mutex);
+
+    while (!h->quit) {
+        BlkQueue queue;
+
+        if (!h->kicks) {
+            pthread_cond_wait(&h->cond, &h->mutex);
+            continue;
+        }
+
+        queue = h->queue;
+        h->kicks = 0;
+        h->busy = 1;
+        pthread_mutex_unlock(&h->mutex);
+
+        serveQueue(h, &queue);
+
+        pthread_mutex_lock(&h->mutex);
+        h->busy = 0;
+        pthread_cond_broadcast(&h->cond);
+    }
+
+    pthread_mutex_unlock(&h->mutex);
+    return NULL;
+}
+
+// Works out where the rings are, as legacy virtio lays them out.
+static int latchQueue(Mips * emu, BlkQueue * q) {
+    Blkdev * blk = &emu->blk;
+    uint64_t desc, avail, used, end;
+    uint32_t align = blk->queueAlign;
+
+    // Ring indices run freely up to 65535, so sizes are powers of two.
+    if (!blk->queuePfn || !blk->queueNum || blk->queueNum > BLK_QUEUE_NUM_MAX ||
+        (blk->queueNum & (blk->queueNum - 1)) || !align || (align & (align - 1))) {
+        return 1;
+    }
+
+    desc = (uint64_t)blk->queuePfn * blk->guestPageSize;
+    avail = desc + 16 * blk->queueNum;
+    used = (avail + 6 + 2 * blk->queueNum + align - 1) & ~(uint64_t)(align - 1);
+    end = used + 6 + 8 * blk->queueNum;
+
+    if (desc % 4 || !inRam(emu->blkHost, desc, end - desc)) {
+        return 1;
+    }
+
+    q->desc = desc;
+    q->avail = avail;
+    q->used = used;
+    q->num = blk->queueNum;
+    return 0;
+}
+
+/* device interface */
+
+// Attaches a disk image, read-only if it can't be written. mem is the
+// RAM the guest runs on, which for cen64 isn't emu->mem.
+int blkdev_open(Mips * emu, const char * path, uint32_t * mem) {
+    struct BlkdevHost * h = calloc(1, sizeof(*h));
+    struct stat sb;
+
+    if (!h) {
+        return 1;
+    }
+
+    h->emu = emu;
+    h->mem = mem;
+    h->pmemsz = emu->pmemsz;
+
+    if ((h->fd = open(path, O_RDWR | O_CLOEXEC)) < 0 &&
+        (errno == EACCES || errno == EROFS || errno == EPERM)) {
+        h->fd = open(path, O_RDONLY | O_CLOEXEC);
+        h->readOnly = 1;
+    }
+
+    if (h->fd < 0 || fstat(h->fd, &sb)) {
+        goto fail;
+    }
+
+    h->capacity = sb.st_size / BLK_SECTOR_SIZE;
+
+    if ((h->buffer = malloc(BLK_BUFFER_SIZE)) == NULL) {
+        goto fail;
+    }
+
+    pthread_mutex_init(&h->mutex, NULL);
+    pthread_cond_init(&h->cond, NULL);
+
+    if (pthread_create(&h->thread, NULL, ioThread, h)) {
+        pthread_cond_destroy(&h->cond);
+        pthread_mutex_destroy(&h->mutex);
+        goto fail;
+    }
+
+    emu->blkHost = h;
+    return 0;
+
+fail:
+    if (h->fd >= 0) {
+        close(h->fd);
+    }
+    free(h->buffer);
+    free(h);
+    return 1;
+}
+
+void blkdev_close(Mips * emu) {
+    struct BlkdevHost * h = emu->blkHost;
+
+    if (!h) {
+        return;
+    }
+
+    pthread_mutex_lock(&h->mutex);
+    h->quit = 1;
+    pthread_cond_broadcast(&h->cond);
+    pthread_mutex_unlock(&h->mutex);
+    pthread_join(h->thread, NULL);
+
+    pthread_cond_destroy(&h->cond);
+    pthread_mutex_destroy(&h->mutex);
+    close(h->fd);
+    free(h->buffer);
+    free(h);
+    emu->blkHost = NULL;
+}
+
+// Waits for the I/O thread to finish everything it's been given, so
+// the device state can be changed or saved.
+void blkdev_drain(Mips * emu) {
+    struct BlkdevHost * h = emu->blkHost;
+
+    if (!h) {
+        return;
+    }
+
+    pthread_mutex_lock(&h->mutex);
+
+    while (h->kicks || h->busy) {
+        pthread_cond_wait(&h->cond, &h->mutex);
+    }
+
+    pthread_mutex_unlock(&h->mutex);
+}
+
+void blkdev_reset(Mips * emu) {
+    uint32_t completions = emu->blk.completions;
+
+    blkdev_drain(emu);
+
+    if (emu->blkHost) {
+        emu->blkHost->seen = __atomic_load_n(&emu->blkHost->completed, __ATOMIC_ACQUIRE);
+    }
+
+    memset(&emu->blk, 0, sizeof(emu->blk));
+    emu->blk.guestPageSize = 4096;
+    emu->blk.completions = completions;
+    clearExternalInterrupt(emu, BLKDEV_IRQ);
+}
+
+// Passes completions on to the guest; called between batches of steps.
+void blkdev_poll(Mips * emu) {
+    struct BlkdevHost * h = emu->blkHost;
+    uint32_t completed;
+
+    if (!h) {
+        return;
+    }
+
+    completed = __atomic_load_n(&h->completed, __ATOMIC_ACQUIRE);
+
+    if (completed != h->seen) {
+        emu->blk.completions += completed - h->seen;
+        h->seen = completed;
+        emu->blk.interruptStatus |= 1;
+        triggerExternalInterrupt(emu, BLKDEV_IRQ);
+    }
+}
+
+uint32_t blkdev_read(Mips * emu, uint32_t offset) {
+    struct BlkdevHost * h = emu->blkHost;
+    Blkdev * blk = &emu->blk;
+
+    switch (offset & ~3) {
+    case BLK_REG_MAGIC:
+        return BLK_MAGIC;
+    case BLK_REG_VERSION:
+        return BLK_VERSION;
+    case BLK_REG_DEVICE_ID:
+        return h ? BLK_DEVICE_ID : 0; // 0 means nothing attached
+    case BLK_REG_VENDOR_ID:
+        return BLK_VENDOR_ID;
+    case BLK_REG_HOST_FEATURES:
+        if (!h || blk->hostFeaturesSel) {
+            return 0;
+        }
+        return BLK_F_FLUSH | (h->readOnly ? BLK_F_RO : 0);
+    case BLK_REG_QUEUE_NUM_MAX:
+        return blk->queueSel ? 0 : BLK_QUEUE_NUM_MAX;
+    case BLK_REG_QUEUE_PFN:
+        return blk->queueSel ? 0 : blk->queuePfn;
+    case BLK_REG_INTERRUPT_STATUS:
+        return blk->interruptStatus;
+    case BLK_REG_STATUS:
+        return blk->status;
+    case BLK_REG_CAPACITY_HI:
+        return h ? h->capacity >> 32 : 0;
+    case BLK_REG_CAPACITY_LO:
+        return h ? (uint32_t)h->capacity : 0;
+    default:
+        return 0;
+    }
+}
+
+void blkdev_write(Mips * emu, uint32_t offset, uint32_t v) {
+    struct BlkdevHost * h = emu->blkHost;
+    Blkdev * blk = &emu->blk;
+
+    switch (offset & ~3) {
+    case BLK_REG_HOST_FEATURES_SEL:
+        blk->hostFeaturesSel = v;
+        break;
+    case BLK_REG_GUEST_FEATURES:
+        if (!blk->guestFeaturesSel) {
+            blk->guestFeatures = v;
+        }
+        break;
+    case BLK_REG_GUEST_FEATURES_SEL:
+        blk->guestFeaturesSel = v;
+        break;
+    case BLK_REG_GUEST_PAGE_SIZE:
+        blk->guestPageSize = v;
+        break;
+    case BLK_REG_QUEUE_SEL:
+        blk->queueSel = v;
+        break;
+    case BLK_REG_QUEUE_NUM:
+        if (!blk->queueSel) {
+            blk->queueNum = v;
+        }
+        break;
+    case BLK_REG_QUEUE_ALIGN:
+        if (!blk->queueSel) {
+            blk->queueAlign = v;
+        }
+        break;
+    case BLK_REG_QUEUE_PFN:
+        if (!blk->queueSel) {
+            blkdev_drain(emu);
+            blk->queuePfn = v;
+            blk->lastAvail = 0;
+            blk->usedIdx = 0;
+        }
+        break;
+    case BLK_REG_QUEUE_NOTIFY:
+        if (h && v == 0) {
+            BlkQueue queue;
+
+            if (latchQueue(emu, &queue)) {
+                break;
+            }
+
+            pthread_mutex_lock(&h->mutex);
+            h->queue = queue;
+            h->kicks++;
+            pthread_cond_broadcast(&h->cond);
+            pthread_mutex_unlock(&h->mutex);
+        }
+        break;
+    case BLK_REG_INTERRUPT_ACK:
+        blk->interruptStatus &= ~v;
+        if (!blk->interruptStatus) {
+            clearExternalInterrupt(emu, BLKDEV_IRQ);
+        }
+        break;
+    case BLK_REG_STATUS:
+        if (v == 0) {
+            blkdev_reset(emu);
+        } else {
+            blk->status = v;
+        }
+        break;
+    }
+}
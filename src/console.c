@@ -0,0 +1,109 @@
+#include "mips.h"
+
+#include <stdio.h>
+
+// A console for bulk output: the guest writes text into a ring buffer
+// in its own RAM and then writes its new head index to the doorbell.
+// The device takes everything between the tail and the head in one go
+// and queues it for the host's writer thread, so a whole boot log costs
+// a handful of MMIO writes instead of several per character.
+//
+// The ring is RING_SIZE bytes (a power of two) at physical RING_ADDR.
+// HEAD and TAIL are free running byte counts; the guest may fill the
+// ring up to TAIL + RING_SIZE. The tail catches up with the head as
+// soon as the doorbell is written. The device reads RAM directly, so
+// cen64 guests writing the ring through kseg0 have to write back their
+// data cache before ringing.
+
+#define CONS_MAGIC 0x434f4e53 // "CONS"
+
+#define CONS_REG_MAGIC 0x00
+#define CONS_REG_RING_ADDR 0x04
+#define CONS_REG_RING_SIZE 0x08
+#define CONS_REG_HEAD 0x0c // doorbell
+#define CONS_REG_TAIL 0x10
+
+#define CONS_CHUNK 4096
+
+static FILE * consoleFile(Mips * emu) {
+    return emu->uartOut ? emu->uartOut : stdout;
+}
+
+// Takes everything up to the new head out of the ring, from the RAM
+// the guest is running on.
+static void consoleDrain(Mips * emu, const uint32_t * mem, uint32_t head) {
+    Console * cons = &emu->cons;
+    uint32_t size = cons->ringSize;
+    uint32_t pending = head - cons->tail;
+    uint8_t chunk[CONS_CHUNK];
+
+    // UART output sent before the doorbell goes first.
+    uart_flush(emu);
+
+    if (!emu->out) {
+        emu->out = new_outbuf(consoleFile(emu));
+    }
+
+    // A guest that got its ring wrong just loses the output.
+    if (!size || (size & (size - 1)) || pending > size ||
+        cons->ringAddr >= emu->pmemsz || size > emu->pmemsz - cons->ringAddr) {
+        cons->tail = head;
+        return;
+    }
+
+    while (pending) {
+        uint32_t n = pending < CONS_CHUNK ? pending : CONS_CHUNK;
+        uint32_t i;
+
+        for (i = 0; i < n; i++) {
+            uint32_t addr = cons->ringAddr + ((cons->tail + i) & (size - 1));
+            chunk[i] = mem[addr / 4] >> 8 * (3 - (addr & 3));
+        }
+
+        if (emu->out) {
+            outbuf_write(emu->out, chunk, n);
+        } else {
+            fwrite(chunk, 1, n, consoleFile(emu));
+            fflush(consoleFile(emu));
+        }
+
+        cons->tail += n;
+        pending -= n;
+    }
+}
+
+uint32_t console_read(Mips * emu, uint32_t offset) {
+    Console * cons = &emu->cons;
+
+    switch (offset & ~3) {
+    case CONS_REG_MAGIC:
+        return CONS_MAGIC;
+    case CONS_REG_RING_ADDR:
+        return cons->ringAddr;
+    case CONS_REG_RING_SIZE:
+        return cons->ringSize;
+    case CONS_REG_HEAD:
+        return cons->head;
+    case CONS_REG_TAIL:
+        return cons->tail;
+    default:
+        return 0;
+    }
+}
+
+void console_write(Mips * emu, const uint32_t * mem, uint32_t offset, uint32_t v) {
+    Console * cons = &emu->cons;
+
+    switch (offset & ~3) {
+    case CONS_REG_RING_ADDR:
+        cons->ringAddr = v;
+        break;
+    case CONS_REG_RING_SIZE:
+        cons->ringSize = v;
+        break;
+    case CONS_REG_HEAD:
+        cons->head = v;
+        consoleDrain(emu, mem, v);
+        break;
+    }
+}
@@ -0,0 +1,200 @@
+#include "mips.h"
+
+#include <string.h>
+
+// A DMA engine for bulk copies and fills of guest RAM, so a guest can
+// clear or copy a page with a handful of MMIO writes instead of running
+// a loop of loads and stores through the emulator.
+//
+// The guest sets SRC, DST and LEN (physical addresses and a byte count)
+// and, for a fill, the byte in FILL, then writes the operation to OP.
+// The host does the work there and then, but the engine reports itself
+// busy for a while to model the transfer: until the next time devices
+// are polled between batches, or until STATUS has been read once for
+// every DMA_BYTES_PER_READ bytes, whichever is first. Then DONE (or
+// ERROR, for a range outside RAM) is set and, if enabled in IRQEN, the
+// interrupt raised; writing those bits back to STATUS clears them.
+//
+// The engine works on RAM directly, so cen64 guests have to write back
+// (and for a destination, invalidate) their caches around a transfer.
+
+#define DMA_MAGIC 0x444d4130 // "DMA0"
+
+#define DMA_REG_MAGIC 0x00
+#define DMA_REG_SRC 0x04
+#define DMA_REG_DST 0x08
+#define DMA_REG_LEN 0x0c
+#define DMA_REG_FILL 0x10
+#define DMA_REG_OP 0x14 // starts a transfer
+#define DMA_REG_STATUS 0x18
+#define DMA_REG_IRQEN 0x1c
+
+#define DMA_OP_COPY 1
+#define DMA_OP_FILL 2
+
+#define DMA_STATUS_BUSY 0x1
+#define DMA_STATUS_DONE 0x2
+#define DMA_STATUS_ERROR 0x4
+
+#define DMA_BYTES_PER_READ 16384
+
+static int dmaInRam(const Mips * emu, uint32_t addr, uint32_t len) {
+    return addr <= emu->pmemsz && len <= emu->pmemsz - addr;
+}
+
+// Guest byte k of a word lives in bits (3-k)*8, so only whole words can
+// be moved with the host's string functions.
+static uint8_t dmaReadByte(const uint32_t * mem, uint32_t addr) {
+    return mem[addr / 4] >> 8 * (3 - (addr & 3));
+}
+
+static void dmaWriteByte(uint32_t * mem, uint32_t addr, uint8_t v) {
+    uint32_t shamt = 8 * (3 - (addr & 3));
+
+    mem[addr / 4] = (mem[addr / 4] & ~(0xffu << shamt)) | (uint32_t)v << shamt;
+}
+
+static void dmaCopy(uint32_t * mem, uint32_t dst, uint32_t src, uint32_t len) {
+    uint32_t i;
+
+    if (((dst | src | len) & 3) == 0) {
+        memmove(mem + dst / 4, mem + src / 4, len);
+    } else if (dst <= src) {
+        for (i = 0; i < len; i++) {
+            dmaWriteByte(mem, dst + i, dmaReadByte(mem, src + i));
+        }
+    } else {
+        for (i = len; i > 0; i--) {
+            dmaWriteByte(mem, dst + i - 1, dmaReadByte(mem, src + i - 1));
+        }
+    }
+}
+
+// Every byte of a word is the same, so the aligned middle can be set
+// with memset whatever the byte order.
+static void dmaFill(uint32_t * mem, uint32_t dst, uint32_t len, uint8_t v) {
+    while (len && (dst & 3)) {
+        dmaWriteByte(mem, dst++, v);
+        len--;
+    }
+
+    memset(mem + dst / 4, v, len & ~3);
+    dst += len & ~3;
+    len &= 3;
+
+    while (len--) {
+        dmaWriteByte(mem, dst++, v);
+    }
+}
+
+static void dmaComplete(Mips * emu, uint32_t status) {
+    Dma * dma = &emu->dma;
+
+    dma->status = (dma->status & ~DMA_STATUS_BUSY) | status;
+    dma->readsLeft = 0;
+    dma->completions++;
+
+    if (dma->irqEnable) {
+        triggerExternalInterrupt(emu, DMA_IRQ);
+    }
+}
+
+static void dmaStart(Mips * emu, uint32_t * mem, uint32_t op) {
+    Dma * dma = &emu->dma;
+
+    // Anything still in flight has already been done.
+    if (dma->status & DMA_STATUS_BUSY) {
+        dmaComplete(emu, DMA_STATUS_DONE);
+    }
+
+    if ((op != DMA_OP_COPY && op != DMA_OP_FILL) ||
+        !dmaInRam(emu, dma->dst, dma->len) ||
+        (op == DMA_OP_COPY && !dmaInRam(emu, dma->src, dma->len))) {
+        dmaComplete(emu, DMA_STATUS_ERROR);
+        return;
+    }
+
+    if (op == DMA_OP_COPY) {
+        dmaCopy(mem, dma->dst, dma->src, dma->len);
+    } else {
+        dmaFill(mem, dma->dst, dma->len, dma->fill);
+    }
+
+    dma->status |= DMA_STATUS_BUSY;
+    dma->readsLeft = dma->len / DMA_BYTES_PER_READ + 1;
+}
+
+void dma_reset(Mips * emu) {
+    uint32_t completions = emu->dma.completions;
+
+    memset(&emu->dma, 0, sizeof(emu->dma));
+    emu->dma.completions = completions;
+    clearExternalInterrupt(emu, DMA_IRQ);
+}
+
+uint32_t dma_read(Mips * emu, uint32_t offset) {
+    Dma * dma = &emu->dma;
+
+    switch (offset & ~3) {
+    case DMA_REG_MAGIC:
+        return DMA_MAGIC;
+    case DMA_REG_SRC:
+        return dma->src;
+    case DMA_REG_DST:
+        return dma->dst;
+    case DMA_REG_LEN:
+        return dma->len;
+    case DMA_REG_FILL:
+        return dma->fill;
+    case DMA_REG_STATUS:
+        if ((dma->status & DMA_STATUS_BUSY) && --dma->readsLeft == 0) {
+            dmaComplete(emu, DMA_STATUS_DONE);
+        }
+        return dma->status;
+    case DMA_REG_IRQEN:
+        return dma->irqEnable;
+    default:
+        return 0;
+    }
+}
+
+void dma_write(Mips * emu, uint32_t * mem, uint32_t offset, uint32_t v) {
+    Dma * dma = &emu->dma;
+
+    switch (offset & ~3) {
+    case DMA_REG_SRC:
+        dma->src = v;
+        break;
+    case DMA_REG_DST:
+        dma->dst = v;
+        break;
+    case DMA_REG_LEN:
+        dma->len = v;
+        break;
+    case DMA_REG_FILL:
+        dma->fill = v & 0xff;
+        break;
+    case DMA_REG_OP:
+        dmaStart(emu, mem, v);
+        break;
+    case DMA_REG_STATUS:
+        dma->status &= ~(v & (DMA_STATUS_DONE | DMA_STATUS_ERROR));
+        break;
+    case DMA_REG_IRQEN:
+        dma->irqEnable = v & 1;
+        break;
+    }
+
+    if (!dma->irqEnable || !(dma->status & (DMA_STATUS_DONE | DMA_STATUS_ERROR))) {
+        clearExternalInterrupt(emu, DMA_IRQ);
+    } else {
+        triggerExternalInterrupt(emu, DMA_IRQ);
+    }
+}
+
+// Finishes a transfer the guest hasn't been polling for.
+void dma_poll(Mips * emu) {
+    if (emu->dma.status & DMA_STATUS_BUSY) {
+        dmaComplete(emu, DMA_STATUS_DONE);
+    }
+}
@@ -1,5 +1,7 @@
 
 #include "mips.h"
+#include "fpu/fpu.h"
+#include "common/callgraph.h"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -51,13 +53,30 @@ Mips * new_mips(uint32_t physMemSize) {
         return 0;
     }
     
-    Mips * ret = calloc(1,sizeof(Mips));
+    Mips * ret = new_mips_on(mem,physMemSize);
     
     if (!ret) {
         free(mem);
         return 0;
     }
     
+    return ret;
+}
+
+// Like new_mips, but on RAM the caller owns. Clear mem before
+// free_mips if it wasn't from malloc.
+Mips * new_mips_on(uint32_t * mem, uint32_t physMemSize) {
+    
+    if (physMemSize % 4 != 0) {
+        return 0;
+    }
+    
+    Mips * ret = calloc(1,sizeof(Mips));
+    
+    if (!ret) {
+        return 0;
+    }
+    
     ret->mem = mem;
     ret->pmemsz = physMemSize;
     
@@ -66,10 +85,22 @@ Mips * new_mips(uint32_t physMemSize) {
     ret->CP0_Status |= (1 << CP0St_ERL); //start in kernel mode with unmapped useg
     
     uart_Reset(ret);
+    blkdev_reset(ret);
+    dma_reset(ret);
     
     return ret;
 }
 
+// Gets the guest's buffered output out before we give up on it; the
+// last thing it printed usually says what went wrong.
+void flushOutput_mips(Mips * emu) {
+    uart_flush(emu);
+
+    if (emu->out) {
+        outbuf_flush(emu->out);
+    }
+}
+
 void free_mips(Mips * mips) {
     free(mips->mem);
     free(mips);
@@ -99,6 +130,7 @@ int32_t sext18(uint32_t val) {
 #define EXC_CpU 11
 #define EXC_Ov 12
 #define EXC_Tr 13
+#define EXC_FPE 15
 #define EXC_Watch 23
 #define EXC_MCheck 24
 
@@ -127,11 +159,9 @@ static inline uint32_t isKernelMode(Mips * emu) {
 #define TLBRET_INVALID 3
 
 //horrible but deterministic fake rand for testing
-uint32_t counter = 0;
-
-static uint32_t randomInRange(uint32_t a,uint32_t b) {
-   counter++;
-   return a + (counter % (1 + b - a));
+static uint32_t randomInRange(Mips * emu,uint32_t a,uint32_t b) {
+   emu->randomCounter++;
+   return a + (emu->randomCounter % (1 + b - a));
 }
 
 static void writeTlbExceptionExtraData(Mips * emu,uint32_t vaddr) {
@@ -218,6 +248,7 @@ static inline int translateAddress(Mips * emu,uint32_t vaddr,uint32_t * paddr_ou
             return tlb_lookup(emu,vaddr,paddr_out, write);
         } else {
             *paddr_out = vaddr;
+            flushOutput_mips(emu);
             puts("translateAddress: unhandled exception");
             exit(1);
             return 1;
@@ -238,6 +269,7 @@ static uint32_t readVirtWord(Mips * emu, uint32_t addr) {
     }
     
     if(paddr % 4 != 0) {
+        flushOutput_mips(emu);
         printf("Unhandled alignment error reading addr %08x\n",addr);
         exit(1); 
     }
@@ -246,7 +278,20 @@ static uint32_t readVirtWord(Mips * emu, uint32_t addr) {
         return uart_read(emu,paddr - UARTBASE);
     }
     
+    if(paddr >= BLKDEVBASE && paddr < BLKDEVBASE + BLKDEVSIZE) {
+        return blkdev_read(emu,paddr - BLKDEVBASE);
+    }
+    
+    if(paddr >= CONSBASE && paddr < CONSBASE + CONSSIZE) {
+        return console_read(emu,paddr - CONSBASE);
+    }
+    
+    if(paddr >= DMABASE && paddr < DMABASE + DMASIZE) {
+        return dma_read(emu,paddr - DMABASE);
+    }
+    
     if (paddr >= emu->pmemsz) {
+        flushOutput_mips(emu);
         printf("unhandled bus error at pc: %08x reading paddr: %08x\n",emu->pc,paddr);
         exit(1);
     }
@@ -262,6 +307,7 @@ static void writeVirtWord(Mips * emu, uint32_t addr,uint32_t val) {
     }
     
     if(paddr % 4 != 0) {
+        flushOutput_mips(emu);
         printf("Unhandled alignment error reading addr %08x\n",addr);
         exit(1); 
     }
@@ -271,6 +317,21 @@ static void writeVirtWord(Mips * emu, uint32_t addr,uint32_t val) {
         return;
     }
     
+    if(paddr >= BLKDEVBASE && paddr < BLKDEVBASE + BLKDEVSIZE) {
+        blkdev_write(emu,paddr - BLKDEVBASE,val);
+        return;
+    }
+    
+    if(paddr >= CONSBASE && paddr < CONSBASE + CONSSIZE) {
+        console_write(emu,emu->mem,paddr - CONSBASE,val);
+        return;
+    }
+    
+    if(paddr >= DMABASE && paddr < DMABASE + DMASIZE) {
+        dma_write(emu,emu->mem,paddr - DMABASE,val);
+        return;
+    }
+    
     if (paddr >= emu->pmemsz) {
         printf("bus error at pc: %08x writing paddr: %08x\n",emu->pc,paddr);
         setExceptionCode(emu,EXC_DBE);
@@ -294,7 +355,21 @@ static uint8_t readVirtByte(Mips * emu, uint32_t addr) {
     
     unsigned int offset = paddr&3;
     
+    // the device sees a word read, as on the cen64 bus
+    if(paddr >= BLKDEVBASE && paddr < BLKDEVBASE + BLKDEVSIZE) {
+        return blkdev_read(emu,paddr - BLKDEVBASE) >> 8*(3 - offset);
+    }
+    
+    if(paddr >= CONSBASE && paddr < CONSBASE + CONSSIZE) {
+        return console_read(emu,paddr - CONSBASE) >> 8*(3 - offset);
+    }
+    
+    if(paddr >= DMABASE && paddr < DMABASE + DMASIZE) {
+        return dma_read(emu,paddr - DMABASE) >> 8*(3 - offset);
+    }
+    
     if (paddr >= emu->pmemsz) {
+        flushOutput_mips(emu);
         printf("unhandled bus error paddr: %08x\n",paddr);
         exit(1);
     }
@@ -319,12 +394,22 @@ static void writeVirtByte(Mips * emu, uint32_t addr,uint8_t val) {
         return;
     }
     
+    // device registers are word-only; byte stores are dropped, as the
+    // cen64 bus does for a partial dqm
+    if((paddr >= BLKDEVBASE && paddr < BLKDEVBASE + BLKDEVSIZE) ||
+       (paddr >= CONSBASE && paddr < CONSBASE + CONSSIZE) ||
+       (paddr >= DMABASE && paddr < DMABASE + DMASIZE)) {
+        return;
+    }
+    
     if(paddr >= POWERBASE && paddr <= POWERBASE + POWERSIZE) {
+        uart_flush(emu);
         emu->shutdown = 1;
         return;
     }
     
     if (paddr >= emu->pmemsz) {
+        flushOutput_mips(emu);
         printf("unhandled bus error paddr: %08x\n",paddr);
         exit(1);
     }
@@ -383,6 +468,10 @@ static void handleException(Mips * emu,int inDelaySlot) {
         emu->pc = 0x80000000 + offset;
     }
 
+    if (emu->callgraph) {
+        callgraph_exception(emu->callgraph, emu->pc);
+    }
+
     //if(exccode != EXC_Int) {
     //    #define TARGET_FMT_lx "%08x"
     //    printf("\nException: PC " TARGET_FMT_lx " EPC " TARGET_FMT_lx " cause %d\n"
@@ -595,6 +684,7 @@ static void op_bnel(Mips * emu,uint32_t op) {
 
 static void op_tne(Mips * emu,uint32_t op) {
 	if (getRs(emu,op) != getRt(emu,op) ) {
+		flushOutput_mips(emu);
 		puts("unhandled trap!");
 		exit(1);
 	}
@@ -612,6 +702,10 @@ static void op_jal(Mips * emu,uint32_t op) {
 	emu->delaypc = addr;
 	emu->regs[31] = pc + 8;
 	emu->inDelaySlot = 1;
+
+    if (emu->callgraph) {
+        callgraph_call(emu->callgraph, addr, pc + 8);
+    }
 }
 
 static void op_sb(Mips * emu,uint32_t op) {
@@ -969,7 +1063,7 @@ static void op_mfc0(Mips * emu,uint32_t op) {
                 break;
             }
             if (sel == 1) {
-                retval = 0x1e190c8a;
+                retval = 0x1e190c8b; // FP: CP1 is implemented
                 break;
             }
             goto unhandled;
@@ -981,6 +1075,7 @@ static void op_mfc0(Mips * emu,uint32_t op) {
         
         default:
             unhandled:
+            flushOutput_mips(emu);
             printf("unhandled cp0 reg selector in mfc0 %d %d\n",regNum,sel);
             exit(1);
     }
@@ -1019,10 +1114,12 @@ static void op_mtc0(Mips * emu,uint32_t op) {
                 goto unhandled;
             }
             if (rt) {
+                flushOutput_mips(emu);
                 puts("untested page mask!");
                 exit(1);
             }
             if (rt != 0) {
+                flushOutput_mips(emu);
                 puts("XXX unhandled page mask");
                 exit(1);
             }
@@ -1091,6 +1188,7 @@ static void op_mtc0(Mips * emu,uint32_t op) {
                 
         default:
             unhandled:
+            flushOutput_mips(emu);
             printf("unhandled cp0 reg selector in mtc0 %d %d\n",regNum,sel);
             exit(1);
     }
@@ -1122,6 +1220,10 @@ static void op_eret(Mips * emu, uint32_t op) {
         emu->CP0_Status &= ~(1 << 1); //clear EXL;
     }
     emu->pc -= 4; //counteract typical pc += 4
+
+    if (emu->callgraph) {
+        callgraph_eret(emu->callgraph);
+    }
 }
 
 static void helper_writeTlbEntry(Mips * emu,uint32_t idx) {
@@ -1149,7 +1251,7 @@ static void op_tlbwi(Mips * emu, uint32_t op) {
 }
 
 static void op_tlbwr(Mips * emu, uint32_t op) {
-    uint32_t idx = randomInRange(emu->CP0_Wired,15);
+    uint32_t idx = randomInRange(emu,emu->CP0_Wired,15);
     helper_writeTlbEntry(emu,idx);
 }
 
@@ -1324,11 +1426,20 @@ static void op_jalr(Mips * emu,uint32_t op) {
 	emu->delaypc = getRs(emu,op);
 	emu->regs[31] = emu->pc + 8;
 	emu->inDelaySlot = 1;
+
+    if (emu->callgraph) {
+        callgraph_call(emu->callgraph, emu->delaypc, emu->pc + 8);
+    }
 }
 
 static void op_jr(Mips * emu,uint32_t op) {
     emu->delaypc = getRs(emu,op);
 	emu->inDelaySlot = 1;
+
+    // jr $ra is a return
+    if (emu->callgraph && ((op >> 21) & 0x1f) == 31) {
+        callgraph_return(emu->callgraph, emu->delaypc);
+    }
 }
 
 static void op_srav(Mips * emu,uint32_t op) {
@@ -1422,6 +1533,440 @@ static void op_bltzl(Mips * emu,uint32_t op) {
 	}
 }
 
+/* CP1 (FPU) */
+
+#define FCR31_C     23 // condition bit
+#define FCR31_FLAGS 2
+#define FCR31_ENABLES 7
+#define FCR31_CAUSE 12
+
+#define FCR0_VALUE 0x00030b00 // S and D formats, VR4300 implementation number
+
+#define FMT_S 16
+#define FMT_D 17
+#define FMT_W 20
+
+// MXCSR rounding modes for the FCR31 RM field: RN, RZ, RP, RM
+static const fpu_state_t fpuRoundModes[4] = {
+    FPU_ROUND_NEAREST, FPU_ROUND_TOZERO, FPU_ROUND_POSINF, FPU_ROUND_NEGINF
+};
+
+// Puts the host FPU in the guest's rounding mode with no flags
+// raised. Runner threads can switch between machines, so this is
+// called whenever a machine starts running.
+void loadFpuState_mips(Mips * emu) {
+    fpu_set_state(FPU_MASK_EXCPS | fpuRoundModes[emu->FCR31 & 3]);
+}
+
+static inline uint32_t getFs(uint32_t op) {
+    return (op&0xf800) >> 11;
+}
+
+static inline uint32_t getFd(uint32_t op) {
+    return (op&0x7c0) >> 6;
+}
+
+static inline uint32_t getFt(uint32_t op) {
+    return (op&0x1f0000) >> 16;
+}
+
+// with FR=0 a double lives in an even/odd pair, low word in the even register
+static inline uint64_t getFprDouble(Mips * emu,uint32_t idx) {
+    idx &= ~1;
+    return ((uint64_t)emu->fpr[idx + 1] << 32) | emu->fpr[idx];
+}
+
+static inline void setFprDouble(Mips * emu,uint32_t idx,uint64_t v) {
+    idx &= ~1;
+    emu->fpr[idx] = (uint32_t)v;
+    emu->fpr[idx + 1] = (uint32_t)(v >> 32);
+}
+
+/* return 1 and raise CpU if CP1 is disabled */
+static int checkCop1Unusable(Mips * emu) {
+    if (emu->CP0_Status & (1 << CP0St_CU1)) {
+        return 0;
+    }
+    
+    setExceptionCode(emu,EXC_CpU);
+    emu->CP0_Cause = (emu->CP0_Cause & ~(3 << 28)) | (1 << 28); // CE = 1
+    emu->exceptionOccured = 1;
+    return 1;
+}
+
+// Picks up the exceptions the host raised for the last op. They go
+// in the cause field (which every arithmetic op rewrites); enabled
+// ones trap before the result is written, the rest set the flags.
+// return 1 if FPE was raised
+static int checkFpuExceptions(Mips * emu) {
+    fpu_state_t state = fpu_get_state();
+    uint32_t raised = ((state >> 5) & 0x01) | ((state >> 3) & 0x02) |
+        ((state >> 1) & 0x04) | ((state << 1) & 0x08) | ((state << 4) & 0x10);
+    
+    emu->FCR31 &= ~(0x3f << FCR31_CAUSE);
+    
+    if (!raised) {
+        return 0;
+    }
+    
+    fpu_set_state(state & ~FPU_FLAG_EXCPS);
+    emu->FCR31 |= raised << FCR31_CAUSE;
+    
+    if (raised & (emu->FCR31 >> FCR31_ENABLES)) {
+        setExceptionCode(emu,EXC_FPE);
+        emu->exceptionOccured = 1;
+        return 1;
+    }
+    
+    emu->FCR31 |= raised << FCR31_FLAGS;
+    return 0;
+}
+
+static void op_lwc1(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    
+	uint32_t addr = ((int32_t)getRs(emu,op) + (int16_t)getImm(op));
+	uint32_t v = readVirtWord(emu,addr);
+	if(emu->exceptionOccured) {
+        return;
+    }
+	emu->fpr[getFt(op)] = v;
+}
+
+static void op_swc1(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    
+	uint32_t addr = ((int32_t)getRs(emu,op) + (int16_t)getImm(op));
+	writeVirtWord(emu,addr,emu->fpr[getFt(op)]);
+}
+
+// the guest is big endian, so the high word of a double comes first
+static void op_ldc1(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    
+	uint32_t addr = ((int32_t)getRs(emu,op) + (int16_t)getImm(op));
+    if (addr % 8 != 0) {
+        emu->CP0_BadVAddr = addr;
+        setExceptionCode(emu,EXC_AdEL);
+        emu->exceptionOccured = 1;
+        return;
+    }
+    
+	uint32_t hi = readVirtWord(emu,addr);
+	if(emu->exceptionOccured) {
+        return;
+    }
+	uint32_t lo = readVirtWord(emu,addr + 4);
+	if(emu->exceptionOccured) {
+        return;
+    }
+    setFprDouble(emu,getFt(op),((uint64_t)hi << 32) | lo);
+}
+
+static void op_sdc1(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    
+	uint32_t addr = ((int32_t)getRs(emu,op) + (int16_t)getImm(op));
+    if (addr % 8 != 0) {
+        emu->CP0_BadVAddr = addr;
+        setExceptionCode(emu,EXC_AdES);
+        emu->exceptionOccured = 1;
+        return;
+    }
+    
+    uint64_t v = getFprDouble(emu,getFt(op));
+	writeVirtWord(emu,addr,(uint32_t)(v >> 32));
+	if(emu->exceptionOccured) {
+        return;
+    }
+	writeVirtWord(emu,addr + 4,(uint32_t)v);
+}
+
+static void op_mfc1(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    setRt(emu,op,emu->fpr[getFs(op)]);
+}
+
+static void op_mtc1(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    emu->fpr[getFs(op)] = getRt(emu,op);
+}
+
+static void op_cfc1(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    
+    switch (getFs(op)) {
+        case 0:
+            setRt(emu,op,FCR0_VALUE);
+            break;
+        case 31:
+            setRt(emu,op,emu->FCR31);
+            break;
+        default:
+            setRt(emu,op,0);
+            break;
+    }
+}
+
+static void op_ctc1(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    
+    if (getFs(op) != 31) {
+        return;
+    }
+    
+    uint32_t v = getRt(emu,op) & 0x0183ffff; // FS, C, cause, enables, flags, RM
+    emu->FCR31 = v;
+    fpu_set_state((fpu_get_state() & ~(FPU_ROUND_MASK | FPU_FLAG_EXCPS)) |
+        fpuRoundModes[v & 3]);
+    
+    // writing a cause bit that is enabled (E always is) traps
+    if ((v >> FCR31_CAUSE) & (((v >> FCR31_ENABLES) & 0x1f) | 0x20)) {
+        setExceptionCode(emu,EXC_FPE);
+        emu->exceptionOccured = 1;
+    }
+}
+
+static void op_bc1f(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    
+	int32_t offset = sext18(getImm(op) * 4);
+	if (!(emu->FCR31 & (1 << FCR31_C))) {
+		emu->delaypc = (int32_t)(emu->pc + 4) + offset;
+	} else {
+		emu->delaypc = emu->pc + 8;
+	}
+	emu->inDelaySlot = 1;
+}
+
+static void op_bc1t(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    
+	int32_t offset = sext18(getImm(op) * 4);
+	if (emu->FCR31 & (1 << FCR31_C)) {
+		emu->delaypc = (int32_t)(emu->pc + 4) + offset;
+	} else {
+		emu->delaypc = emu->pc + 8;
+	}
+	emu->inDelaySlot = 1;
+}
+
+static void op_bc1fl(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    
+	int32_t offset = sext18(getImm(op) * 4);
+	if (!(emu->FCR31 & (1 << FCR31_C))) {
+		emu->delaypc = (int32_t)(emu->pc + 4) + offset;
+		emu->inDelaySlot = 1;
+	} else {
+		emu->pc += 4;
+	}
+}
+
+static void op_bc1tl(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    
+	int32_t offset = sext18(getImm(op) * 4);
+	if (emu->FCR31 & (1 << FCR31_C)) {
+		emu->delaypc = (int32_t)(emu->pc + 4) + offset;
+		emu->inDelaySlot = 1;
+	} else {
+		emu->pc += 4;
+	}
+}
+
+// fd = fs op ft for both formats, trapping before the write if needed
+#define FPU_BINARY_OP(name,kernel) \
+static void op_##name##_s(Mips * emu,uint32_t op) { \
+    uint32_t fs, ft, fd; \
+    if (checkCop1Unusable(emu)) { \
+        return; \
+    } \
+    fs = emu->fpr[getFs(op)]; \
+    ft = emu->fpr[getFt(op)]; \
+    kernel##_32(&fs,&ft,&fd); \
+    if (checkFpuExceptions(emu)) { \
+        return; \
+    } \
+    emu->fpr[getFd(op)] = fd; \
+} \
+static void op_##name##_d(Mips * emu,uint32_t op) { \
+    uint64_t fs, ft, fd; \
+    if (checkCop1Unusable(emu)) { \
+        return; \
+    } \
+    fs = getFprDouble(emu,getFs(op)); \
+    ft = getFprDouble(emu,getFt(op)); \
+    kernel##_64(&fs,&ft,&fd); \
+    if (checkFpuExceptions(emu)) { \
+        return; \
+    } \
+    setFprDouble(emu,getFd(op),fd); \
+}
+
+// fd = op(fs) for an fs of format "from" (s, d or w)
+#define FPU_UNARY_OP(name,from,ti,to,kernel,get,set) \
+static void op_##name##_##from(Mips * emu,uint32_t op) { \
+    ti fs; \
+    to fd; \
+    if (checkCop1Unusable(emu)) { \
+        return; \
+    } \
+    fs = get(emu,getFs(op)); \
+    kernel(&fs,&fd); \
+    if (checkFpuExceptions(emu)) { \
+        return; \
+    } \
+    set(emu,getFd(op),fd); \
+}
+
+static inline uint32_t getFprSingle(Mips * emu,uint32_t idx) {
+    return emu->fpr[idx];
+}
+
+static inline void setFprSingle(Mips * emu,uint32_t idx,uint32_t v) {
+    emu->fpr[idx] = v;
+}
+
+#define FPU_OP_SS(name,kernel) \
+    FPU_UNARY_OP(name,s,uint32_t,uint32_t,kernel,getFprSingle,setFprSingle)
+#define FPU_OP_DD(name,kernel) \
+    FPU_UNARY_OP(name,d,uint64_t,uint64_t,kernel,getFprDouble,setFprDouble)
+#define FPU_OP_SD(name,kernel) \
+    FPU_UNARY_OP(name,s,uint32_t,uint64_t,kernel,getFprSingle,setFprDouble)
+#define FPU_OP_DS(name,kernel) \
+    FPU_UNARY_OP(name,d,uint64_t,uint32_t,kernel,getFprDouble,setFprSingle)
+#define FPU_OP_WS(name,kernel) \
+    FPU_UNARY_OP(name,w,uint32_t,uint32_t,kernel,getFprSingle,setFprSingle)
+#define FPU_OP_WD(name,kernel) \
+    FPU_UNARY_OP(name,w,uint32_t,uint64_t,kernel,getFprSingle,setFprDouble)
+
+FPU_BINARY_OP(add,fpu_add)
+FPU_BINARY_OP(sub,fpu_sub)
+FPU_BINARY_OP(mul,fpu_mul)
+FPU_BINARY_OP(div,fpu_div)
+
+FPU_OP_SS(sqrt,fpu_sqrt_32)
+FPU_OP_DD(sqrt,fpu_sqrt_64)
+FPU_OP_SS(abs,fpu_abs_32)
+FPU_OP_DD(abs,fpu_abs_64)
+FPU_OP_SS(neg,fpu_neg_32)
+FPU_OP_DD(neg,fpu_neg_64)
+
+FPU_OP_SD(cvt_d,fpu_cvt_f64_f32)
+FPU_OP_WD(cvt_d,fpu_cvt_f64_i32)
+FPU_OP_DS(cvt_s,fpu_cvt_f32_f64)
+FPU_OP_WS(cvt_s,fpu_cvt_f32_i32)
+FPU_OP_SS(cvt_w,fpu_cvt_i32_f32)
+FPU_OP_DS(cvt_w,fpu_cvt_i32_f64)
+FPU_OP_SS(round_w,fpu_round_i32_f32)
+FPU_OP_DS(round_w,fpu_round_i32_f64)
+FPU_OP_SS(trunc_w,fpu_trunc_i32_f32)
+FPU_OP_DS(trunc_w,fpu_trunc_i32_f64)
+FPU_OP_SS(ceil_w,fpu_ceil_i32_f32)
+FPU_OP_DS(ceil_w,fpu_ceil_i32_f64)
+FPU_OP_SS(floor_w,fpu_floor_i32_f32)
+FPU_OP_DS(floor_w,fpu_floor_i32_f64)
+
+static void op_mov_s(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    emu->fpr[getFd(op)] = emu->fpr[getFs(op)];
+}
+
+static void op_mov_d(Mips * emu,uint32_t op) {
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    setFprDouble(emu,getFd(op),getFprDouble(emu,getFs(op)));
+}
+
+// c.cond.fmt: the low three cond bits pick the predicate; the
+// signalling forms (cond & 8) raise invalid for any NaN, so only they
+// use the comis kernels, the quiet ones the ucomis (qcmp) kernels
+static void op_c_s(Mips * emu,uint32_t op) {
+    uint32_t fs, ft;
+    uint8_t flag;
+    int sig = op & 8;
+    
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    
+    fs = emu->fpr[getFs(op)];
+    ft = emu->fpr[getFt(op)];
+    
+    switch (op & 7) {
+        case 0: flag = sig ? fpu_cmp_f_32(&fs,&ft) : fpu_qcmp_f_32(&fs,&ft); break;
+        case 1: flag = sig ? fpu_cmp_un_32(&fs,&ft) : fpu_qcmp_un_32(&fs,&ft); break;
+        case 2: flag = sig ? fpu_cmp_eq_32(&fs,&ft) : fpu_qcmp_eq_32(&fs,&ft); break;
+        case 3: flag = sig ? fpu_cmp_ueq_32(&fs,&ft) : fpu_qcmp_ueq_32(&fs,&ft); break;
+        case 4: flag = sig ? fpu_cmp_olt_32(&fs,&ft) : fpu_qcmp_olt_32(&fs,&ft); break;
+        case 5: flag = sig ? fpu_cmp_ult_32(&fs,&ft) : fpu_qcmp_ult_32(&fs,&ft); break;
+        case 6: flag = sig ? fpu_cmp_ole_32(&fs,&ft) : fpu_qcmp_ole_32(&fs,&ft); break;
+        default: flag = sig ? fpu_cmp_ule_32(&fs,&ft) : fpu_qcmp_ule_32(&fs,&ft); break;
+    }
+    
+    if (checkFpuExceptions(emu)) {
+        return;
+    }
+    emu->FCR31 = (emu->FCR31 & ~(1 << FCR31_C)) | (flag << FCR31_C);
+}
+
+static void op_c_d(Mips * emu,uint32_t op) {
+    uint64_t fs, ft;
+    uint8_t flag;
+    int sig = op & 8;
+    
+    if (checkCop1Unusable(emu)) {
+        return;
+    }
+    
+    fs = getFprDouble(emu,getFs(op));
+    ft = getFprDouble(emu,getFt(op));
+    
+    switch (op & 7) {
+        case 0: flag = sig ? fpu_cmp_f_64(&fs,&ft) : fpu_qcmp_f_64(&fs,&ft); break;
+        case 1: flag = sig ? fpu_cmp_un_64(&fs,&ft) : fpu_qcmp_un_64(&fs,&ft); break;
+        case 2: flag = sig ? fpu_cmp_eq_64(&fs,&ft) : fpu_qcmp_eq_64(&fs,&ft); break;
+        case 3: flag = sig ? fpu_cmp_ueq_64(&fs,&ft) : fpu_qcmp_ueq_64(&fs,&ft); break;
+        case 4: flag = sig ? fpu_cmp_olt_64(&fs,&ft) : fpu_qcmp_olt_64(&fs,&ft); break;
+        case 5: flag = sig ? fpu_cmp_ult_64(&fs,&ft) : fpu_qcmp_ult_64(&fs,&ft); break;
+        case 6: flag = sig ? fpu_cmp_ole_64(&fs,&ft) : fpu_qcmp_ole_64(&fs,&ft); break;
+        default: flag = sig ? fpu_cmp_ule_64(&fs,&ft) : fpu_qcmp_ule_64(&fs,&ft); break;
+    }
+    
+    if (checkFpuExceptions(emu)) {
+        return;
+    }
+    emu->FCR31 = (emu->FCR31 & ~(1 << FCR31_C)) | (flag << FCR31_C);
+}
+
 #include "./gen/doop.gen.c"
 
 
@@ -0,0 +1,280 @@
+// emutop: shows what running emulators are up to, from their stats
+// pages (see statspage.h), without disturbing them.
+
+#include "statspage.h"
+#include "vr4300/cpu.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_PAGES 64
+
+typedef struct {
+    char path[256];
+    const StatsPage * page;
+    size_t size;
+    StatsPageSlot * prev; // slots as of the previous refresh
+} Watched;
+
+static Watched watched[MAX_PAGES];
+static unsigned numWatched;
+
+static const char * stateNames[] = { "-", "run", "off", "limit" };
+
+static const Watched * findWatched(const char * path) {
+    unsigned i;
+
+    for (i = 0; i < numWatched; i++) {
+        if (!strcmp(watched[i].path, path)) {
+            return &watched[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Maps a stats page, if it looks like one we understand.
+static int watch(const char * path) {
+    const StatsPage * page;
+    struct stat sb;
+    Watched * w;
+    int fd;
+
+    if (numWatched == MAX_PAGES || findWatched(path)) {
+        return 1;
+    }
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return 1;
+    }
+
+    if (fstat(fd, &sb) || (size_t)sb.st_size < sizeof(StatsPage)) {
+        close(fd);
+        return 1;
+    }
+
+    page = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (page == MAP_FAILED) {
+        return 1;
+    }
+
+    if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != STATSPAGE_MAGIC ||
+        page->version != STATSPAGE_VERSION ||
+        page->slotSize != sizeof(StatsPageSlot) ||
+        sizeof(StatsPage) + page->numSlots * sizeof(StatsPageSlot) > (size_t)sb.st_size) {
+        munmap((void *)page, sb.st_size);
+        return 1;
+    }
+
+    w = &watched[numWatched];
+
+    if ((w->prev = calloc(page->numSlots, sizeof(StatsPageSlot))) == NULL) {
+        munmap((void *)page, sb.st_size);
+        return 1;
+    }
+
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    w->page = page;
+    w->size = sb.st_size;
+    numWatched++;
+    return 0;
+}
+
+// Drops pages whose emulator has exited (and removed the file).
+static void prune(void) {
+    unsigned i = 0;
+
+    while (i < numWatched) {
+        if (access(watched[i].path, F_OK) == 0) {
+            i++;
+            continue;
+        }
+
+        munmap((void *)watched[i].page, watched[i].size);
+        free(watched[i].prev);
+        watched[i] = watched[--numWatched];
+    }
+}
+
+// Picks up every emulator running on the host.
+static void scan(void) {
+    struct dirent * d;
+    DIR * dir;
+
+    if ((dir = opendir("/dev/shm")) == NULL) {
+        return;
+    }
+
+    while ((d = readdir(dir)) != NULL) {
+        char path[256];
+
+        if (strncmp(d->d_name, "emu-", 4)) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "/dev/shm/%s", d->d_name);
+        watch(path);
+    }
+
+    closedir(dir);
+}
+
+static void readSlot(const StatsPageSlot * src, StatsPageSlot * dst) {
+    unsigned i;
+
+#define LOAD(field) dst->field = __atomic_load_n(&src->field, __ATOMIC_RELAXED)
+    LOAD(state);
+    LOAD(type);
+    LOAD(steps);
+    LOAD(retired);
+    LOAD(pc);
+    LOAD(idle);
+    LOAD(uartBytes);
+    LOAD(hostNs);
+
+    for (i = 0; i < STATSPAGE_MEM_STATS; i++) {
+        LOAD(memStats[i]);
+    }
+#undef LOAD
+
+    memcpy(dst->name, src->name, sizeof(dst->name));
+    dst->name[sizeof(dst->name) - 1] = '\0';
+}
+
+static double hitRate(const uint64_t * stats, unsigned hits, unsigned misses) {
+    uint64_t total = stats[hits] + stats[misses];
+    return total ? 100.0 * stats[hits] / total : -1.0;
+}
+
+static void printRate(double rate) {
+    if (rate < 0) {
+        printf(" %6s", "-");
+    } else {
+        printf(" %5.1f%%", rate);
+    }
+}
+
+static void refresh(int clear) {
+    unsigned i, j;
+
+    if (clear) {
+        printf("\033[H\033[J");
+    }
+
+    printf("%-24s %5s %8s %9s %9s %6s %5s %9s %18s %7s %7s\n",
+        "machine", "state", "pid", "Msteps/s", "MIPS", "IPC", "idle",
+        "uart B/s", "pc", "I$", "D$");
+
+    for (i = 0; i < numWatched; i++) {
+        Watched * w = &watched[i];
+
+        for (j = 0; j < w->page->numSlots; j++) {
+            StatsPageSlot cur, * prev = &w->prev[j];
+            double secs, dsteps;
+
+            readSlot(&w->page->slots[j], &cur);
+
+            if (cur.state == STATSPAGE_EMPTY) {
+                continue;
+            }
+
+            secs = (cur.hostNs - prev->hostNs) / 1e9;
+            dsteps = cur.steps - prev->steps;
+
+            printf("%-24.24s %5s %8" PRIu64, cur.name,
+                stateNames[cur.state < 4 ? cur.state : 0], w->page->pid);
+
+            if (prev->hostNs && secs > 0) {
+                printf(" %9.2f %9.2f %6.3f %4.0f%% %9.0f",
+                    dsteps / secs / 1e6,
+                    (cur.retired - prev->retired) / secs / 1e6,
+                    dsteps ? (cur.retired - prev->retired) / dsteps : 0.0,
+                    dsteps ? 100.0 * (cur.idle - prev->idle) / dsteps : 0.0,
+                    (cur.uartBytes - prev->uartBytes) / secs);
+            } else {
+                printf(" %9s %9s %6s %5s %9s", "-", "-", "-", "-", "-");
+            }
+
+            printf(" %#18" PRIx64, cur.pc);
+            printRate(hitRate(cur.memStats,
+                VR4300_STAT_ICACHE_HITS, VR4300_STAT_ICACHE_MISSES));
+            printRate(hitRate(cur.memStats,
+                VR4300_STAT_DCACHE_HITS, VR4300_STAT_DCACHE_MISSES));
+            printf("\n");
+
+            *prev = cur;
+        }
+    }
+
+    fflush(stdout);
+}
+
+static void usage(const char * argv0) {
+    printf("Usage: %s [-d seconds] [-n refreshes] [pid|stats page...]\n", argv0);
+    printf("Watches every /dev/shm/emu-* page unless some are given.\n");
+}
+
+int main(int argc, char * argv[]) {
+    unsigned long refreshes = 0, n;
+    double delay = 1.0;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "d:n:")) != -1) {
+        switch (opt) {
+            case 'd':
+                delay = atof(optarg);
+                break;
+            case 'n':
+                refreshes = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (delay <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (i = optind; i < argc; i++) {
+        char path[256];
+        char * end;
+
+        strtoul(argv[i], &end, 10);
+
+        if (*end == '\0') {
+            snprintf(path, sizeof(path), "/dev/shm/emu-%s", argv[i]);
+        } else {
+            snprintf(path, sizeof(path), "%s", argv[i]);
+        }
+
+        if (watch(path)) {
+            fprintf(stderr, "%s is not a stats page\n", path);
+            return 1;
+        }
+    }
+
+    for (n = 0; !refreshes || n < refreshes; n++) {
+        prune();
+
+        if (optind == argc) {
+            scan();
+        }
+
+        refresh(isatty(STDOUT_FILENO));
+        usleep(delay * 1e6);
+    }
+
+    return 0;
+}
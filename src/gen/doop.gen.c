@@ -93,12 +93,116 @@ void doop(Mips * emu, uint32_t op) {
         case 0xc0000000:
             op_ll(emu,op);
             return;
+        case 0xc4000000:
+            op_lwc1(emu,op);
+            return;
         case 0xcc000000:
             op_pref(emu,op);
             return;
+        case 0xd4000000:
+            op_ldc1(emu,op);
+            return;
         case 0xe0000000:
             op_sc(emu,op);
             return;
+        case 0xe4000000:
+            op_swc1(emu,op);
+            return;
+        case 0xf4000000:
+            op_sdc1(emu,op);
+            return;
+    }
+    switch(op & 0xffe0003f) {
+        case 0x46000000:
+            op_add_s(emu,op);
+            return;
+        case 0x46000001:
+            op_sub_s(emu,op);
+            return;
+        case 0x46000002:
+            op_mul_s(emu,op);
+            return;
+        case 0x46000003:
+            op_div_s(emu,op);
+            return;
+        case 0x46000004:
+            op_sqrt_s(emu,op);
+            return;
+        case 0x46000005:
+            op_abs_s(emu,op);
+            return;
+        case 0x46000006:
+            op_mov_s(emu,op);
+            return;
+        case 0x46000007:
+            op_neg_s(emu,op);
+            return;
+        case 0x4600000c:
+            op_round_w_s(emu,op);
+            return;
+        case 0x4600000d:
+            op_trunc_w_s(emu,op);
+            return;
+        case 0x4600000e:
+            op_ceil_w_s(emu,op);
+            return;
+        case 0x4600000f:
+            op_floor_w_s(emu,op);
+            return;
+        case 0x46000021:
+            op_cvt_d_s(emu,op);
+            return;
+        case 0x46000024:
+            op_cvt_w_s(emu,op);
+            return;
+        case 0x46200000:
+            op_add_d(emu,op);
+            return;
+        case 0x46200001:
+            op_sub_d(emu,op);
+            return;
+        case 0x46200002:
+            op_mul_d(emu,op);
+            return;
+        case 0x46200003:
+            op_div_d(emu,op);
+            return;
+        case 0x46200004:
+            op_sqrt_d(emu,op);
+            return;
+        case 0x46200005:
+            op_abs_d(emu,op);
+            return;
+        case 0x46200006:
+            op_mov_d(emu,op);
+            return;
+        case 0x46200007:
+            op_neg_d(emu,op);
+            return;
+        case 0x4620000c:
+            op_round_w_d(emu,op);
+            return;
+        case 0x4620000d:
+            op_trunc_w_d(emu,op);
+            return;
+        case 0x4620000e:
+            op_ceil_w_d(emu,op);
+            return;
+        case 0x4620000f:
+            op_floor_w_d(emu,op);
+            return;
+        case 0x46200020:
+            op_cvt_s_d(emu,op);
+            return;
+        case 0x46200024:
+            op_cvt_w_d(emu,op);
+            return;
+        case 0x46800020:
+            op_cvt_s_w(emu,op);
+            return;
+        case 0x46800021:
+            op_cvt_d_w(emu,op);
+            return;
     }
     switch(op & 0xfc00003f) {
         case 0x0:
@@ -215,6 +319,26 @@ void doop(Mips * emu, uint32_t op) {
             op_bgtzl(emu,op);
             return;
     }
+    switch(op & 0xffe00000) {
+        case 0x40000000:
+            op_mfc0(emu,op);
+            return;
+        case 0x40800000:
+            op_mtc0(emu,op);
+            return;
+        case 0x44000000:
+            op_mfc1(emu,op);
+            return;
+        case 0x44400000:
+            op_cfc1(emu,op);
+            return;
+        case 0x44800000:
+            op_mtc1(emu,op);
+            return;
+        case 0x44c00000:
+            op_ctc1(emu,op);
+            return;
+    }
     switch(op & 0xffffffff) {
         case 0x42000002:
             op_tlbwi(emu,op);
@@ -229,6 +353,20 @@ void doop(Mips * emu, uint32_t op) {
             op_eret(emu,op);
             return;
     }
+    switch(op & 0xffff0000) {
+        case 0x45000000:
+            op_bc1f(emu,op);
+            return;
+        case 0x45010000:
+            op_bc1t(emu,op);
+            return;
+        case 0x45020000:
+            op_bc1fl(emu,op);
+            return;
+        case 0x45030000:
+            op_bc1tl(emu,op);
+            return;
+    }
     switch(op & 0xfc0007ff) {
         case 0xa:
             op_movz(emu,op);
@@ -240,12 +378,12 @@ void doop(Mips * emu, uint32_t op) {
             op_mul(emu,op);
             return;
     }
-    switch(op & 0xffe00000) {
-        case 0x40000000:
-            op_mfc0(emu,op);
+    switch(op & 0xffe007f0) {
+        case 0x46000030:
+            op_c_s(emu,op);
             return;
-        case 0x40800000:
-            op_mtc0(emu,op);
+        case 0x46200030:
+            op_c_d(emu,op);
             return;
     }
     switch(op & 0xfe00003f) {
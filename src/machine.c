@@ -0,0 +1,1000 @@
+#include "machine.h"
+#include "common/callgraph.h"
+#include "common/perf.h"
+#include "common/ram.h"
+#include "common/snapshot.h"
+#include "common/symbols.h"
+#include "vr4300/cp1.h"
+#include "vr4300/cpu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#define MACHINE_DEFAULT_MEMSIZE (64 * 1024 * 1024)
+
+// How often (in host ns) a time-based sample period gets adjusted.
+#define MACHINE_CLOCK_NS 10000000ULL
+
+static unsigned statsRequests;
+
+static void lockMachine(Machine * m) {
+    if(pthread_mutex_lock(&m->mutex)) {
+        puts("mutex failed lock, exiting");
+        exit(1);
+    }
+}
+
+static void unlockMachine(Machine * m) {
+    if(pthread_mutex_unlock(&m->mutex)) {
+        puts("mutex failed unlock, exiting");
+        exit(1);
+    }
+}
+
+static const char * machineName(const Machine * m) {
+    return m->config.image ? m->config.image : m->config.loadPath;
+}
+
+static uint64_t clockNs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Detailed builds always collect statistics, for every pcycle unless
+// a sample period is given.
+static int wantStats(const MachineConfig * config) {
+#ifdef VR4300_DETAILED_STATS
+    return 1;
+#else
+    return config->statsInterval || config->statsSample || config->statsSampleNs;
+#endif
+}
+
+// Loads an srec into RAM the way cmips does.
+static int loadSrecInto(const char * path, uint8_t * mem, uint32_t memSize) {
+    Mips loader;
+
+    memset(&loader, 0, sizeof(loader));
+    loader.mem = (uint32_t *)mem;
+    loader.pmemsz = memSize;
+    return loadSrecFromFile_mips(&loader, (char *)path);
+}
+
+// Sets up the image each backend's RAM is a copy-on-write view of:
+// the RAM image file if there is one, else an in-memory image with
+// the srec loaded into it (once, for every view to share).
+static int openRamImage(Machine * m, struct ram_image * image) {
+    const MachineConfig * config = &m->config;
+    uint8_t * mem;
+    int failed;
+
+    if (config->ramPath) {
+        if (ram_image_open(image, config->ramPath, config->memSize)) {
+            printf("failed to open RAM image %s\n", config->ramPath);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if (ram_image_create(image, config->memSize)) {
+        puts("creating RAM image failed.");
+        return 1;
+    }
+
+    if (!config->image) {
+        return 0;
+    }
+
+    if ((mem = ram_image_map_shared(image)) == NULL) {
+        puts("mapping RAM image failed.");
+        ram_image_close(image);
+        return 1;
+    }
+
+    failed = loadSrecInto(config->image, mem, config->memSize);
+    ram_unmap(mem, config->memSize);
+
+    if (failed) {
+        printf("failed loading srec %s\n", config->image);
+        ram_image_close(image);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Maps a backend's own view of RAM. A RAM image file is never written,
+// so the srec goes into each view on top of it. With hugePages, the
+// view the guest runs on gets huge pages instead of sharing the image.
+static uint8_t * mapRam(Machine * m, const struct ram_image * image,
+  int running) {
+    const MachineConfig * config = &m->config;
+    enum ram_pages pages;
+    uint8_t * mem;
+
+    if (config->hugePages && running) {
+        mem = ram_image_map_huge(image, &pages);
+
+        if (mem && pages == RAM_PAGES_SMALL) {
+            puts("huge pages unavailable, using 4KiB pages.");
+        }
+    } else {
+        mem = ram_image_map(image);
+    }
+
+    if (mem == NULL) {
+        puts("mapping RAM failed.");
+        return NULL;
+    }
+
+    if (config->ramPath && config->image &&
+        loadSrecInto(config->image, mem, config->memSize)) {
+        printf("failed loading srec %s\n", config->image);
+        ram_unmap(mem, config->memSize);
+        return NULL;
+    }
+
+    return mem;
+}
+
+static int initCen64(Machine * m, const struct ram_image * image,
+  const struct snapshot * snapshot) {
+    struct vr4300 * vr4300;
+
+    if ((m->mem = mapRam(m, image, 1)) == NULL) {
+        return 1;
+    }
+
+    if (bus_init(&m->bus, m->mem, m->config.memSize, m->emu)) {
+        puts("mapping memory failed.");
+        return 1;
+    }
+
+    if (snapshot && bus_load_snapshot(&m->bus, snapshot)) {
+        printf("snapshot %s has no cen64 RAM or UART state\n", m->config.loadPath);
+        return 1;
+    }
+
+    if ((m->vr4300 = vr4300 = vr4300_alloc()) == NULL) {
+        puts("allocating vr4300 failed.");
+        return 1;
+    }
+
+    vr4300_init(vr4300, &m->bus);
+
+    if (wantStats(&m->config)) {
+        if ((m->stats = calloc(1, sizeof(*m->stats))) == NULL) {
+            puts("allocating stats failed.");
+            return 1;
+        }
+
+        if (m->config.statsInterval) {
+            m->nextStats = m->steps + m->config.statsInterval;
+        }
+
+        m->statsBase = m->steps;
+        m->samplePeriod = m->config.statsSample ? m->config.statsSample : 1;
+        m->sampleWeight = m->sampleCountdown = 1;
+        m->sampleSeed = 0x9E3779B97F4A7C15ULL;
+        m->clockSteps = m->steps;
+        m->clockNs = clockNs();
+    }
+
+    if (m->config.logPath &&
+        (vr4300->log = fopen(m->config.logPath, "a")) == NULL) {
+        printf("failed to open %s\n", m->config.logPath);
+        return 1;
+    }
+
+    if (snapshot) {
+        if (vr4300_load_snapshot(vr4300, snapshot)) {
+            printf("snapshot %s has no cen64 state\n", m->config.loadPath);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    vr4300->pipeline.icrf_latch.pc = 0xFFFFFFFF801E4B10ULL;
+
+    // Prime the pipeline...
+    while (vr4300->pipeline.dcwb_latch.common.pc != 0xFFFFFFFF801E4B10ULL ||
+          (vr4300->pipeline.dcwb_latch.common.fault ||
+          vr4300->pipeline.dcwb_latch.common.killed))
+      vr4300_cycle(vr4300);
+
+    return 0;
+}
+
+// Attaches a call-graph profile to whichever backend is running.
+// Symbols are optional: without them, functions go by address.
+static int startProfile(Machine * m) {
+    const char * symbolsPath = m->config.symbolsPath;
+
+    if ((m->callgraph = callgraph_create()) == NULL) {
+        puts("allocating call graph failed.");
+        return 1;
+    }
+
+    if (symbolsPath) {
+        if ((m->symbols = malloc(sizeof(*m->symbols))) == NULL) {
+            puts("allocating symbols failed.");
+            return 1;
+        }
+
+        if (symbols_load(m->symbols, symbolsPath)) {
+            printf("failed loading symbols from %s\n", symbolsPath);
+            free(m->symbols);
+            m->symbols = NULL;
+            return 1;
+        }
+    }
+
+    if (m->vr4300) {
+        m->vr4300->callgraph = m->callgraph;
+    } else {
+        m->emu->callgraph = m->callgraph;
+    }
+
+    return 0;
+}
+
+Machine * new_machine(const MachineConfig * config) {
+    struct snapshot snapshot;
+    struct ram_image ram;
+    int haveSnapshot = 0;
+    int haveRam = 0;
+    uint8_t * mem;
+    Machine * m;
+
+    m = calloc(1,sizeof(Machine));
+
+    if (!m) {
+        puts("allocating machine failed.");
+        return NULL;
+    }
+
+    m->config = *config;
+
+    if (!m->config.memSize) {
+        m->config.memSize = MACHINE_DEFAULT_MEMSIZE;
+    }
+
+    if(pthread_mutex_init(&m->mutex,NULL)) {
+        puts("failed to create mutex");
+        free(m);
+        return NULL;
+    }
+
+    if (openRamImage(m, &ram)) {
+        goto fail;
+    }
+
+    haveRam = 1;
+
+    if ((mem = mapRam(m, &ram, config->type == MACHINE_CMIPS)) == NULL) {
+        goto fail;
+    }
+
+    if ((m->emu = new_mips_on((uint32_t *)mem, m->config.memSize)) == NULL) {
+        puts("allocating emu failed.");
+        ram_unmap(mem, m->config.memSize);
+        goto fail;
+    }
+
+    if (config->uartPath &&
+        (m->emu->uartOut = fopen(config->uartPath, "w")) == NULL) {
+        printf("failed to open %s\n", config->uartPath);
+        goto fail;
+    }
+
+    if (uart_open_tx(m->emu, config->uartTx)) {
+        puts("allocating UART buffer failed.");
+        goto fail;
+    }
+
+    if (config->loadPath) {
+        if (snapshot_open(&snapshot, config->loadPath)) {
+            printf("failed to open snapshot %s\n", config->loadPath);
+            goto fail;
+        }
+
+        haveSnapshot = 1;
+        m->steps = snapshot.header->steps;
+    }
+
+    if (config->type == MACHINE_CEN64) {
+        if (initCen64(m, &ram, haveSnapshot ? &snapshot : NULL)) {
+            goto fail;
+        }
+    } else if (haveSnapshot && loadSnapshot_mips(m->emu, &snapshot)) {
+        goto fail;
+    }
+
+    // Neither is needed past here, and the fail path mustn't close them
+    // again.
+    if (haveSnapshot) {
+        snapshot_close(&snapshot);
+        haveSnapshot = 0;
+    }
+
+    if (haveRam) {
+        ram_image_close(&ram);
+        haveRam = 0;
+    }
+
+    if (config->diskPath && blkdev_open(m->emu, config->diskPath,
+        config->type == MACHINE_CEN64 ? (uint32_t *)m->mem : m->emu->mem)) {
+        printf("failed to open disk image %s\n", config->diskPath);
+        goto fail;
+    }
+
+    if (config->profilePath && startProfile(m)) {
+        goto fail;
+    }
+
+    if (config->statsSlot) {
+        claimSlot_statspage(config->statsSlot, machineName(m), config->type);
+    }
+
+    return m;
+
+fail:
+    if (haveSnapshot) {
+        snapshot_close(&snapshot);
+    }
+
+    if (haveRam) {
+        ram_image_close(&ram);
+    }
+
+    free_machine(m);
+    return NULL;
+}
+
+void free_machine(Machine * m) {
+    if (m->vr4300) {
+        if (m->vr4300->log) {
+            fclose(m->vr4300->log);
+        }
+
+        vr4300_free(m->vr4300);
+    }
+
+    bus_destroy(&m->bus);
+
+    free(m->stats);
+
+    if (m->callgraph) {
+        callgraph_destroy(m->callgraph);
+    }
+
+    if (m->symbols) {
+        symbols_free(m->symbols);
+        free(m->symbols);
+    }
+
+    if (m->emu) {
+        blkdev_close(m->emu);
+        uart_close_tx(m->emu);
+        free_outbuf(m->emu->out);
+
+        if (m->emu->uartOut) {
+            fclose(m->emu->uartOut);
+        }
+
+        ram_unmap((uint8_t *)m->emu->mem, m->config.memSize);
+        m->emu->mem = NULL;
+        free_mips(m->emu);
+    }
+
+    ram_unmap(m->mem, m->config.memSize);
+    pthread_mutex_destroy(&m->mutex);
+    free(m);
+}
+
+// Passes device events on to the guest between batches. Devices raise
+// their lines in the cmips Cause register, which cen64 mirrors.
+static void pollDevices(Machine * m) {
+    blkdev_poll(m->emu);
+    dma_poll(m->emu);
+    uart_poll(m->emu);
+
+    if (m->vr4300) {
+        vr4300_set_interrupt_lines(m->vr4300, m->emu->CP0_Cause >> 10);
+    }
+}
+
+// Writes out a snapshot of whichever backend is running. Steps are
+// cmips instructions or cen64 pcycles, and get stored in the header.
+static void saveSnapshot(Machine * m) {
+    const char * path = m->config.savePath;
+    struct snapshot_writer writer;
+    int status;
+
+    if (snapshot_create(&writer, path, m->steps)) {
+        fprintf(stderr, "failed to create snapshot %s\n", path);
+        return;
+    }
+
+    // Device state only settles once no requests are in flight.
+    blkdev_drain(m->emu);
+    pollDevices(m);
+
+    if (m->vr4300) {
+        // Flush the data cache first so the RAM section is complete,
+        // and pick up any FP exception flags still in the host FPU.
+        vr4300_writeback_dcache(m->vr4300);
+        vr4300_cp1_save_host_state(m->vr4300);
+        status = vr4300_save_snapshot(m->vr4300, &writer) ||
+            bus_save_snapshot(&m->bus, &writer);
+        vr4300_cp1_load_host_state(m->vr4300);
+    } else {
+        status = saveSnapshot_mips(m->emu, &writer);
+    }
+
+    if (snapshot_finish(&writer) || status) {
+        fprintf(stderr, "failed writing snapshot %s\n", path);
+    } else {
+        fprintf(stderr, "wrote snapshot %s @ %" PRIu64 " steps\n",
+            path, m->steps);
+    }
+}
+
+// Writes out the call-graph profile taken so far.
+static void saveProfile(Machine * m) {
+    const char * path = m->config.profilePath;
+
+    if (callgraph_write_folded(m->callgraph, path, m->symbols)) {
+        fprintf(stderr, "failed writing profile %s\n", path);
+    } else {
+        fprintf(stderr, "wrote profile %s (%u call paths)\n",
+            path, m->callgraph->num_nodes - 1);
+    }
+}
+
+// Instructions the guest has retired: cmips steps one at a time.
+static uint64_t guestInstructions(const Machine * m) {
+    return m->vr4300 ? m->vr4300->pipeline.retired_instructions : m->steps;
+}
+
+// Reports host events per guest instruction since counting started.
+static void printHostCounters(Machine * m) {
+    struct perf_counters * perf = m->perf;
+    uint64_t insns = guestInstructions(m) - m->perfInsns;
+    unsigned i;
+
+    perf_counters_read(perf);
+
+    flockfile(stdout);
+    printf("%s: host events (%s), %" PRIu64 " guest insns",
+        machineName(m), m->vr4300 ? "cen64" : "cmips", insns);
+
+    if (m->vr4300) {
+        printf(", %" PRIu64 " pcycles", m->steps - m->perfSteps);
+    }
+
+    printf(":\n");
+
+    for (i = 0; i < NUM_PERF_COUNTERS; i++) {
+        if (!perf_counter_available(perf, i)) {
+            printf("   %18s: %16s\n", perf_counter_names[i], "n/a");
+            continue;
+        }
+
+        printf("   %18s: %16" PRIu64 "  %10.3f/insn\n", perf_counter_names[i],
+            perf->values[i], insns ? (double)perf->values[i] / insns : 0.0);
+    }
+
+    fflush(stdout);
+    funlockfile(stdout);
+}
+
+// Prints the cen64 statistics, with the machine locked.
+static void printStats(Machine * m) {
+    m->stats->total_cycles = m->steps - m->statsBase;
+
+    flockfile(stdout);
+    printf("%s:\n", machineName(m));
+    vr4300_print_summary(m->vr4300, m->stats);
+
+    if (m->perf) {
+        printHostCounters(m);
+    }
+
+    fflush(stdout);
+    funlockfile(stdout);
+}
+
+// Opens host counters on the calling (runner) thread, if asked to.
+static void startHostCounters(Machine * m) {
+    if (!m->config.hostCounters) {
+        return;
+    }
+
+    if ((m->perf = malloc(sizeof(*m->perf))) == NULL) {
+        fprintf(stderr, "%s: allocating host counters failed\n", machineName(m));
+        return;
+    }
+
+    if (perf_counters_open(m->perf) == 0) {
+        fprintf(stderr, "%s: no host counters available\n", machineName(m));
+        free(m->perf);
+        m->perf = NULL;
+        return;
+    }
+
+    m->perfInsns = guestInstructions(m);
+    m->perfSteps = m->steps;
+    perf_counters_start(m->perf);
+}
+
+static void stopHostCounters(Machine * m) {
+    struct perf_counters * perf = m->perf;
+
+    if (!perf) {
+        return;
+    }
+
+    lockMachine(m);
+    perf_counters_stop(perf);
+
+    // Summaries already include them.
+    if (!m->stats) {
+        printHostCounters(m);
+    }
+
+    m->perf = NULL;
+    unlockMachine(m);
+
+    perf_counters_close(perf);
+    free(perf);
+}
+
+// Picks the pcycles until the next sample. These are jittered around
+// the period so that samples don't alias with loops in the guest.
+static uint64_t nextSampleInterval(Machine * m) {
+    uint64_t x = m->sampleSeed;
+
+    if (m->samplePeriod <= 1) {
+        return 1;
+    }
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    m->sampleSeed = x;
+
+    return m->samplePeriod / 2 + 1 + x % m->samplePeriod;
+}
+
+// Takes a sample; returns the pcycles until the next one.
+static uint64_t sampleCen64(Machine * m) {
+    vr4300_cycle_extra(m->vr4300, m->stats, m->sampleWeight);
+    m->sampleWeight = nextSampleInterval(m);
+    return m->sampleWeight;
+}
+
+// Retunes the sample period to hit about one sample per statsSampleNs
+// of host time. Idle pcycles are skipped without being sampled, so
+// only the busy ones count.
+static void adjustSamplePeriod(Machine * m) {
+    uint64_t busy = m->steps - m->vr4300->idle.idle_cycles;
+    uint64_t now = clockNs();
+    uint64_t period;
+
+    if (now - m->clockNs < MACHINE_CLOCK_NS) {
+        return;
+    }
+
+    period = (double) m->config.statsSampleNs *
+        (busy - m->clockSteps) / (now - m->clockNs);
+
+    if (period < 1) {
+        period = 1;
+    } else if (period > UINT32_MAX / 2) {
+        period = UINT32_MAX / 2;
+    }
+
+    m->samplePeriod = period;
+    m->clockSteps = busy;
+    m->clockNs = now;
+}
+
+// Copies the machine's counters out to its stats page slot.
+static void publishStats(Machine * m, StatsPageState state) {
+    StatsPageSlot * slot = m->config.statsSlot;
+    uint64_t retired = m->steps, pc = m->emu->pc, idle = 0;
+
+#define PUBLISH(field, value) \
+    __atomic_store_n(&slot->field, (value), __ATOMIC_RELAXED)
+
+    if (m->vr4300) {
+        retired = m->vr4300->pipeline.retired_instructions;
+        pc = m->vr4300->pipeline.last_pipe_result.pc;
+        idle = m->vr4300->idle.idle_cycles;
+
+#ifdef VR4300_DETAILED_STATS
+        unsigned i;
+
+        _Static_assert(NUM_VR4300_MEM_STATS <= STATSPAGE_MEM_STATS,
+            "stats page is too small for the memory counters");
+
+        for (i = 0; i < NUM_VR4300_MEM_STATS; i++) {
+            PUBLISH(memStats[i], m->vr4300->mem_stats[i]);
+        }
+#endif
+    }
+
+    PUBLISH(steps, m->steps);
+    PUBLISH(retired, retired);
+    PUBLISH(pc, pc);
+    PUBLISH(idle, idle);
+    PUBLISH(uartBytes, m->emu->serial.txBytes);
+    PUBLISH(hostNs, clockNs());
+    PUBLISH(state, state);
+
+#undef PUBLISH
+}
+
+// Called between batches with the machine locked; returns nonzero
+// once the machine should stop.
+static int endOfBatch(Machine * m) {
+    pollDevices(m);
+
+    if (m->config.savePath && m->steps >= m->config.saveAt) {
+        saveSnapshot(m);
+        m->config.savePath = NULL;
+    }
+
+    if (m->stats) {
+        unsigned requests = __atomic_load_n(&statsRequests, __ATOMIC_RELAXED);
+        int due = m->nextStats && m->steps >= m->nextStats;
+
+        // The statistics are worked out in floating point, which has
+        // to be kept apart from the guest's rounding mode and flags.
+        vr4300_cp1_save_host_state(m->vr4300);
+
+        if (due || requests != m->statsRequests) {
+            m->statsRequests = requests;
+            printStats(m);
+        }
+
+        while (m->nextStats && m->steps >= m->nextStats) {
+            m->nextStats += m->config.statsInterval;
+        }
+
+        if (m->config.statsSampleNs) {
+            adjustSamplePeriod(m);
+        }
+
+        vr4300_cp1_load_host_state(m->vr4300);
+    }
+
+    if (m->config.statsSlot) {
+        publishStats(m, STATSPAGE_RUNNING);
+    }
+
+    return m->emu->shutdown == 1 ||
+        __atomic_load_n(&m->stopRequested, __ATOMIC_RELAXED) ||
+        (m->config.maxSteps && m->steps >= m->config.maxSteps);
+}
+
+static void runCen64(Machine * m) {
+  struct vr4300 *vr4300 = m->vr4300;
+  struct vr4300_stats *stats = m->stats;
+  struct callgraph *callgraph = m->callgraph;
+  uint64_t retired = vr4300->pipeline.retired_instructions;
+  int profileCycles = m->config.profileCycles;
+  int done = 0;
+
+  //printf("cmips starts at 0x%.8X... PRIMED!!\n",bus->emu->pc);
+
+  // Shadow copies of RAM for the lockstep comparison below, which
+  // is compiled out along with it.
+#if 0
+  struct bus_controller *bus = &m->bus;
+  unsigned steps_compld = 0;
+  uint8_t *mem_at_wb = malloc(bus->mem_size);
+  uint8_t *mem_at_commit = malloc(bus->mem_size);
+
+  if (mem_at_wb == NULL || mem_at_commit == NULL) {
+    printf("MOAR mammaries required!!\n");
+    abort();
+  }
+
+  memcpy(mem_at_wb, bus->emu->mem, bus->mem_size);
+  memcpy(mem_at_commit, bus->emu->mem, bus->mem_size);
+#endif
+
+  // This thread may have just run some other machine (or none yet).
+  vr4300_cp1_load_host_state(vr4300);
+
+  while (!done) {
+        uint64_t countdown;
+        int i;
+
+        lockMachine(m);
+        countdown = m->sampleCountdown;
+
+        for (i = 0; i < 10000; i++) {
+#if 0
+          //printf(".");
+          //fflush(stdout);
+
+          // printf("step_mips, pc: 0x%.8X\n", bus->emu->pc);
+          uint32_t cmp_pc = bus->emu->pc;
+          step_mips(bus->emu);
+
+          do {
+            vr4300_cycle(vr4300);
+          } while(vr4300->pipeline.last_pipe_result.fault ||
+                  vr4300->pipeline.last_pipe_result.killed);
+
+          vr4300->pipeline.last_pipe_result.fault = ~0;
+
+          if (cmp_pc != (uint32_t) vr4300->pipeline.last_pipe_result.pc) {
+            printf("PC mismatch detected @ %u steps!\n", steps_compld);
+            printf("cmips: 0x%.8X, cen64: 0x%.8X\n",
+              bus->emu->pc, vr4300->pipeline.last_pipe_result.pc);
+            abort();
+          }
+
+          size_t ri;
+          for (ri = 1; ri < 32; ri++) {
+            if ((uint32_t) vr4300->regs[ri] != bus->emu->regs[ri]) {
+              printf("GPR[%u] mismatch detected @ 0x%.8X/%u steps!\n", ri, cmp_pc, steps_compld);
+              printf("cmips: 0x%.8X, cen64: 0x%.8X\n", bus->emu->regs[ri], vr4300->regs[ri]);
+              abort();
+            }
+          }
+
+#if 0
+          else {
+            printf("cmips: 0x%.8X, cen64: 0x%.8X\n",
+              bus->emu->pc, vr4300->pipeline.last_pipe_result.pc);
+          }
+#endif
+
+// this is too slow
+#if 1
+        if (steps_compld > 242180) {
+          //memcpy(mem_at_commit, bus->mem, bus->mem_size);
+          if (steps_compld > 242182 && memcmp(mem_at_commit, bus->emu->mem, bus->mem_size)) {
+            size_t k;
+            bool false_alarm;
+            for (k = 0; k < bus->mem_size / 4; k++) {
+              uint32_t cm, cm1, cm2;
+              memcpy(&cm, mem_at_commit + k * 4, sizeof(cm));
+              memcpy(&cm1, mem_at_wb + k * 4, sizeof(cm1));
+              memcpy(&cm2, bus->mem + k * 4, sizeof(cm2));
+              if (cm != bus->emu->mem[k] && cm1 != bus->emu->mem[k] && cm2 != bus->emu->mem[k]) {
+                printf("Memory mismatch detected @ %u steps!\n", steps_compld);
+                printf("   -> @addr=0x%.8X ... cmips=0x%.8X, cen64=0x%.8X\n",
+                  (unsigned) (k * 4), bus->emu->mem[k], cm);
+                false_alarm = false;
+                break;
+              } else {
+                false_alarm = true;
+                break;
+              }
+            }
+            if (!false_alarm)
+            abort();
+          }
+
+          memcpy(mem_at_commit, mem_at_wb, bus->mem_size);
+          memcpy(mem_at_wb, bus->mem, bus->mem_size);
+        }
+#endif
+        steps_compld++;
+#else
+            // Skip ahead if the guest is sitting in an idle loop.
+            unsigned skipped = vr4300_idle_fast_forward(vr4300, 10000 - 1 - i);
+
+            i += skipped;
+            vr4300_cycle(vr4300);
+
+            if (callgraph) {
+                uint64_t now = vr4300->pipeline.retired_instructions;
+
+                callgraph_tick(callgraph, profileCycles ? skipped + 1 : now - retired);
+                retired = now;
+            }
+
+            if (stats && --countdown == 0) {
+                countdown = sampleCen64(m);
+            }
+#endif
+        }
+
+        m->sampleCountdown = countdown;
+        m->steps += 10000;
+        done = endOfBatch(m);
+        unlockMachine(m);
+  }
+
+  vr4300_cp1_save_host_state(vr4300);
+
+#if 0
+  free(mem_at_wb);
+  free(mem_at_commit);
+#endif
+
+  if (stats) {
+    printStats(m);
+  }
+}
+
+static void runCmips(Machine * m) {
+    struct callgraph * callgraph = m->callgraph;
+    Mips * emu = m->emu;
+    int done = 0;
+
+    // This thread may have just run some other machine (or none yet).
+    loadFpuState_mips(emu);
+
+    while(!done) {
+        int i;
+
+        lockMachine(m);
+
+        if (callgraph) {
+            for(i = 0; i < 1000 ; i++) {
+                step_mips(emu);
+                callgraph_tick(callgraph, 1);
+            }
+        } else {
+            for(i = 0; i < 1000 ; i++)
+                step_mips(emu);
+        }
+
+        m->steps += 1000;
+        done = endOfBatch(m);
+        unlockMachine(m);
+    }
+}
+
+// Runs until the guest powers off (returns 0) or hits the step limit
+// (returns 1).
+int run_machine(Machine * m) {
+    int status;
+
+    startHostCounters(m);
+
+    if (m->config.type == MACHINE_CEN64) {
+        runCen64(m);
+    } else {
+        runCmips(m);
+    }
+
+    stopHostCounters(m);
+    uart_flush(m->emu);
+
+    if (m->emu->out) {
+        outbuf_flush(m->emu->out);
+    }
+
+    if (m->callgraph) {
+        saveProfile_machine(m);
+    }
+
+    status = m->emu->shutdown == 1 ? 0 : 1;
+
+    if (m->config.statsSlot) {
+        publishStats(m, status ? STATSPAGE_STEP_LIMIT : STATSPAGE_POWERED_OFF);
+    }
+
+    return status;
+}
+
+// Feeds a character of host input into the machine's UART.
+void receiveChar_machine(Machine * m, uint8_t c) {
+    lockMachine(m);
+    uart_RecieveChar(m->emu,c);
+    unlockMachine(m);
+}
+
+// Makes run_machine return at the end of the current batch, as if it
+// had hit the step limit (so output gets flushed, statistics printed
+// and so on).
+void stop_machine(Machine * m) {
+    __atomic_store_n(&m->stopRequested, 1, __ATOMIC_RELAXED);
+}
+
+// Writes out the call-graph profile, if the machine is taking one.
+void saveProfile_machine(Machine * m) {
+    lockMachine(m);
+
+    if (m->callgraph) {
+        saveProfile(m);
+    }
+
+    unlockMachine(m);
+}
+
+// Asks every running machine for a summary at the end of its current
+// batch. Only does an atomic add, so it's safe from a signal handler.
+void requestStats_machine(void) {
+    __atomic_fetch_add(&statsRequests, 1, __ATOMIC_RELAXED);
+}
+
+typedef struct {
+    const MachineConfig * configs;
+    unsigned count;
+    unsigned next;   // next config to run, claimed atomically
+    unsigned failed;
+} MachinePool;
+
+static void * poolWorker(void * p) {
+    MachinePool * pool = p;
+
+    while (1) {
+        unsigned idx = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        Machine * m;
+        int status;
+
+        if (idx >= pool->count) {
+            break;
+        }
+
+        if ((m = new_machine(&pool->configs[idx])) == NULL) {
+            __atomic_fetch_add(&pool->failed, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        status = run_machine(m);
+        printf("%s: %s after %" PRIu64 " steps\n", machineName(m),
+            status ? "step limit reached" : "powered off", m->steps);
+
+        if (status) {
+            __atomic_fetch_add(&pool->failed, 1, __ATOMIC_RELAXED);
+        }
+
+        free_machine(m);
+    }
+
+    return NULL;
+}
+
+// Runs every config to completion on up to threads host threads.
+// Returns the number of machines that failed to start or power off.
+int runPool_machine(const MachineConfig * configs, unsigned count, unsigned threads) {
+    MachinePool pool = { configs, count, 0, 0 };
+    pthread_t * workers;
+    unsigned i, started;
+
+    if (threads > count) {
+        threads = count;
+    }
+
+    if ((workers = calloc(threads, sizeof(*workers))) == NULL) {
+        puts("allocating workers failed.");
+        return count;
+    }
+
+    for (started = 0; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, poolWorker, &pool)) {
+            puts("creating emulator thread failed!");
+            break;
+        }
+    }
+
+    if (started == 0) {
+        free(workers);
+        return count;
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    return pool.failed;
+}
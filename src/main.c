@@ -1,14 +1,14 @@
-#include "bus/controller.h"
-#include "vr4300/cpu.h"
+#include "machine.h"
 #include "mips.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <pthread.h>
+#include <signal.h>
+#include <string.h>
 #include <termios.h>
 #include <unistd.h>
 
-pthread_mutex_t emu_mutex;
-
 int ttyraw()
 {
 	int fd = STDIN_FILENO;
@@ -104,194 +104,296 @@ static void printstate(Mips * emu,uint64_t n) {
     
 }
 
-void * runCen64(void * p) {
-  struct bus_controller *bus = (struct bus_controller *) p;
-  struct vr4300 vr4300;
+static void usage(const char * argv0) {
+    printf("Usage: %s [options] [image.srec...] <emutype>\n",argv0);
+    printf("<emutype> can either be cmips or cen64\n");
+    printf("  -l snapshot         resume from a snapshot (image.srec is optional)\n");
+    printf("  -M ram.img          start with RAM holding this file (image.srec is\n");
+    printf("                      optional, and loaded on top of it)\n");
+    printf("  -r size             guest RAM size, with an optional K or M suffix\n");
+    printf("                      (default 64M, at most 320M)\n");
+    printf("  -L                  back guest RAM with huge pages (hugetlbfs if\n");
+    printf("                      reserved, else transparent) for fewer host TLB\n");
+    printf("                      misses\n");
+    printf("  -d disk.img         attach a block device backed by this file\n");
+    printf("  -u policy           UART output: immediate (a write per byte), line\n");
+    printf("                      (default; a write per line or 10ms) or thread\n");
+    printf("                      (handed in bulk to a writer thread)\n");
+    printf("  -s steps:snapshot   write a snapshot after this many steps\n");
+    printf("  -n steps            stop after this many steps\n");
+    printf("  -H                  count host events (cycles, instructions, misses...)\n");
+    printf("                      per guest instruction, falling back to software\n");
+    printf("                      events without a PMU\n");
+    printf("  -i steps            print cen64 statistics at this interval\n");
+    printf("  -S period           sample cen64 statistics every ~period pcycles,\n");
+    printf("                      or with a us/ms suffix, that often in host time\n");
+    printf("                      (statistics are printed on exit and on SIGUSR1)\n");
+    printf("  -p profile.folded   write a call-graph profile of the guest, as folded\n");
+    printf("                      stacks for flame graph tools (image.srec.folded\n");
+    printf("                      per image with -j)\n");
+    printf("  -y symbols          name profiled functions from a System.map or ELF\n");
+    printf("  -C                  weight the profile by cen64 pcycles, not instructions\n");
+    printf("  -j threads          run the images in parallel, with UART output\n");
+    printf("                      going to image.srec.out (default: all cores)\n");
+    printf("Live counters are published in /dev/shm/emu-<pid>; see emutop.\n");
+}
 
-  vr4300_init(&vr4300, bus);
-  vr4300.pipeline.icrf_latch.pc = 0xFFFFFFFF801E4B10ULL;
+static StatsPage * statsPage;
+static char statsPagePath[64];
 
-  // Prime the pipeline...
-  while (vr4300.pipeline.dcwb_latch.common.pc != 0xFFFFFFFF801E4B10ULL ||
-        (vr4300.pipeline.dcwb_latch.common.fault ||
-        vr4300.pipeline.dcwb_latch.common.killed))
-    vr4300_cycle(&vr4300);
+static void freeStatsPage(void) {
+    free_statspage(statsPage, statsPagePath);
+}
 
-  //printf("cmips starts at 0x%.8X... PRIMED!!\n",bus->emu->pc);
-  unsigned steps_compld = 0;
+// Publishes live counters for numSlots machines in /dev/shm/emu-<pid>.
+// Machines run fine without it, so failing is only worth a warning.
+static void openStatsPage(unsigned numSlots) {
+    snprintf(statsPagePath, sizeof(statsPagePath), "/dev/shm/emu-%d", (int)getpid());
 
-  uint8_t *mem_at_wb = malloc(64 * 1024 * 1024);
-  uint8_t *mem_at_commit = malloc(64 * 1024 * 1024);
+    if ((statsPage = new_statspage(statsPagePath, numSlots)) == NULL) {
+        fprintf(stderr, "failed to create stats page %s\n", statsPagePath);
+        return;
+    }
 
-  if (mem_at_wb == NULL || mem_at_commit == NULL) {
-    printf("MOAR mammaries required!!\n");
-    abort();
-  }
+    atexit(freeStatsPage);
+}
 
-  memcpy(mem_at_wb, bus->emu->mem, 64 * 1024 * 1024);
-  memcpy(mem_at_commit, bus->emu->mem, 64 * 1024 *1024);
+static void onSigusr1(int sig) {
+    (void)sig;
+    requestStats_machine();
+}
 
-  while (1) {
-        int i;
+// Runs a single machine wired up to the terminal.
+static void * runInteractive(void * p) {
+    Machine * m = (Machine *)p;
+    int status = run_machine(m);
 
-        if(pthread_mutex_lock(&emu_mutex)) {
-            puts("mutex failed lock, exiting");
-            exit(1);
-        }
+    free_machine(m);
+    exit(status);
+}
 
-        for (i = 0; i < 10000; i++) {
-#if 0
-          //printf(".");
-          //fflush(stdout);
-
-          // printf("step_mips, pc: 0x%.8X\n", bus->emu->pc);
-          uint32_t cmp_pc = bus->emu->pc;
-          step_mips(bus->emu);
-
-          do {
-            vr4300_cycle(&vr4300);
-          } while(vr4300.pipeline.last_pipe_result.fault ||
-                  vr4300.pipeline.last_pipe_result.killed);
-
-          vr4300.pipeline.last_pipe_result.fault = ~0;
-
-          if (cmp_pc != (uint32_t) vr4300.pipeline.last_pipe_result.pc) {
-            printf("PC mismatch detected @ %u steps!\n", steps_compld);
-            printf("cmips: 0x%.8X, cen64: 0x%.8X\n",
-              bus->emu->pc, vr4300.pipeline.last_pipe_result.pc);
-            abort();
-          }
-
-          size_t ri;
-          for (ri = 1; ri < 32; ri++) {
-            if ((uint32_t) vr4300.regs[ri] != bus->emu->regs[ri]) {
-              printf("GPR[%u] mismatch detected @ 0x%.8X/%u steps!\n", ri, cmp_pc, steps_compld);
-              printf("cmips: 0x%.8X, cen64: 0x%.8X\n", bus->emu->regs[ri], vr4300.regs[ri]);
-              abort();
-            }
-          }
+// Runs a batch of images, one machine each, across host threads.
+static int runBatch(const MachineConfig * base, char ** images,
+  unsigned count, unsigned threads) {
+    MachineConfig * configs = calloc(count, sizeof(*configs));
+    unsigned i;
+    int failed;
 
-#if 0
-          else {
-            printf("cmips: 0x%.8X, cen64: 0x%.8X\n",
-              bus->emu->pc, vr4300.pipeline.last_pipe_result.pc);
-          }
-#endif
+    if (!configs) {
+        puts("allocating configs failed.");
+        return 1;
+    }
 
-// this is too slow
-#if 1
-        if (steps_compld > 242180) {
-          //memcpy(mem_at_commit, bus->mem, 64 * 1024 * 1024);
-          if (steps_compld > 242182 && memcmp(mem_at_commit, bus->emu->mem, 64 * 1024 * 1024)) {
-            size_t k;
-            bool false_alarm;
-            for (k = 0; k < 64 * 1024 * 1024 / 4; k++) {
-              uint32_t cm, cm1, cm2;
-              memcpy(&cm, mem_at_commit + k * 4, sizeof(cm));
-              memcpy(&cm1, mem_at_wb + k * 4, sizeof(cm1));
-              memcpy(&cm2, bus->mem + k * 4, sizeof(cm2));
-              if (cm != bus->emu->mem[k] && cm1 != bus->emu->mem[k] && cm2 != bus->emu->mem[k]) {
-                printf("Memory mismatch detected @ %u steps!\n", steps_compld);
-                printf("   -> @addr=0x%.8X ... cmips=0x%.8X, cen64=0x%.8X\n",
-                  (unsigned) (k * 4), bus->emu->mem[k], cm);
-                false_alarm = false;
-                break;
-              } else {
-                false_alarm = true;
-                break;
-              }
-            }
-            if (!false_alarm)
-            abort();
-          }
-
-          memcpy(mem_at_commit, mem_at_wb, 64 * 1024 * 1024);
-          memcpy(mem_at_wb, bus->mem, 64 * 1024 * 1024);
-        }
-#endif
-        steps_compld++;
-#else
-            vr4300_cycle(&vr4300);
-#endif
-        }
+    for (i = 0; i < count; i++) {
+        char * uartPath = malloc(strlen(images[i]) + sizeof(".out"));
+        char * profilePath = NULL;
 
-        if(pthread_mutex_unlock(&emu_mutex)) {
-            puts("mutex failed unlock, exiting");
-            exit(1);
+        if (base->profilePath &&
+            (profilePath = malloc(strlen(images[i]) + sizeof(".folded")))) {
+            sprintf(profilePath, "%s.folded", images[i]);
         }
-  }
-
-  return NULL;
-}
 
-void * runEmulator(void * p) {
-    Mips * emu = (Mips *)p;
-
-    while(emu->shutdown != 1) {
-        int i;
-        
-        if(pthread_mutex_lock(&emu_mutex)) {
-            puts("mutex failed lock, exiting");
-            exit(1);
+        if (!uartPath || (base->profilePath && !profilePath)) {
+            puts("allocating configs failed.");
+            return 1;
         }
 
-        for(i = 0; i < 1000 ; i++)
-            step_mips(emu);
-        
-        if(pthread_mutex_unlock(&emu_mutex)) {
-            puts("mutex failed unlock, exiting");
-            exit(1);
-        }
-        
+        sprintf(uartPath, "%s.out", images[i]);
+        configs[i] = *base;
+        configs[i].image = images[i];
+        configs[i].uartPath = uartPath;
+        configs[i].profilePath = profilePath;
+        configs[i].statsSlot = statsPage ? &statsPage->slots[i] : NULL;
     }
-    free_mips(emu);
-    exit(0);
-    
-}
 
+    failed = runPool_machine(configs, count, threads);
+    printf("%u of %u machines powered off\n", count - failed, count);
 
+    for (i = 0; i < count; i++) {
+        free((char *)configs[i].uartPath);
+        free((char *)configs[i].profilePath);
+    }
 
+    free(configs);
+    return failed != 0;
+}
 
 int main(int argc,char * argv[]) {
-    struct bus_controller bus;
-    Mips * emu;
+    MachineConfig config = { MACHINE_CMIPS };
+    unsigned threads = 0;
+    unsigned nimages;
+    char * emutype;
+    Machine * m;
+    int opt;
 
     pthread_t emu_thread;
+    struct sigaction sa;
+
+    config.uartTx = UART_TX_LINE;
     
-    if(pthread_mutex_init(&emu_mutex,NULL)) {
-        puts("failed to create mutex");
-        return 1;
+    while ((opt = getopt(argc, argv, "CHd:i:j:Ll:M:n:p:r:s:S:u:y:")) != -1) {
+        uint64_t period;
+        uint64_t size;
+        char * sep;
+
+        switch (opt) {
+            case 'C':
+                config.profileCycles = 1;
+                break;
+            case 'H':
+                config.hostCounters = 1;
+                break;
+            case 'd':
+                config.diskPath = optarg;
+                break;
+            case 'i':
+                config.statsInterval = strtoull(optarg, &sep, 0);
+                if (*sep) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'j':
+                threads = strtoul(optarg, &sep, 0);
+                if (*sep || threads == 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'l':
+                config.loadPath = optarg;
+                break;
+            case 'L':
+                config.hugePages = 1;
+                break;
+            case 'M':
+                config.ramPath = optarg;
+                break;
+            case 'n':
+                config.maxSteps = strtoull(optarg, &sep, 0);
+                if (*sep) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'p':
+                config.profilePath = optarg;
+                break;
+            case 'r':
+                size = strtoull(optarg, &sep, 0);
+                if (!strcmp(sep, "K")) {
+                    size <<= 10;
+                } else if (!strcmp(sep, "M")) {
+                    size <<= 20;
+                } else if (*sep) {
+                    size = 0;
+                }
+                // Whole 4KiB pages, which is how RAM gets mapped.
+                if (size == 0 || size > MEMORY_MAX_LEN || size % 4096) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                config.memSize = size;
+                break;
+            case 'S':
+                period = strtoull(optarg, &sep, 0);
+                if (period == 0) {
+                    usage(argv[0]);
+                    return 1;
+                } else if (!strcmp(sep, "us")) {
+                    config.statsSampleNs = period * 1000;
+                } else if (!strcmp(sep, "ms")) {
+                    config.statsSampleNs = period * 1000000;
+                } else if (*sep == '\0') {
+                    config.statsSample = period;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 's':
+                config.saveAt = strtoull(optarg, &sep, 0);
+                if (*sep != ':' || !sep[1]) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                config.savePath = sep + 1;
+                break;
+            case 'u':
+                if (!strcmp(optarg, "immediate")) {
+                    config.uartTx = UART_TX_IMMEDIATE;
+                } else if (!strcmp(optarg, "line")) {
+                    config.uartTx = UART_TX_LINE;
+                } else if (!strcmp(optarg, "thread")) {
+                    config.uartTx = UART_TX_THREAD;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'y':
+                config.symbolsPath = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
     }
-    
-    if (argc < 3 || (strcmp(argv[2], "cmips") && strcmp(argv[2], "cen64"))) {
-        printf("Usage: %s image.srec <emutype>\n",argv[0]);
-        printf("<emutype> can either be cmips or cen64\n");
+
+    if (argc - optind < 1) {
+        usage(argv[0]);
         return 1;
     }
- 
-    emu = new_mips(64 * 1024 * 1024);
-    
-    if (!emu) {
-        puts("allocating emu failed.");
+
+    emutype = argv[argc - 1];
+    nimages = argc - optind - 1;
+
+    if (!strcmp(emutype, "cmips")) {
+        config.type = MACHINE_CMIPS;
+    } else if (!strcmp(emutype, "cen64")) {
+        config.type = MACHINE_CEN64;
+    } else {
+        usage(argv[0]);
         return 1;
     }
-    
-    if (loadSrecFromFile_mips(emu,argv[1]) != 0) {
-        puts("failed loading srec");
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSigusr1;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    if (nimages > 1 || threads) {
+        // Snapshots name a single machine's state.
+        if (nimages == 0 || config.loadPath || config.savePath) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        if (threads == 0) {
+            threads = sysconf(_SC_NPROCESSORS_ONLN);
+        }
+
+        openStatsPage(nimages);
+        return runBatch(&config, argv + optind, nimages, threads);
+    }
+
+    if (nimages == 0 && !config.loadPath && !config.ramPath) {
+        usage(argv[0]);
         return 1;
     }
 
-  if (!strcmp(argv[2], "cen64")) {   
-    uint8_t *mem = malloc(64 * 1024 * 1024);
+    config.image = nimages ? argv[optind] : NULL;
 
-    if (mem == NULL) {
-      puts("allocated mem failed.");
-      return 1;
+    if (config.type == MACHINE_CEN64) {
+        config.logPath = "out.log";
     }
 
-    bus_init(&bus, mem, 64 * 1024 * 1024, emu);
-    memcpy(mem, emu->mem, emu->pmemsz);
-  }
+    openStatsPage(1);
+    config.statsSlot = statsPage ? &statsPage->slots[0] : NULL;
+
+    if ((m = new_machine(&config)) == NULL) {
+        return 1;
+    }
     
 #if 0
 	if(ttyraw()) {
@@ -300,33 +402,21 @@ int main(int argc,char * argv[]) {
 	}
 #endif
 
-  if (!strcmp(argv[2], "cmips")) {
-    if(pthread_create(&emu_thread,NULL,runEmulator,emu)) {
-        puts("creating emulator thread failed!");
-        return 1;
-    }
-  } else {
-    if (pthread_create(&emu_thread,NULL,runCen64,&bus)) {
+    if(pthread_create(&emu_thread,NULL,runInteractive,m)) {
         puts("creating emulator thread failed!");
         return 1;
     }
-  }
 	
     while(1) {
         int c = getchar();
         if(c == EOF) {
-            exit(1);
+            // The emulator thread exits once the machine has stopped.
+            stop_machine(m);
+            pthread_join(emu_thread, NULL);
+            return 1;
         }
         
-        if(pthread_mutex_lock(&emu_mutex)) {
-            puts("mutex failed lock, exiting");
-            exit(1);
-        }
-        uart_RecieveChar(emu,c);
-        if(pthread_mutex_unlock(&emu_mutex)) {
-            puts("mutex failed unlock, exiting");
-            exit(1);
-        }
+        receiveChar_machine(m,c);
     }
     
     
@@ -0,0 +1,154 @@
+#include "mips.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Output that gets written out on a thread of its own, so devices can
+// hand over whole buffers without waiting on the host (or making a
+// syscall per byte). Writers only block when the buffer is full.
+
+#define OUTBUF_SIZE (1024 * 1024)
+
+struct OutBuf {
+    FILE * out;
+    uint8_t * buf;
+    size_t head;    // bytes ever queued
+    size_t tail;    // bytes ever written out
+    int writing;
+    int quit;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static void * writerThread(void * p) {
+    struct OutBuf * o = (struct OutBuf *)p;
+
+    pthread_mutex_lock(&o->mutex);
+
+    for (;;) {
+        size_t start, len;
+
+        if (o->head == o->tail) {
+            if (o->quit) {
+                break;
+            }
+
+            pthread_cond_wait(&o->cond, &o->mutex);
+            continue;
+        }
+
+        // Everything queued, up to the end of the buffer.
+        start = o->tail % OUTBUF_SIZE;
+        len = o->head - o->tail;
+
+        if (len > OUTBUF_SIZE - start) {
+            len = OUTBUF_SIZE - start;
+        }
+
+        o->writing = 1;
+        pthread_mutex_unlock(&o->mutex);
+
+        fwrite(o->buf + start, 1, len, o->out);
+        fflush(o->out);
+
+        pthread_mutex_lock(&o->mutex);
+        o->tail += len;
+        o->writing = 0;
+        pthread_cond_broadcast(&o->cond);
+    }
+
+    pthread_mutex_unlock(&o->mutex);
+    return NULL;
+}
+
+struct OutBuf * new_outbuf(FILE * out) {
+    struct OutBuf * o = calloc(1, sizeof(*o));
+
+    if (!o) {
+        return NULL;
+    }
+
+    o->out = out;
+
+    if ((o->buf = malloc(OUTBUF_SIZE)) == NULL) {
+        free(o);
+        return NULL;
+    }
+
+    pthread_mutex_init(&o->mutex, NULL);
+    pthread_cond_init(&o->cond, NULL);
+
+    if (pthread_create(&o->thread, NULL, writerThread, o)) {
+        pthread_cond_destroy(&o->cond);
+        pthread_mutex_destroy(&o->mutex);
+        free(o->buf);
+        free(o);
+        return NULL;
+    }
+
+    return o;
+}
+
+void outbuf_write(struct OutBuf * o, const uint8_t * data, size_t len) {
+    pthread_mutex_lock(&o->mutex);
+
+    while (len) {
+        size_t start = o->head % OUTBUF_SIZE;
+        size_t room = OUTBUF_SIZE - (o->head - o->tail);
+        size_t n = len;
+
+        if (!room) {
+            pthread_cond_wait(&o->cond, &o->mutex);
+            continue;
+        }
+
+        if (n > room) {
+            n = room;
+        }
+
+        if (n > OUTBUF_SIZE - start) {
+            n = OUTBUF_SIZE - start;
+        }
+
+        memcpy(o->buf + start, data, n);
+        o->head += n;
+        data += n;
+        len -= n;
+        pthread_cond_broadcast(&o->cond);
+    }
+
+    pthread_mutex_unlock(&o->mutex);
+}
+
+// Waits until everything queued so far has been written out.
+void outbuf_flush(struct OutBuf * o) {
+    pthread_mutex_lock(&o->mutex);
+
+    while (o->head != o->tail || o->writing) {
+        pthread_cond_wait(&o->cond, &o->mutex);
+    }
+
+    pthread_mutex_unlock(&o->mutex);
+}
+
+// Writes out whatever is left and stops the writer.
+void free_outbuf(struct OutBuf * o) {
+    if (!o) {
+        return;
+    }
+
+    pthread_mutex_lock(&o->mutex);
+    o->quit = 1;
+    pthread_cond_broadcast(&o->cond);
+    pthread_mutex_unlock(&o->mutex);
+    pthread_join(o->thread, NULL);
+
+    pthread_cond_destroy(&o->cond);
+    pthread_mutex_destroy(&o->mutex);
+    free(o->buf);
+    free(o);
+}
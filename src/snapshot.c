@@ -0,0 +1,66 @@
+#include "mips.h"
+#include "common/snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// The whole Mips struct goes into one section (devices included), with
+// host pointers cleared; guest RAM gets a section of its own. The
+// block device has to be drained first.
+int saveSnapshot_mips(Mips * emu, struct snapshot_writer * writer) {
+    Mips state = *emu;
+
+    state.mem = NULL;
+    state.uartOut = NULL;
+    state.callgraph = NULL;
+    state.blkHost = NULL;
+    state.uartTx = NULL;
+    state.out = NULL;
+
+    if (snapshot_write_section(writer, SNAPSHOT_SECTION_MIPS,
+        &state, sizeof(state))) {
+        return 1;
+    }
+
+    return snapshot_write_section(writer, SNAPSHOT_SECTION_RAM,
+        emu->mem, emu->pmemsz);
+}
+
+int loadSnapshot_mips(Mips * emu, const struct snapshot * snapshot) {
+    const Mips * state;
+    const void * mem;
+    size_t length;
+
+    state = snapshot_get_section(snapshot, SNAPSHOT_SECTION_MIPS, &length);
+
+    if (!state || length != sizeof(*state)) {
+        puts("snapshot has no cmips state");
+        return 1;
+    }
+
+    mem = snapshot_get_section(snapshot, SNAPSHOT_SECTION_RAM, &length);
+
+    if (!mem || length != emu->pmemsz || state->pmemsz != emu->pmemsz) {
+        puts("snapshot RAM size does not match");
+        return 1;
+    }
+
+    uint32_t * emumem = emu->mem;
+    FILE * uartOut = emu->uartOut;
+    struct callgraph * callgraph = emu->callgraph;
+    struct BlkdevHost * blkHost = emu->blkHost;
+    struct UartTx * uartTx = emu->uartTx;
+    struct OutBuf * out = emu->out;
+    *emu = *state;
+    emu->mem = emumem;
+    emu->uartOut = uartOut;
+    emu->callgraph = callgraph;
+    emu->blkHost = blkHost;
+    emu->uartTx = uartTx;
+    emu->out = out;
+
+    memcpy(emu->mem, mem, emu->pmemsz);
+    return 0;
+}
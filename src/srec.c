@@ -1,66 +1,339 @@
 #include "mips.h"
 
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+static void writeb(Mips * emu,uint32_t addr,uint8_t v);
+static void srecStoreByte(uint32_t * mem, uint32_t paddr, uint8_t v);
 
-static int fnextChar(void * ud) {
-    int c = fgetc((FILE*)ud);
-    if(c == EOF) {
-        return -1;
+
+// Files are loaded by a table driven parser working straight out of a
+// mapping of the file, rather than through SrecLoader a character at a
+// time. Big files get split into chunks of whole lines, loaded side by
+// side on threads of their own. Records only ever overlap by accident,
+// but if two in different chunks might, the chunks are loaded again one
+// after another so that the last record wins, as it always has.
+
+#define SREC_MIN_CHUNK (4 * 1024 * 1024)
+#define SREC_MAX_THREADS 8
+
+// The value of each hex digit, -1 for anything else.
+static const int8_t srecHex[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+typedef struct {
+    Mips * emu;
+    const char * start; // whole lines, from here
+    const char * end;   // up to here
+    uint32_t entry;     // from the last S7 record, if haveEntry
+    int haveEntry;
+    const char * error;
+    uint64_t lo, hi;    // physical range stored to, if hi
+    pthread_t thread;
+    int threaded;
+} SrecChunk;
+
+// Stores a record's data. Whole words in the middle are stored as they
+// are; the bytes at either end may share a word with another record.
+static void srecStore(Mips * emu, uint32_t addr, const uint8_t * data, uint32_t len) {
+    uint32_t base = addr & 0xe0000000;
+    uint32_t paddr = addr - base;
+
+    if ((base != 0x80000000 && base != 0xa0000000) || paddr + len > 0x20000000 ||
+        paddr > emu->pmemsz || len > emu->pmemsz - paddr) {
+        while (len--) {
+            writeb(emu, addr++, *data++);
+        }
+        return;
+    }
+
+    for (; len && (paddr & 3); len--) {
+        srecStoreByte(emu->mem, paddr++, *data++);
+    }
+
+    for (; len >= 4; len -= 4, paddr += 4, data += 4) {
+        emu->mem[paddr / 4] = (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+            (uint32_t)data[2] << 8 | data[3];
+    }
+
+    while (len--) {
+        srecStoreByte(emu->mem, paddr++, *data++);
     }
-    return c;
 }
 
-static int fisEof(void * ud) {
-    return feof((FILE*)ud);
+// Widens the range of physical addresses a chunk has stored to. The
+// rare record that runs off the end of kseg0 or kseg1 counts as all of
+// it.
+static void srecTrack(SrecChunk * chunk, uint32_t addr, uint32_t len) {
+    uint32_t base = addr & 0xe0000000;
+    uint64_t lo, hi;
+
+    if (len == 0 || (base != 0x80000000 && base != 0xa0000000)) {
+        return;
+    }
+
+    lo = addr - base;
+    hi = lo + len;
+
+    if (hi > 0x20000000) {
+        lo = 0;
+        hi = 0x20000000;
+    }
+
+    if (chunk->hi == 0 || lo < chunk->lo) {
+        chunk->lo = lo;
+    }
+
+    if (hi > chunk->hi) {
+        chunk->hi = hi;
+    }
 }
 
+// Loads one line: S0 records are skipped, S3 ones stored and S7 ones
+// give the entry point. Returns an error message, or NULL.
+static const char * srecParseLine(SrecChunk * chunk, const char * line, size_t len) {
+    uint8_t bytes[256];
+    unsigned count, sum, i;
+    uint32_t addr;
 
-int loadSrecFromFile_mips(Mips * emu,char * fname) {
-    
-    void * ud = fopen(fname,"r");
-    
-    if(!ud) {
-        fprintf(stdout,"srec %s failed to open",fname);
-        return 1;
+    if (len && line[len - 1] == '\r') {
+        len--;
     }
-    
-    SrecLoader loader;
-    loader.nextChar = &fnextChar;
-    loader.isEof = &fisEof;
-    loader.userdata = ud;
-    int ret = loadSrec_mips(emu,&loader);
-    fclose((FILE*)ud);
-    return ret;
+
+    if (len == 0) {
+        return NULL;
+    }
+
+    if (len < 2 || line[0] != 'S' ||
+        (line[1] != '0' && line[1] != '3' && line[1] != '7')) {
+        return "Bad/Unsupported srec type\n";
+    }
+
+    if (line[1] == '0') {
+        return NULL;
+    }
+
+    // The count byte, then that many more: address, data and checksum.
+    if (len < 4 || (srecHex[(uint8_t)line[2]] | srecHex[(uint8_t)line[3]]) < 0) {
+        return "srecLoader: failed to parse bytecount.\n";
+    }
+
+    count = srecHex[(uint8_t)line[2]] << 4 | srecHex[(uint8_t)line[3]];
+    sum = count;
+
+    if (count < 5 || len < 4 + 2 * (size_t)count) {
+        return "srecLoader: record too short.\n";
+    }
+
+    for (i = 0; i < count; i++) {
+        int hi = srecHex[(uint8_t)line[4 + 2 * i]];
+        int lo = srecHex[(uint8_t)line[5 + 2 * i]];
+
+        if ((hi | lo) < 0) {
+            return "srecLoader: failed to load data.\n";
+        }
+
+        bytes[i] = hi << 4 | lo;
+        sum += bytes[i];
+    }
+
+    if ((sum & 0xff) != 0xff) {
+        return "srecLoader: bad checksum.\n";
+    }
+
+    addr = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 |
+        (uint32_t)bytes[2] << 8 | bytes[3];
+
+    if (line[1] == '7') {
+        chunk->entry = addr;
+        chunk->haveEntry = 1;
+    } else {
+        srecTrack(chunk, addr, count - 5);
+        srecStore(chunk->emu, addr, bytes + 4, count - 5);
+    }
+
+    return NULL;
 }
 
+static void * srecParseChunk(void * p) {
+    SrecChunk * chunk = (SrecChunk *)p;
+    const char * line = chunk->start;
 
-static int snextChar(void * ud) {
-    int c = **(char**)ud;
-    (*(char**)ud)++;
-    if(c == 0) {
-        return -1;
+    while (line < chunk->end && !chunk->error) {
+        const char * eol = memchr(line, '\n', chunk->end - line);
+
+        if (!eol) {
+            eol = chunk->end;
+        }
+
+        chunk->error = srecParseLine(chunk, line, eol - line);
+        line = eol + 1;
     }
-    return c;
+
+    return NULL;
 }
 
-static int sisEof(void * ud) {
-    return (**(char**)ud) == 0;
+// Returns the start of the line after the one pos is on.
+static const char * srecNextLine(const char * pos, const char * end) {
+    const char * eol = memchr(pos, '\n', end - pos);
+    return eol ? eol + 1 : end;
 }
 
-int loadSrecFromString_mips(Mips * emu,char * srec) {
-    
-    void * ud = (void*)&srec;
-    
-    SrecLoader loader;
-    loader.nextChar = &snextChar;
-    loader.isEof = &sisEof;
-    loader.userdata = ud;
-    int ret = loadSrec_mips(emu,&loader);
+// Whether two chunks have stored to any of the same addresses.
+static int srecChunksOverlap(const SrecChunk * chunks, size_t n) {
+    size_t i, j;
+
+    for (i = 0; i < n; i++) {
+        for (j = i + 1; j < n; j++) {
+            if (chunks[i].hi && chunks[j].hi &&
+                chunks[i].lo < chunks[j].hi && chunks[j].lo < chunks[i].hi) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int srecParse(Mips * emu, const char * text, size_t size) {
+    SrecChunk chunks[SREC_MAX_THREADS];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n = size / SREC_MIN_CHUNK;
+    const char * end = text + size;
+    const char * start = text;
+    size_t i;
+
+    if (n > (size_t)cpus) {
+        n = cpus;
+    }
+
+    if (n > SREC_MAX_THREADS) {
+        n = SREC_MAX_THREADS;
+    }
+
+    if (n == 0) {
+        n = 1;
+    }
+
+    memset(chunks, 0, sizeof(chunks));
+
+    for (i = 0; i < n; i++) {
+        chunks[i].emu = emu;
+        chunks[i].start = start;
+        chunks[i].end = i == n - 1 ? end : srecNextLine(text + size * (i + 1) / n, end);
+
+        if (chunks[i].end < start) {
+            chunks[i].end = start;
+        }
+
+        start = chunks[i].end;
+    }
+
+    // The first chunk gets loaded on this thread, as does any chunk a
+    // thread couldn't be started for.
+    for (i = 1; i < n; i++) {
+        chunks[i].threaded =
+            !pthread_create(&chunks[i].thread, NULL, srecParseChunk, &chunks[i]);
+    }
+
+    srecParseChunk(&chunks[0]);
+
+    for (i = 1; i < n; i++) {
+        if (chunks[i].threaded) {
+            pthread_join(chunks[i].thread, NULL);
+        } else {
+            srecParseChunk(&chunks[i]);
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (chunks[i].error) {
+            fputs(chunks[i].error, stdout);
+            return 1;
+        }
+    }
+
+    // Storing every chunk again in file order leaves each byte as the
+    // last record for it had it.
+    if (n > 1 && srecChunksOverlap(chunks, n)) {
+        for (i = 0; i < n; i++) {
+            srecParseChunk(&chunks[i]);
+        }
+    }
+
+    for (i = n; i > 0; i--) {
+        if (chunks[i - 1].haveEntry) {
+            emu->pc = chunks[i - 1].entry;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+int loadSrecFromFile_mips(Mips * emu,char * fname) {
+    struct stat sb;
+    void * text;
+    int fd, ret;
+
+    if ((fd = open(fname, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &sb)) {
+        fprintf(stdout,"srec %s failed to open\n",fname);
+
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        return 1;
+    }
+
+    if (sb.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    text = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (text == MAP_FAILED) {
+        fprintf(stdout,"srec %s failed to map\n",fname);
+        return 1;
+    }
+
+    madvise(text, sb.st_size, MADV_SEQUENTIAL);
+    ret = srecParse(emu, text, sb.st_size);
+    munmap(text, sb.st_size);
     return ret;
 }
 
+int loadSrecFromString_mips(Mips * emu,char * srec) {
+    return srecParse(emu, srec, strlen(srec));
+}
+
+
+// The loader below reads through SrecLoader callbacks, a character at
+// a time, and doesn't check checksums.
 
 //a minimized version of address translation which checks fixed map ranges
 static void writeb(Mips * emu,uint32_t addr,uint8_t v) {
@@ -74,16 +347,23 @@ static void writeb(Mips * emu,uint32_t addr,uint8_t v) {
         return;
     }
     
-    if (addr > emu->pmemsz) {
+    if (addr >= emu->pmemsz) {
         return;
     }
     
-    uint32_t word = emu->mem[addr / 4];
-    unsigned int offset = addr % 4;
-    int shamt = 8*(3 - offset);
-    word = (word & ~(0xff << shamt)) | (v << shamt);
-    emu->mem[addr / 4] = word;
-    
+    srecStoreByte(emu->mem, addr, v);
+}
+
+// Other chunks may be storing the rest of the word at the same time.
+static void srecStoreByte(uint32_t * mem, uint32_t paddr, uint8_t v) {
+    uint32_t * word = &mem[paddr / 4];
+    int shamt = 8*(3 - (paddr % 4));
+    uint32_t mask = 0xffu << shamt;
+    uint32_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(word, &old, (old & ~mask) | ((uint32_t)v << shamt),
+        1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
 }
 
 static int isHexChar(char c){
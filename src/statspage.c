@@ -0,0 +1,55 @@
+#include "statspage.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static size_t statspageSize(unsigned numSlots) {
+    return sizeof(StatsPage) + numSlots * sizeof(StatsPageSlot);
+}
+
+// Creates the stats page file and maps it. Slots start out empty;
+// the magic is stored last so readers never see a half-made header.
+StatsPage * new_statspage(const char * path, unsigned numSlots) {
+    size_t size = statspageSize(numSlots);
+    StatsPage * page;
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        return NULL;
+    }
+
+    if (ftruncate(fd, size)) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    page = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (page == MAP_FAILED) {
+        unlink(path);
+        return NULL;
+    }
+
+    page->version = STATSPAGE_VERSION;
+    page->slotSize = sizeof(StatsPageSlot);
+    page->numSlots = numSlots;
+    page->pid = getpid();
+    __atomic_store_n(&page->magic, STATSPAGE_MAGIC, __ATOMIC_RELEASE);
+    return page;
+}
+
+void free_statspage(StatsPage * page, const char * path) {
+    munmap(page, statspageSize(page->numSlots));
+    unlink(path);
+}
+
+void claimSlot_statspage(StatsPageSlot * slot, const char * name, unsigned type) {
+    snprintf(slot->name, sizeof(slot->name), "%s", name ? name : "");
+    __atomic_store_n(&slot->type, type, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->state, STATSPAGE_RUNNING, __ATOMIC_RELEASE);
+}
@@ -1,6 +1,7 @@
 #include "mips.h"
 
 #include <stdio.h>
+#include <time.h>
 
 //XXX remove this when exit calls are removed...
 #include <stdlib.h>
@@ -8,6 +9,25 @@
 //XXX ThrowCTI NextInterrupt and ClearInterrupt recurse sometimes
 //seemingly pointlessly.
 
+/* host side of the transmitter */
+
+// Bytes the guest sends wait here unless the policy is immediate. With
+// the line policy they're written out a line at a time. With the thread
+// policy whole buffers are queued for the writer thread the console
+// uses, which keeps the emulation thread from waking it for every line.
+// Either way, bytes go out once they've waited UART_TX_TIMEOUT_NS, so
+// prompts and slow output still show up.
+
+#define UART_TX_SIZE 4096
+#define UART_TX_TIMEOUT_NS 10000000ULL
+
+struct UartTx {
+    UartTxPolicy policy;
+    uint8_t buf[UART_TX_SIZE];
+    size_t len;
+    uint64_t since; // host time the oldest waiting byte was sent
+};
+
 /* some forward declarations */
 
 static void uart_NextInterrupt(Mips * emu); 
@@ -36,6 +56,101 @@ void uart_writeb(Mips * emu,uint32_t offset,uint8_t v){
 }
 
 
+static uint64_t uart_ClockNs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static FILE * uart_File(Mips * emu) {
+    return emu->uartOut ? emu->uartOut : stdout;
+}
+
+int uart_open_tx(Mips * emu, UartTxPolicy policy) {
+    if (policy == UART_TX_IMMEDIATE) {
+        return 0;
+    }
+
+    if ((emu->uartTx = calloc(1, sizeof(*emu->uartTx))) == NULL) {
+        return 1;
+    }
+
+    emu->uartTx->policy = policy;
+    return 0;
+}
+
+void uart_close_tx(Mips * emu) {
+    uart_flush(emu);
+    free(emu->uartTx);
+    emu->uartTx = NULL;
+}
+
+// Sends whatever is waiting on to the host. Console output queued
+// earlier always goes out first.
+void uart_flush(Mips * emu) {
+    struct UartTx * tx = emu->uartTx;
+    FILE * out = uart_File(emu);
+
+    if (!tx || !tx->len) {
+        return;
+    }
+
+    if (tx->policy == UART_TX_THREAD && !emu->out) {
+        emu->out = new_outbuf(out);
+    }
+
+    if (tx->policy == UART_TX_THREAD && emu->out) {
+        outbuf_write(emu->out, tx->buf, tx->len);
+    } else {
+        if (emu->out) {
+            outbuf_flush(emu->out);
+        }
+
+        fwrite(tx->buf, 1, tx->len, out);
+        fflush(out);
+    }
+
+    tx->len = 0;
+}
+
+// Called between batches: lets a partial line out once it's waited long
+// enough.
+void uart_poll(Mips * emu) {
+    struct UartTx * tx = emu->uartTx;
+
+    if (tx && tx->len && uart_ClockNs() - tx->since >= UART_TX_TIMEOUT_NS) {
+        uart_flush(emu);
+    }
+}
+
+static void uart_Transmit(Mips * emu, uint8_t c) {
+    struct UartTx * tx = emu->uartTx;
+
+    if (!tx) {
+        FILE * out = uart_File(emu);
+
+        if (emu->out) {
+            outbuf_flush(emu->out);
+        }
+
+        fputc(c,out);
+        fflush(out);
+        return;
+    }
+
+    if (!tx->len) {
+        tx->since = uart_ClockNs();
+    }
+
+    tx->buf[tx->len++] = c;
+
+    if (tx->len == UART_TX_SIZE ||
+        (c == '\n' && tx->policy == UART_TX_LINE)) {
+        uart_flush(emu);
+    }
+}
+
 // code inspired by/ported from
 // https://raw.github.com/s-macke/jor1k/master/js/worker/uart.js
 // -------------------------------------------------
@@ -147,6 +262,7 @@ static void uart_UpdateIrq (Mips * emu){
 
 void uart_RecieveChar(Mips * emu, uint8_t c) {
     uart_fifoPush(emu,c);
+    emu->serial.rxEvents++;
     emu->serial.LSR |= UART_LSR_DATA_READY;
     uart_UpdateIrq(emu);
 };
@@ -198,6 +314,7 @@ static uint8_t uart_ReadReg8(Mips * emu ,uint32_t offset) {
     case UART_SCR:
         return emu->serial.SCR;
     default:
+        flushOutput_mips(emu);
         printf("Error in uart ReadRegister: not supported %u\n",offset);
         exit(1);
     }
@@ -224,9 +341,9 @@ static void uart_WriteReg8(Mips * emu,uint32_t offset, uint8_t x) {
         if (emu->serial.MCR & (1 << 4)) { //LOOPBACK 
             uart_RecieveChar(emu,x);
         } else {
-            putchar(x);
-            fflush(stdout);
+            uart_Transmit(emu,x);
         }
+        emu->serial.txBytes++;
         // Data is sent with a latency of zero!
         emu->serial.LSR |= UART_LSR_FIFO_EMPTY; // send buffer is empty					
         uart_UpdateIrq(emu);
@@ -9,6 +9,7 @@
 //
 
 #include "common.h"
+#include "common/callgraph.h"
 #include "tlb/tlb.h"
 #include "vr4300/cp0.h"
 #include "vr4300/cpu.h"
@@ -64,6 +65,7 @@ int VR4300_DMFC0(struct vr4300 *vr4300,
   if (src == (VR4300_CP0_REGISTER_COUNT - 32)) {
     exdc_latch->result = (uint32_t)
       (vr4300->regs[VR4300_CP0_REGISTER_COUNT] >> 1);
+    vr4300->idle.count_regs |= 1U << dest;
   }
 
   else
@@ -84,6 +86,7 @@ int VR4300_DMTC0(struct vr4300 *vr4300,
     vr4300->regs[VR4300_CP0_REGISTER_CAUSE] &= ~0x8000;
 
   vr4300->regs[dest] = rt;
+  vr4300->idle.impure = true;
   return 0;
 }
 
@@ -123,6 +126,10 @@ int VR4300_ERET(struct vr4300 *vr4300,
   pipeline->icrf_latch.segment = get_segment(icrf_latch->pc, status);
   pipeline->exdc_latch.segment = get_default_segment();
   // vr4300->llbit = 0;
+
+  if (unlikely(vr4300->callgraph))
+    callgraph_eret(vr4300->callgraph);
+
   return 1;
 }
 
@@ -149,6 +156,7 @@ int VR4300_MFC0(struct vr4300 *vr4300,
   else if (src == (VR4300_CP0_REGISTER_COUNT - 32)) {
     exdc_latch->result = (uint32_t)
       (vr4300->regs[VR4300_CP0_REGISTER_COUNT] >> 1);
+    vr4300->idle.count_regs |= 1U << dest;
   }
 
   else
@@ -176,6 +184,7 @@ int VR4300_MTC0(struct vr4300 *vr4300,
   }
 
   vr4300->regs[dest] = (int32_t) rt;
+  vr4300->idle.impure = true;
   return 0;
 }
 
@@ -249,7 +258,12 @@ int VR4300_TLBWR(struct vr4300 *vr4300,
   uint32_t page_mask = mask_reg(5, vr4300->regs[VR4300_CP0_REGISTER_PAGEMASK]);
   unsigned index = vr4300->regs[VR4300_CP0_REGISTER_WIRED] & 0x3F;
 
-  index = rand() % (32 - index) + index;
+  // Random counts down between 31 and Wired every cycle, so derive it
+  // from Count instead of host state (keeps instances independent).
+  index = index < 32
+    ? index + vr4300->regs[VR4300_CP0_REGISTER_COUNT] % (32 - index)
+    : 31;
+
   tlb_write(&vr4300->cp0.tlb, index, entry_hi, entry_lo_0, entry_lo_1, page_mask);
 
   vr4300->cp0.page_mask[index] = (page_mask | 0x1FFF) >> 1;
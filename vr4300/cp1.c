@@ -15,12 +15,54 @@
 #include "vr4300/decoder.h"
 #include "vr4300/fault.h"
 
+// Host rounding modes for each FCR31 RM setting: RN, RZ, RP, RM.
+static const fpu_state_t vr4300_cp1_round_modes[4] = {
+  FPU_ROUND_NEAREST, FPU_ROUND_TOZERO, FPU_ROUND_POSINF, FPU_ROUND_NEGINF
+};
+
+// Converts host FPU exception flags into FCR31 order.
+static inline uint32_t vr4300_cp1_host_flags(fpu_state_t state) {
+  return (state >> 5 & 0x01) | (state >> 3 & 0x02) |
+    (state >> 1 & 0x04) | (state << 1 & 0x08) | (state << 4 & 0x10);
+}
+
+// Picks up the exceptions the last FPU op raised, when some are
+// enabled. Raises FPE (without writing the result) if the op raised
+// an enabled one. This is the only per-op cost of exception support.
+static cen64_cold int vr4300_cp1_raise_fpe(struct vr4300 *vr4300) {
+  fpu_state_t state = fpu_get_state();
+  uint32_t raised = vr4300_cp1_host_flags(state);
+
+  vr4300->cp1.cause = raised;
+
+  if (!raised)
+    return 0;
+
+  fpu_set_state(state & ~FPU_FLAG_EXCPS);
+
+  // Trapped exceptions set the cause bits, but not the flags.
+  if (!(raised & vr4300->cp1.enables)) {
+    vr4300->cp1.flags |= raised;
+    return 0;
+  }
+
+  VR4300_FPE(vr4300);
+  return 1;
+}
+
+static inline int vr4300_cp1_check_fpe(struct vr4300 *vr4300) {
+  return unlikely(vr4300->cp1.enables) && vr4300_cp1_raise_fpe(vr4300);
+}
+
 //
 // Raises a MCI interlock for a set number of cycles.
 //
 static inline int vr4300_do_mci(struct vr4300 *vr4300, unsigned cycles) {
   vr4300->pipeline.cycles_to_stall = cycles - 1;
   vr4300->regs[PIPELINE_CYCLE_TYPE] = 3;
+
+  VR4300_STALL(vr4300, VR4300_STALL_MCI,
+    vr4300->pipeline.rfex_latch.common.pc, cycles);
   return 1;
 }
 
@@ -90,6 +132,9 @@ int VR4300_CP1_ADD(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300, 3);
@@ -147,6 +192,10 @@ int VR4300_BC1(struct vr4300 *vr4300,
   return 0;
 }
 
+// Each C.cond handler covers a quiet compare and its signalling twin
+// (iw bit 3 set), which raises invalid for any NaN operand rather than
+// only for a signalling one.
+
 //
 // C.eq.fmt
 // C.seq.fmt
@@ -168,12 +217,16 @@ int VR4300_CP1_C_EQ_C_SEQ(struct vr4300 *vr4300,
       ft32 = ft;
 
       result &= ~(1 << 23);
-      flag = fpu_cmp_eq_32(&fs32, &ft32);
+      flag = iw & 0x8
+        ? fpu_cmp_eq_32(&fs32, &ft32)
+        : fpu_qcmp_eq_32(&fs32, &ft32);
       break;
 
     case VR4300_FMT_D:
       result &= ~(1 << 23);
-      flag = fpu_cmp_eq_64(&fs, &ft);
+      flag = iw & 0x8
+        ? fpu_cmp_eq_64(&fs, &ft)
+        : fpu_qcmp_eq_64(&fs, &ft);
       break;
 
     default:
@@ -181,6 +234,9 @@ int VR4300_CP1_C_EQ_C_SEQ(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result | (flag << 23);
   exdc_latch->dest = dest;
   return 0;
@@ -207,12 +263,16 @@ int VR4300_CP1_C_F_C_SF(struct vr4300 *vr4300,
       ft32 = ft;
 
       result &= ~(1 << 23);
-      flag = fpu_cmp_f_32(&fs32, &ft32);
+      flag = iw & 0x8
+        ? fpu_cmp_f_32(&fs32, &ft32)
+        : fpu_qcmp_f_32(&fs32, &ft32);
       break;
 
     case VR4300_FMT_D:
       result &= ~(1 << 23);
-      flag = fpu_cmp_f_64(&fs, &ft);
+      flag = iw & 0x8
+        ? fpu_cmp_f_64(&fs, &ft)
+        : fpu_qcmp_f_64(&fs, &ft);
       break;
 
     default:
@@ -220,6 +280,9 @@ int VR4300_CP1_C_F_C_SF(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result | (flag << 23);
   exdc_latch->dest = dest;
   return 0;
@@ -246,12 +309,16 @@ int VR4300_CP1_C_OLE_C_LE(struct vr4300 *vr4300,
       ft32 = ft;
 
       result &= ~(1 << 23);
-      flag = fpu_cmp_ole_32(&fs32, &ft32);
+      flag = iw & 0x8
+        ? fpu_cmp_ole_32(&fs32, &ft32)
+        : fpu_qcmp_ole_32(&fs32, &ft32);
       break;
 
     case VR4300_FMT_D:
       result &= ~(1 << 23);
-      flag = fpu_cmp_ole_64(&fs, &ft);
+      flag = iw & 0x8
+        ? fpu_cmp_ole_64(&fs, &ft)
+        : fpu_qcmp_ole_64(&fs, &ft);
       break;
 
     default:
@@ -259,6 +326,9 @@ int VR4300_CP1_C_OLE_C_LE(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result | (flag << 23);
   exdc_latch->dest = dest;
   return 0;
@@ -285,12 +355,16 @@ int VR4300_CP1_C_OLT_C_LT(struct vr4300 *vr4300,
       ft32 = ft;
 
       result &= ~(1 << 23);
-      flag = fpu_cmp_olt_32(&fs32, &ft32);
+      flag = iw & 0x8
+        ? fpu_cmp_olt_32(&fs32, &ft32)
+        : fpu_qcmp_olt_32(&fs32, &ft32);
       break;
 
     case VR4300_FMT_D:
       result &= ~(1 << 23);
-      flag = fpu_cmp_olt_64(&fs, &ft);
+      flag = iw & 0x8
+        ? fpu_cmp_olt_64(&fs, &ft)
+        : fpu_qcmp_olt_64(&fs, &ft);
       break;
 
     default:
@@ -298,6 +372,9 @@ int VR4300_CP1_C_OLT_C_LT(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result | (flag << 23);
   exdc_latch->dest = dest;
   return 0;
@@ -324,12 +401,16 @@ int VR4300_CP1_C_UEQ_C_NGL(struct vr4300 *vr4300,
       ft32 = ft;
 
       result &= ~(1 << 23);
-      flag = fpu_cmp_ueq_32(&fs32, &ft32);
+      flag = iw & 0x8
+        ? fpu_cmp_ueq_32(&fs32, &ft32)
+        : fpu_qcmp_ueq_32(&fs32, &ft32);
       break;
 
     case VR4300_FMT_D:
       result &= ~(1 << 23);
-      flag = fpu_cmp_ueq_64(&fs, &ft);
+      flag = iw & 0x8
+        ? fpu_cmp_ueq_64(&fs, &ft)
+        : fpu_qcmp_ueq_64(&fs, &ft);
       break;
 
     default:
@@ -337,6 +418,9 @@ int VR4300_CP1_C_UEQ_C_NGL(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result | (flag << 23);
   exdc_latch->dest = dest;
   return 0;
@@ -363,12 +447,16 @@ int VR4300_CP1_C_ULE_C_NGT(struct vr4300 *vr4300,
       ft32 = ft;
 
       result &= ~(1 << 23);
-      flag = fpu_cmp_ule_32(&fs32, &ft32);
+      flag = iw & 0x8
+        ? fpu_cmp_ule_32(&fs32, &ft32)
+        : fpu_qcmp_ule_32(&fs32, &ft32);
       break;
 
     case VR4300_FMT_D:
       result &= ~(1 << 23);
-      flag = fpu_cmp_ule_64(&fs, &ft);
+      flag = iw & 0x8
+        ? fpu_cmp_ule_64(&fs, &ft)
+        : fpu_qcmp_ule_64(&fs, &ft);
       break;
 
     default:
@@ -376,6 +464,9 @@ int VR4300_CP1_C_ULE_C_NGT(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result | (flag << 23);
   exdc_latch->dest = dest;
   return 0;
@@ -402,12 +493,16 @@ int VR4300_CP1_C_ULT_C_NGE(struct vr4300 *vr4300,
       ft32 = ft;
 
       result &= ~(1 << 23);
-      flag = fpu_cmp_ult_32(&fs32, &ft32);
+      flag = iw & 0x8
+        ? fpu_cmp_ult_32(&fs32, &ft32)
+        : fpu_qcmp_ult_32(&fs32, &ft32);
       break;
 
     case VR4300_FMT_D:
       result &= ~(1 << 23);
-      flag = fpu_cmp_ult_64(&fs, &ft);
+      flag = iw & 0x8
+        ? fpu_cmp_ult_64(&fs, &ft)
+        : fpu_qcmp_ult_64(&fs, &ft);
       break;
 
     default:
@@ -415,6 +510,9 @@ int VR4300_CP1_C_ULT_C_NGE(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result | (flag << 23);
   exdc_latch->dest = dest;
   return 0;
@@ -441,12 +539,16 @@ int VR4300_CP1_C_UN_C_NGLE(struct vr4300 *vr4300,
       ft32 = ft;
 
       result &= ~(1 << 23);
-      flag = fpu_cmp_un_32(&fs32, &ft32);
+      flag = iw & 0x8
+        ? fpu_cmp_un_32(&fs32, &ft32)
+        : fpu_qcmp_un_32(&fs32, &ft32);
       break;
 
     case VR4300_FMT_D:
       result &= ~(1 << 23);
-      flag = fpu_cmp_un_64(&fs, &ft);
+      flag = iw & 0x8
+        ? fpu_cmp_un_64(&fs, &ft)
+        : fpu_qcmp_un_64(&fs, &ft);
       break;
 
     default:
@@ -454,6 +556,9 @@ int VR4300_CP1_C_UN_C_NGLE(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result | (flag << 23);
   exdc_latch->dest = dest;
   return 0;
@@ -512,6 +617,9 @@ int VR4300_CP1_CEIL_L(struct vr4300 *vr4300,
   }
 #endif
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300, 5);
@@ -570,6 +678,9 @@ int VR4300_CP1_CEIL_W(struct vr4300 *vr4300,
   }
 #endif
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300, 5);
@@ -606,6 +717,17 @@ int VR4300_CFC1(struct vr4300 *vr4300,
   if (vr4300->pipeline.dcwb_latch.dest == VR4300_CP1_FCR31)
     result = vr4300->pipeline.dcwb_latch.result;
 
+  // Fold in exceptions raised since FCR31 was written. Those still
+  // in the host's sticky flags (everything, when no exceptions are
+  // enabled) can't be told apart by op, so they all count as cause.
+  if (src == VR4300_CP1_FCR31) {
+    uint32_t host = vr4300_cp1_host_flags(fpu_get_state());
+    uint32_t cause = vr4300->cp1.cause | host;
+
+    result |= (vr4300->cp1.flags | host) << 2;
+    result = (result & ~0x3F000ULL) | (uint64_t) cause << 12;
+  }
+
   // Undefined while the next instruction
   // executes, so we can cheat and use the RF.
   exdc_latch->result = (int32_t) result;
@@ -616,16 +738,36 @@ int VR4300_CFC1(struct vr4300 *vr4300,
 //
 // CTC1
 //
-// XXX: Raise exception on cause/enable.
-// XXX: In such cases, ensure write occurs.
-//
 int VR4300_CTC1(struct vr4300 *vr4300,
   uint32_t iw, uint64_t rs, uint64_t rt) {
   struct vr4300_exdc_latch *exdc_latch = &vr4300->pipeline.exdc_latch;
   unsigned dest = GET_RD(iw);
 
-  if (dest == 31)
+  if (dest == 31) {
+    fpu_state_t state = fpu_get_state();
+    fpu_state_t round = vr4300_cp1_round_modes[rt & 0x3];
+
+    // The host FPU runs in the guest's rounding mode at all times,
+    // so the kernels don't have to switch modes around each op. We
+    // only need to touch it here, when the mode actually changes
+    // (or there are host exception flags to clear).
+    if ((state & (FPU_ROUND_MASK | FPU_FLAG_EXCPS)) != round)
+      fpu_set_state((state & ~(FPU_ROUND_MASK | FPU_FLAG_EXCPS)) | round);
+
+    vr4300->cp1.enables = rt >> 7 & 0x1F;
+    vr4300->cp1.flags = 0;
+    vr4300->cp1.cause = rt >> 12 & 0x3F;
+
+    // Writing a cause bit that's enabled raises FPE (the write
+    // still happens).
+    if (unlikely(rt >> 12 & rt >> 7 & 0x1F)) {
+      vr4300->regs[VR4300_CP1_FCR31] = (uint32_t) rt;
+      VR4300_FPE(vr4300);
+      return 1;
+    }
+
     dest = VR4300_CP1_FCR31;
+  }
 
   else {
     assert(0 && "CTC1: Write to fixed/reserved FCR.");
@@ -675,6 +817,9 @@ int VR4300_CP1_CVT_D(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return fmt != VR4300_FMT_S
@@ -710,6 +855,9 @@ int VR4300_CP1_CVT_L(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300, 5);
@@ -747,6 +895,9 @@ int VR4300_CP1_CVT_S(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300,
@@ -781,6 +932,9 @@ int VR4300_CP1_CVT_W(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300, 5);
@@ -816,6 +970,9 @@ int VR4300_CP1_DIV(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300,
@@ -900,6 +1057,9 @@ int VR4300_CP1_FLOOR_L(struct vr4300 *vr4300,
   }
 #endif
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300, 5);
@@ -957,6 +1117,9 @@ int VR4300_CP1_FLOOR_W(struct vr4300 *vr4300,
   }
 #endif
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300, 5);
@@ -1052,6 +1215,9 @@ int VR4300_CP1_MUL(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300,
@@ -1204,6 +1370,9 @@ int VR4300_CP1_ROUND_L(struct vr4300 *vr4300,
   }
 #endif
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300, 5);
@@ -1262,6 +1431,9 @@ int VR4300_CP1_ROUND_W(struct vr4300 *vr4300,
   }
 #endif
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300, 5);
@@ -1315,6 +1487,9 @@ int VR4300_CP1_SQRT(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300,
@@ -1351,6 +1526,9 @@ int VR4300_CP1_SUB(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300, 3);
@@ -1408,6 +1586,9 @@ int VR4300_CP1_TRUNC_L(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300, 5);
@@ -1441,6 +1622,9 @@ int VR4300_CP1_TRUNC_W(struct vr4300 *vr4300,
       return 1;
   }
 
+  if (vr4300_cp1_check_fpe(vr4300))
+    return 1;
+
   exdc_latch->result = result;
   exdc_latch->dest = dest;
   return vr4300_do_mci(vr4300, 5);
@@ -1448,6 +1632,28 @@ int VR4300_CP1_TRUNC_W(struct vr4300 *vr4300,
 
 // Initializes the coprocessor.
 void vr4300_cp1_init(struct vr4300 *vr4300) {
+  vr4300_cp1_load_host_state(vr4300);
+}
+
+// Puts the host FPU into the state FCR31 calls for. The state is
+// per host thread, so this has to be done whenever a thread starts
+// (or resumes) running a processor.
+void vr4300_cp1_load_host_state(struct vr4300 *vr4300) {
+  uint32_t fcr31 = vr4300->regs[VR4300_CP1_FCR31];
+
+  fpu_set_state(vr4300_cp1_round_modes[fcr31 & 0x3] | FPU_MASK_EXCPS);
+}
+
+// Takes this processor's exception flags out of the host FPU, before
+// the thread goes on to something else (or we take a snapshot), and
+// leaves the host FPU as host code expects it: rounding to nearest,
+// with no flags for the guest to pick up later.
+void vr4300_cp1_save_host_state(struct vr4300 *vr4300) {
+  fpu_state_t state = fpu_get_state();
+  uint32_t host = vr4300_cp1_host_flags(state);
+
+  vr4300->cp1.flags |= host;
+  vr4300->cp1.cause |= host;
   fpu_set_state(FPU_ROUND_NEAREST | FPU_MASK_EXCPS);
 }
 
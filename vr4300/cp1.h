@@ -15,6 +15,16 @@
 
 struct vr4300;
 
+// FP exception state that isn't in FCR31 (yet). Exception bits here
+// are in FCR31 order (inexact, underflow, overflow, div-by-zero and
+// invalid), unshifted. Flags raised by the host FPU stay in its
+// sticky bits until the guest reads FCR31 or we switch threads.
+struct vr4300_cp1 {
+  uint32_t enables; // FCR31 enables, as of the last CTC1
+  uint32_t flags;   // raised since FCR31 was last written
+  uint32_t cause;   // FCR31 cause (unimplemented op included)
+};
+
 int VR4300_BC1(struct vr4300 *vr4300, uint32_t iw, uint64_t fs, uint64_t ft);
 int VR4300_CFC1(struct vr4300 *vr4300, uint32_t iw, uint64_t rs, uint64_t rt);
 int VR4300_CTC1(struct vr4300 *vr4300, uint32_t iw, uint64_t rs, uint64_t rt);
@@ -57,6 +67,8 @@ int VR4300_CP1_TRUNC_L(struct vr4300 *vr4300, uint32_t iw, uint64_t fs, uint64_t
 int VR4300_CP1_TRUNC_W(struct vr4300 *vr4300, uint32_t iw, uint64_t fs, uint64_t ft);
 
 cen64_cold void vr4300_cp1_init(struct vr4300 *vr4300);
+cen64_cold void vr4300_cp1_load_host_state(struct vr4300 *vr4300);
+cen64_cold void vr4300_cp1_save_host_state(struct vr4300 *vr4300);
 
 #endif
 
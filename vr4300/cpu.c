@@ -9,11 +9,26 @@
 //
 
 #include "common.h"
+#include "bus/controller.h"
+#include "common/snapshot.h"
 #include "vr4300/cp0.h"
 #include "vr4300/cp1.h"
 #include "vr4300/cpu.h"
 #include "vr4300/icache.h"
 #include "vr4300/pipeline.h"
+#include "vr4300/segment.h"
+#include <inttypes.h>
+
+// Layout of the VR4300 snapshot section. Everything is stored as-is,
+// save for host pointers: the bus is reattached, segments are looked
+// up again, the trace log is kept and the pending cache operation is
+// stored by LUT index.
+struct vr4300_snapshot {
+  uint32_t cacheop;
+  uint32_t reserved;
+
+  struct vr4300 vr4300;
+};
 
 #ifdef DEBUG_MMIO_REGISTER_ACCESS
 const char *mi_register_mnemonics[NUM_MI_REGISTERS] = {
@@ -29,6 +44,22 @@ static void vr4300_connect_bus(struct vr4300 *vr4300,
   vr4300->bus = bus;
 }
 
+// Allocates a zeroed VR4300 with its hot state cache-line aligned.
+struct vr4300 *vr4300_alloc(void) {
+  void *vr4300;
+
+  if (posix_memalign(&vr4300, CACHE_LINE_SIZE, sizeof(struct vr4300)))
+    return NULL;
+
+  memset(vr4300, 0, sizeof(struct vr4300));
+  return vr4300;
+}
+
+// Releases a VR4300 from vr4300_alloc().
+void vr4300_free(struct vr4300 *vr4300) {
+  free(vr4300);
+}
+
 // Initializes the VR4300 component.
 int vr4300_init(struct vr4300 *vr4300, struct bus_controller *bus) {
   vr4300_connect_bus(vr4300, bus);
@@ -48,8 +79,180 @@ int vr4300_init(struct vr4300 *vr4300, struct bus_controller *bus) {
   return 0;
 }
 
-// Prints out simulation information to stdout.
-void vr4300_print_summary(struct vr4300_stats *stats) {
+// Writes back every dirty data cache line, leaving it valid and clean,
+// so guest RAM holds everything the guest has stored.
+void vr4300_writeback_dcache(struct vr4300 *vr4300) {
+  struct vr4300_dcache *dcache = &vr4300->dcache;
+  uint32_t dirty[512 / 32];
+  unsigned i, j;
+
+  if (vr4300_dcache_find_dirty(dcache, dirty) == 0)
+    return;
+
+  for (i = 0; i < 512 / 32; i++) {
+    while (dirty[i]) {
+      unsigned index = i * 32 + __builtin_ctz(dirty[i]);
+      const struct vr4300_dcache_line *line = dcache->lines + index;
+      uint32_t bus_address = dcache->tags[index] | (index << 4 & 0xFF0);
+      uint32_t data[4];
+
+      memcpy(data, line->data, sizeof(data));
+
+      for (j = 0; j < 4; j++)
+        bus_write_word(vr4300, bus_address + j * 4,
+          data[j ^ (WORD_ADDR_XOR >> 2)], ~0);
+
+      vr4300_dcache_set_clean(dcache, line);
+      dirty[i] &= dirty[i] - 1;
+    }
+  }
+}
+
+// Drives the external interrupt pins (Cause IP2-IP6) from the system's
+// devices; IP7 belongs to the timer and IP0-IP1 to software.
+void vr4300_set_interrupt_lines(struct vr4300 *vr4300, unsigned lines) {
+  uint64_t cause = vr4300->regs[VR4300_CP0_REGISTER_CAUSE];
+
+  vr4300->regs[VR4300_CP0_REGISTER_CAUSE] =
+    (cause & ~0x7C00ULL) | (lines & 0x1F) << 10;
+}
+
+// Writes the processor state out to a snapshot.
+int vr4300_save_snapshot(const struct vr4300 *vr4300,
+  struct snapshot_writer *writer) {
+  struct vr4300_pipeline *pipeline;
+  struct vr4300_snapshot *state;
+  int status;
+
+  if (posix_memalign((void **) &state, CACHE_LINE_SIZE, sizeof(*state)))
+    return 1;
+
+  memset(state, 0, sizeof(*state));
+
+  state->vr4300 = *vr4300;
+  pipeline = &state->vr4300.pipeline;
+
+  state->cacheop = vr4300_get_cacheop_index(
+    pipeline->exdc_latch.request.cacheop);
+
+  state->vr4300.bus = NULL;
+  state->vr4300.log = NULL;
+  state->vr4300.callgraph = NULL;
+  pipeline->exdc_latch.request.cacheop = NULL;
+  pipeline->icrf_latch.segment = NULL;
+  pipeline->exdc_latch.segment = NULL;
+
+  status = snapshot_write_section(writer,
+    SNAPSHOT_SECTION_VR4300, state, sizeof(*state));
+
+  free(state);
+  return status;
+}
+
+// Restores the processor state from a snapshot.
+int vr4300_load_snapshot(struct vr4300 *vr4300,
+  const struct snapshot *snapshot) {
+  const struct vr4300_snapshot *state;
+  struct bus_controller *bus = vr4300->bus;
+  struct vr4300_pipeline *pipeline;
+  struct callgraph *callgraph = vr4300->callgraph;
+  FILE *log = vr4300->log;
+  uint32_t cp0_status;
+  size_t length;
+
+  if ((state = snapshot_get_section(snapshot,
+    SNAPSHOT_SECTION_VR4300, &length)) == NULL ||
+    length != sizeof(*state))
+    return 1;
+
+  *vr4300 = state->vr4300;
+  vr4300_connect_bus(vr4300, bus);
+  vr4300->log = log;
+  vr4300->callgraph = callgraph;
+
+  pipeline = &vr4300->pipeline;
+  cp0_status = vr4300->regs[VR4300_CP0_REGISTER_STATUS];
+
+  pipeline->exdc_latch.request.cacheop = vr4300_get_cacheop(state->cacheop);
+  pipeline->exdc_latch.segment = get_default_segment();
+
+  // RF consumes the segment IC latched without checking it again.
+  if ((pipeline->icrf_latch.segment = get_segment(
+    pipeline->icrf_latch.common.pc, cp0_status)) == NULL)
+    pipeline->icrf_latch.segment = get_default_segment();
+
+  return 0;
+}
+
+#ifdef VR4300_DETAILED_STATS
+static const char *vr4300_mem_stat_names[NUM_VR4300_MEM_STATS] = {
+  "I$ hits",
+  "I$ misses",
+  "I$ fills",
+  "Uncached fetches",
+  "D$ hits",
+  "D$ misses",
+  "D$ fills",
+  "D$ write-backs",
+  "Uncached reads",
+  "Uncached writes",
+  "ITLB hits",
+  "ITLB misses",
+  "DTLB hits",
+  "DTLB misses",
+};
+
+// Returns hits / (hits + misses) as a percentage.
+static float vr4300_hit_rate(uint64_t hits, uint64_t misses) {
+  return hits + misses ? 100.0f * hits / (hits + misses) : 0.0f;
+}
+
+// Prints the memory hierarchy counters, run total and since the
+// previous summary, then starts a new interval.
+static void vr4300_print_mem_stats(const struct vr4300 *vr4300,
+  struct vr4300_stats *stats) {
+  const uint64_t *total = vr4300->mem_stats;
+  uint64_t interval[NUM_VR4300_MEM_STATS];
+  unsigned i;
+
+  for (i = 0; i < NUM_VR4300_MEM_STATS; i++)
+    interval[i] = total[i] - stats->last_mem_stats[i];
+
+  printf(" * Memory hierarchy statistics:\n\n"
+         "   %16s  %16s  %16s\n", "", "Run", "Interval");
+
+  for (i = 0; i < NUM_VR4300_MEM_STATS; i++) {
+    printf("   %16s: %16" PRIu64 "  %16" PRIu64 "\n",
+      vr4300_mem_stat_names[i], total[i], interval[i]);
+  }
+
+#define HIT_RATE(counts, what) vr4300_hit_rate( \
+  counts[VR4300_STAT_##what##_HITS], counts[VR4300_STAT_##what##_MISSES])
+
+  printf("\n"
+         "   %16s: %15.2f%%  %15.2f%%\n"
+         "   %16s: %15.2f%%  %15.2f%%\n"
+         "   %16s: %15.2f%%  %15.2f%%\n"
+         "   %16s: %15.2f%%  %15.2f%%\n"
+         "\n\n",
+
+    "I$ hit rate", HIT_RATE(total, ICACHE), HIT_RATE(interval, ICACHE),
+    "D$ hit rate", HIT_RATE(total, DCACHE), HIT_RATE(interval, DCACHE),
+    "ITLB hit rate", HIT_RATE(total, ITLB), HIT_RATE(interval, ITLB),
+    "DTLB hit rate", HIT_RATE(total, DTLB), HIT_RATE(interval, DTLB)
+  );
+
+#undef HIT_RATE
+
+  memcpy(stats->last_mem_stats, total, sizeof(stats->last_mem_stats));
+}
+#endif
+
+// Prints out simulation information to stdout. Figures are given for
+// the whole run, and for the interval since the previous summary.
+void vr4300_print_summary(const struct vr4300 *vr4300,
+  struct vr4300_stats *stats) {
+  unsigned long interval_cycles, interval_instructions;
   unsigned i, j;
   float secs;
   float cpi;
@@ -71,19 +274,41 @@ void vr4300_print_summary(struct vr4300_stats *stats) {
   );
 
   // Print performance statistics.
-  cpi = (float) stats->executed_instructions / stats->total_cycles;
+  interval_cycles = stats->total_cycles - stats->last_total_cycles;
+  interval_instructions = stats->executed_instructions -
+    stats->last_executed_instructions;
+
+  cpi = stats->executed_instructions
+    ? (float) stats->total_cycles / stats->executed_instructions : 0.0f;
 
   printf(" * Performance statistics:\n\n"
+         "   %16s: %lu\n"
+         "   %16s: %lu\n"
+         "   %16s: %lu\n"
+         "   %16s: %1.2f\n"
          "   %16s: %lu\n"
          "   %16s: %lu\n"
          "   %16s: %1.2f\n"
          "\n\n",
 
     "Elapsed pcycles", stats->total_cycles,
+    "Sampled pcycles", stats->sampled_cycles,
     "Insns executed", stats->executed_instructions,
-    "Average CPI", cpi
+    "Average CPI", cpi,
+    "Interval pcycles", interval_cycles,
+    "Interval insns", interval_instructions,
+    "Interval CPI", interval_instructions
+      ? (float) interval_cycles / interval_instructions : 0.0f
   );
 
+#ifdef VR4300_DETAILED_STATS
+  vr4300_print_stall_profile(vr4300, stats);
+  vr4300_print_mem_stats(vr4300, stats);
+#endif
+
+  stats->last_total_cycles = stats->total_cycles;
+  stats->last_executed_instructions = stats->executed_instructions;
+
   // Print executed opcode counts.
   printf(" * Executed instruction counts:\n\n");
 
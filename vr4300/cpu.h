@@ -15,10 +15,14 @@
 #include "vr4300/cp1.h"
 #include "vr4300/dcache.h"
 #include "vr4300/icache.h"
+#include "vr4300/idle.h"
 #include "vr4300/opcodes.h"
 #include "vr4300/pipeline.h"
+#include "vr4300/stalls.h"
 
 struct bus_controller;
+struct snapshot;
+struct snapshot_writer;
 
 enum vr4300_signals {
   VR4300_SIGNAL_FORCEEXIT = 0x000000001,
@@ -89,30 +93,101 @@ enum mi_register {
 extern const char *mi_register_mnemonics[NUM_MI_REGISTERS];
 #endif
 
+// Memory hierarchy counters. These are only maintained when built
+// with VR4300_DETAILED_STATS; otherwise VR4300_STAT() compiles away.
+enum vr4300_mem_stat {
+  VR4300_STAT_ICACHE_HITS,
+  VR4300_STAT_ICACHE_MISSES,
+  VR4300_STAT_ICACHE_FILLS,
+  VR4300_STAT_UNCACHED_FETCHES,
+  VR4300_STAT_DCACHE_HITS,
+  VR4300_STAT_DCACHE_MISSES,
+  VR4300_STAT_DCACHE_FILLS,
+  VR4300_STAT_DCACHE_WRITEBACKS,
+  VR4300_STAT_UNCACHED_READS,
+  VR4300_STAT_UNCACHED_WRITES,
+  VR4300_STAT_ITLB_HITS,
+  VR4300_STAT_ITLB_MISSES,
+  VR4300_STAT_DTLB_HITS,
+  VR4300_STAT_DTLB_MISSES,
+  NUM_VR4300_MEM_STATS
+};
+
+#ifdef VR4300_DETAILED_STATS
+#define VR4300_STAT(vr4300, stat, n) ((vr4300)->mem_stats[stat] += (n))
+#else
+#define VR4300_STAT(vr4300, stat, n) do {} while (0)
+#endif
+
+struct callgraph;
+
+// Laid out by access frequency: the pipeline and register file are
+// touched every pcycle and start on their own host cache lines. The
+// signals and idle state are touched by memory accesses and branches.
+// Everything else (TLB, MI registers, caches) is cold.
 struct vr4300 {
-  struct bus_controller *bus;
+  // The bus functions expect this to be the first member.
+  cen64_align(struct bus_controller *bus, CACHE_LINE_SIZE);
   struct vr4300_pipeline pipeline;
 
-  uint64_t regs[NUM_VR4300_REGISTERS];
+  cen64_align(uint64_t regs[NUM_VR4300_REGISTERS], CACHE_LINE_SIZE);
+
+  cen64_align(unsigned signals, CACHE_LINE_SIZE);
+
+  // Per-instance execution trace; NULL when tracing is disabled.
+  FILE *log;
+
+  // Call-graph profile being taken; NULL when not profiling.
+  struct callgraph *callgraph;
+
+  struct vr4300_idle idle;
+  struct vr4300_cp1 cp1;
+
+  cen64_align(struct vr4300_cp0 cp0, CACHE_LINE_SIZE);
   uint32_t mi_regs[NUM_MI_REGISTERS];
 
-  unsigned signals;
-  struct vr4300_cp0 cp0;
+#ifdef VR4300_DETAILED_STATS
+  uint64_t mem_stats[NUM_VR4300_MEM_STATS];
+#endif
 
-  struct vr4300_dcache dcache;
-  struct vr4300_icache icache;
+  cen64_align(struct vr4300_dcache dcache, CACHE_LINE_SIZE);
+  cen64_align(struct vr4300_icache icache, CACHE_LINE_SIZE);
 
+#ifdef VR4300_DETAILED_STATS
+  cen64_align(struct vr4300_stall_profile stalls, CACHE_LINE_SIZE);
+#endif
 };
 
+// Instruction figures are estimated from sampled pcycles (which may
+// be every pcycle), scaled up by the pcycles each sample stands for.
 struct vr4300_stats {
   unsigned long executed_instructions;
   unsigned long total_cycles;
+  unsigned long sampled_cycles;
 
   unsigned long opcode_counts[NUM_VR4300_OPCODES];
+
+  // Totals as of the previous summary, for per-interval figures.
+  unsigned long last_executed_instructions;
+  unsigned long last_total_cycles;
+  uint64_t last_mem_stats[NUM_VR4300_MEM_STATS];
+  uint64_t last_stall_cycles[NUM_VR4300_STALLS];
+  uint64_t last_idle_cycles;
 };
 
+cen64_cold struct vr4300 *vr4300_alloc(void);
+cen64_cold void vr4300_free(struct vr4300 *vr4300);
+
 cen64_cold int vr4300_init(struct vr4300 *vr4300, struct bus_controller *bus);
-cen64_cold void vr4300_print_summary(struct vr4300_stats *stats);
+cen64_cold void vr4300_print_summary(const struct vr4300 *vr4300,
+  struct vr4300_stats *stats);
+
+cen64_cold void vr4300_writeback_dcache(struct vr4300 *vr4300);
+void vr4300_set_interrupt_lines(struct vr4300 *vr4300, unsigned lines);
+cen64_cold int vr4300_save_snapshot(const struct vr4300 *vr4300,
+  struct snapshot_writer *writer);
+cen64_cold int vr4300_load_snapshot(struct vr4300 *vr4300,
+  const struct snapshot *snapshot);
 
 cen64_flatten cen64_hot void vr4300_cycle_(struct vr4300 *vr4300);
 
@@ -135,7 +210,8 @@ cen64_flatten cen64_hot static inline void vr4300_cycle(struct vr4300 *vr4300) {
 }
 
 
-cen64_cold void vr4300_cycle_extra(struct vr4300 *vr4300, struct vr4300_stats *stats);
+cen64_cold void vr4300_cycle_extra(struct vr4300 *vr4300,
+  struct vr4300_stats *stats, unsigned weight);
 
 #endif
 
@@ -10,162 +10,211 @@
 
 #include "common.h"
 #include "vr4300/dcache.h"
+#include <emmintrin.h>
 
-static inline struct vr4300_dcache_line* get_line(
-  struct vr4300_dcache *dcache, uint64_t vaddr);
+static inline unsigned get_index(uint64_t vaddr);
+static inline bool is_valid(const struct vr4300_dcache *dcache,
+  unsigned index);
 
-static inline uint32_t get_tag(const struct vr4300_dcache_line *line);
-static inline bool is_valid(const struct vr4300_dcache_line *line);
+static void invalidate_line(struct vr4300_dcache *dcache, unsigned index);
+static bool is_dirty(const struct vr4300_dcache *dcache, unsigned index);
+static void set_dirty(struct vr4300_dcache *dcache, unsigned index);
+static void set_tag(struct vr4300_dcache *dcache,
+  unsigned index, uint32_t tag);
+static void set_taglo(struct vr4300_dcache *dcache,
+  unsigned index, uint32_t taglo);
+static void validate_line(struct vr4300_dcache *dcache,
+  unsigned index, uint32_t tag);
 
-static void invalidate_line(struct vr4300_dcache_line *line);
-static bool is_dirty(const struct vr4300_dcache_line *line);
-static void set_dirty(struct vr4300_dcache_line *line);
-static void set_tag(struct vr4300_dcache_line *line, uint32_t tag);
-static void set_taglo(struct vr4300_dcache_line *line, uint32_t taglo);
-static void validate_line(struct vr4300_dcache_line *line, uint32_t tag);
-
-// Returns the line for a given virtual address.
-struct vr4300_dcache_line* get_line(
-  struct vr4300_dcache *dcache, uint64_t vaddr) {
-  return dcache->lines + (vaddr >> 4 & 0x1FF);
-}
-
-// Returns the physical tag associated with the line.
-uint32_t get_tag(const struct vr4300_dcache_line *line) {
-  return line->metadata & ~0xFFFU;
+// Returns the line index for a given virtual address.
+unsigned get_index(uint64_t vaddr) {
+  return vaddr >> 4 & 0x1FF;
 }
 
 // Invalidates the line, but leaves the physical tag untouched.
-void invalidate_line(struct vr4300_dcache_line *line) {
-  line->metadata &= ~0x1;
+void invalidate_line(struct vr4300_dcache *dcache, unsigned index) {
+  dcache->state[index] &= ~VR4300_DCACHE_VALID;
 }
 
-// Returns true if the line is valid, otherwise returns false.
-bool is_dirty(const struct vr4300_dcache_line *line) {
-  return (line->metadata & 0x2) == 0x2;
+// Returns true if the line is dirty, otherwise returns false.
+bool is_dirty(const struct vr4300_dcache *dcache, unsigned index) {
+  return (dcache->state[index] & VR4300_DCACHE_DIRTY) != 0;
 }
 
 // Returns true if the line is valid, otherwise returns false.
-bool is_valid(const struct vr4300_dcache_line *line) {
-  return (line->metadata & 0x1) == 0x1;
+bool is_valid(const struct vr4300_dcache *dcache, unsigned index) {
+  return (dcache->state[index] & VR4300_DCACHE_VALID) != 0;
 }
 
 // Sets the state of the line to dirty.
-void set_dirty(struct vr4300_dcache_line *line) {
-  line->metadata |= 0x2;
+void set_dirty(struct vr4300_dcache *dcache, unsigned index) {
+  dcache->state[index] |= VR4300_DCACHE_DIRTY;
 }
 
 // Sets the tag of the specified line, retaining current valid bit.
-void set_tag(struct vr4300_dcache_line *line, uint32_t tag) {
-  line->metadata = tag | (line->metadata & 0x1);
+void set_tag(struct vr4300_dcache *dcache, unsigned index, uint32_t tag) {
+  dcache->tags[index] = tag;
+  dcache->state[index] &= VR4300_DCACHE_VALID;
 }
 
 // Sets the tag of the specified line and valid bit.
-void set_taglo(struct vr4300_dcache_line *line, uint32_t taglo) {
-  line->metadata = (taglo << 4 & 0xFFFFF000U) | (taglo >> 7 & 0x1) | (taglo >> 5 & 0x2);
+void set_taglo(struct vr4300_dcache *dcache, unsigned index, uint32_t taglo) {
+  dcache->tags[index] = taglo << 4 & 0xFFFFF000U;
+  dcache->state[index] = (taglo >> 7 & VR4300_DCACHE_VALID) |
+    (taglo >> 5 & VR4300_DCACHE_DIRTY);
 }
 
 // Sets the line's physical tag and validates the line.
-static void validate_line(struct vr4300_dcache_line *line, uint32_t tag) {
-  line->metadata = tag | 0x1;
+static void validate_line(struct vr4300_dcache *dcache,
+  unsigned index, uint32_t tag) {
+  dcache->tags[index] = tag;
+  dcache->state[index] = VR4300_DCACHE_VALID;
 }
 
 // Sets the physical tag associated with the line, marks as dirty.
 void vr4300_dcache_create_dirty_exclusive(
   struct vr4300_dcache *dcache, uint64_t vaddr, uint32_t paddr) {
-  struct vr4300_dcache_line *line = get_line(dcache, vaddr);
+  unsigned index = get_index(vaddr);
 
-  set_tag(line, paddr & ~0xFFFU);
-  set_dirty(line);
+  set_tag(dcache, index, paddr & ~0xFFFU);
+  set_dirty(dcache, index);
 }
 
 // Fills an instruction cache line with data.
 void vr4300_dcache_fill(struct vr4300_dcache *dcache,
   uint64_t vaddr, uint32_t paddr, const void *data) {
-  struct vr4300_dcache_line *line = get_line(dcache, vaddr);
+  unsigned index = get_index(vaddr);
 
-  memcpy(line->data, data, sizeof(line->data));
-  validate_line(line, paddr & ~0xFFFU);
+  memcpy(dcache->lines[index].data, data, sizeof(dcache->lines[index].data));
+  validate_line(dcache, index, paddr & ~0xFFFU);
 }
 
 // Returns the tag of the line associated with vaddr.
-uint32_t vr4300_dcache_get_tag(const struct vr4300_dcache_line *line, uint64_t vaddr) {
-  return get_tag(line) | (vaddr & 0xFF0U);
+uint32_t vr4300_dcache_get_tag(const struct vr4300_dcache *dcache,
+  const struct vr4300_dcache_line *line, uint64_t vaddr) {
+  return dcache->tags[vr4300_dcache_line_index(dcache, line)] |
+    (vaddr & 0xFF0U);
 }
 
 // Gets the physical tag associated with the line.
 uint32_t vr4300_dcache_get_taglo(struct vr4300_dcache *dcache, uint64_t vaddr) {
-  struct vr4300_dcache_line *line = get_line(dcache, vaddr);
+  unsigned index = get_index(vaddr);
+  uint8_t state = dcache->state[index];
+
+  uint32_t taglo = ((state & VR4300_DCACHE_VALID) << 1) |
+    ((state & VR4300_DCACHE_DIRTY) >> 1);
 
-  uint32_t taglo = ((line->metadata & 0x1) << 1) | ((line->metadata & 0x2) >> 1);
-  return taglo | (line->metadata >> 4 & 0x0FFFFF00U);
+  return taglo | (dcache->tags[index] >> 4 & 0x0FFFFF00U);
 }
 
 // Initializes the instruction cache.
 void vr4300_dcache_init(struct vr4300_dcache *dcache) {
+  vr4300_dcache_invalidate_all(dcache);
 }
 
 // Invalidates an instruction cache line (regardless if hit or miss).
-void vr4300_dcache_invalidate(struct vr4300_dcache_line *line) {
-  invalidate_line(line);
+void vr4300_dcache_invalidate(struct vr4300_dcache *dcache,
+  const struct vr4300_dcache_line *line) {
+  invalidate_line(dcache, vr4300_dcache_line_index(dcache, line));
 }
 
 // Invalidates an instruction cache line (only on a hit).
 void vr4300_dcache_invalidate_hit(struct vr4300_dcache *dcache,
   uint64_t vaddr, uint32_t paddr) {
-  struct vr4300_dcache_line *line = get_line(dcache, vaddr);
-  uint32_t ptag = get_tag(line);
+  unsigned index = get_index(vaddr);
 
-  if (ptag == (paddr & ~0xFFFU) && is_valid(line))
-    invalidate_line(line);
+  if (dcache->tags[index] == (paddr & ~0xFFFU) && is_valid(dcache, index))
+    invalidate_line(dcache, index);
 }
 
 // Probes the instruction cache for a matching line.
 struct vr4300_dcache_line* vr4300_dcache_probe(
   struct vr4300_dcache *dcache, uint64_t vaddr, uint32_t paddr) {
-  struct vr4300_dcache_line *line = get_line(dcache, vaddr);
-  uint32_t ptag = get_tag(line);
+  unsigned index = get_index(vaddr);
 
   // Virtually index, and physically tagged.
-  if (ptag == (paddr & ~0xFFFU) && is_valid(line))
-    return line;
+  if (dcache->tags[index] == (paddr & ~0xFFFU) && is_valid(dcache, index))
+    return dcache->lines + index;
 
   return NULL;
 }
 
-// Marks the line as dirty.
-void vr4300_dcache_set_dirty(struct vr4300_dcache_line *line) {
-  set_dirty(line);
+// Returns true if the line is dirty.
+bool vr4300_dcache_is_dirty(const struct vr4300_dcache *dcache,
+  const struct vr4300_dcache_line *line) {
+  return is_dirty(dcache, vr4300_dcache_line_index(dcache, line));
+}
+
+// Marks the line as clean (i.e., after a write back).
+void vr4300_dcache_set_clean(struct vr4300_dcache *dcache,
+  const struct vr4300_dcache_line *line) {
+  dcache->state[vr4300_dcache_line_index(dcache, line)] &=
+    ~VR4300_DCACHE_DIRTY;
 }
 
 // Sets the physical tag associated with the line.
 void vr4300_dcache_set_taglo(struct vr4300_dcache *dcache,
   uint64_t vaddr, uint32_t taglo) {
-  struct vr4300_dcache_line *line = get_line(dcache, vaddr);
-
-  set_taglo(line, taglo);
+  set_taglo(dcache, get_index(vaddr), taglo);
 }
 
 // Returns the line if it's dirty and valid.
 // Call before replacement of writeback entry.
 struct vr4300_dcache_line *vr4300_dcache_should_flush_line(
   struct vr4300_dcache *dcache, uint64_t vaddr) {
-  struct vr4300_dcache_line *line = get_line(dcache, vaddr);
+  unsigned index = get_index(vaddr);
 
-  return is_dirty(line) && is_valid(line)
-    ? line : NULL;
+  return is_dirty(dcache, index) && is_valid(dcache, index)
+    ? dcache->lines + index : NULL;
 }
 
 // Writes back the block if the line is valid, then invalidates the line.
 struct vr4300_dcache_line *vr4300_dcache_wb_invalidate(
   struct vr4300_dcache *dcache, uint64_t vaddr) {
-  struct vr4300_dcache_line *line = get_line(dcache, vaddr);
+  unsigned index = get_index(vaddr);
 
-  if (is_valid(line)) {
-    invalidate_line(line);
-    return line;
+  if (is_valid(dcache, index)) {
+    invalidate_line(dcache, index);
+    return dcache->lines + index;
   }
 
   return NULL;
 }
 
+// Invalidates every line, leaving the physical tags untouched.
+void vr4300_dcache_invalidate_all(struct vr4300_dcache *dcache) {
+  __m128i mask = _mm_set1_epi8(~VR4300_DCACHE_VALID);
+  unsigned i;
+
+  for (i = 0; i < 512; i += 16) {
+    __m128i state = _mm_load_si128((__m128i *) (dcache->state + i));
+    _mm_store_si128((__m128i *) (dcache->state + i),
+      _mm_and_si128(state, mask));
+  }
+}
+
+// Builds a bitmap of the lines which are both valid and dirty (i.e.,
+// the ones which need flushing). Returns the number of such lines.
+unsigned vr4300_dcache_find_dirty(const struct vr4300_dcache *dcache,
+  uint32_t dirty[512 / 32]) {
+  __m128i mask = _mm_set1_epi8(VR4300_DCACHE_VALID | VR4300_DCACHE_DIRTY);
+  unsigned i, count = 0;
+
+  for (i = 0; i < 512; i += 32) {
+    __m128i lo = _mm_load_si128((__m128i *) (dcache->state + i));
+    __m128i hi = _mm_load_si128((__m128i *) (dcache->state + i + 16));
+    uint32_t bits;
+
+    lo = _mm_cmpeq_epi8(_mm_and_si128(lo, mask), mask);
+    hi = _mm_cmpeq_epi8(_mm_and_si128(hi, mask), mask);
+
+    bits = (uint32_t) _mm_movemask_epi8(lo) |
+      (uint32_t) _mm_movemask_epi8(hi) << 16;
+
+    dirty[i / 32] = bits;
+    count += __builtin_popcount(bits);
+  }
+
+  return count;
+}
+
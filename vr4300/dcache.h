@@ -12,13 +12,21 @@
 #define __vr4300_dcache_h__
 #include "common.h"
 
+// These match the bus request types (read = 1, write = 2), so a
+// cached access can OR its type into the line state.
+#define VR4300_DCACHE_VALID 0x1
+#define VR4300_DCACHE_DIRTY 0x2
+
 struct vr4300_dcache_line {
   uint8_t data[4 * 4];
-  uint32_t metadata;
 };
 
+// Tags and state are kept apart from the data so that probes and
+// bulk operations only walk a few dense host cache lines.
 struct vr4300_dcache {
-  struct vr4300_dcache_line lines[512];
+  cen64_align(uint32_t tags[512], CACHE_LINE_SIZE);
+  cen64_align(uint8_t state[512], CACHE_LINE_SIZE);
+  cen64_align(struct vr4300_dcache_line lines[512], CACHE_LINE_SIZE);
 };
 
 cen64_cold void vr4300_dcache_init(struct vr4300_dcache *dcache);
@@ -27,13 +35,18 @@ void vr4300_dcache_create_dirty_exclusive(
   struct vr4300_dcache *dcache, uint64_t vaddr, uint32_t paddr);
 void vr4300_dcache_fill(struct vr4300_dcache *dcache,
   uint64_t vaddr, uint32_t paddr, const void *data);
-uint32_t vr4300_dcache_get_tag(const struct vr4300_dcache_line *line, uint64_t vaddr);
-void vr4300_dcache_invalidate(struct vr4300_dcache_line *line);
+uint32_t vr4300_dcache_get_tag(const struct vr4300_dcache *dcache,
+  const struct vr4300_dcache_line *line, uint64_t vaddr);
+void vr4300_dcache_invalidate(struct vr4300_dcache *dcache,
+  const struct vr4300_dcache_line *line);
 void vr4300_dcache_invalidate_hit(struct vr4300_dcache *dcache,
   uint64_t vaddr, uint32_t paddr);
 struct vr4300_dcache_line* vr4300_dcache_probe(
   struct vr4300_dcache *dcache, uint64_t vaddr, uint32_t paddr);
-void vr4300_dcache_set_dirty(struct vr4300_dcache_line *line);
+bool vr4300_dcache_is_dirty(const struct vr4300_dcache *dcache,
+  const struct vr4300_dcache_line *line);
+void vr4300_dcache_set_clean(struct vr4300_dcache *dcache,
+  const struct vr4300_dcache_line *line);
 struct vr4300_dcache_line *vr4300_dcache_should_flush_line(
   struct vr4300_dcache *dcache, uint64_t vaddr);
 struct vr4300_dcache_line *vr4300_dcache_wb_invalidate(
@@ -43,5 +56,21 @@ uint32_t vr4300_dcache_get_taglo(struct vr4300_dcache *dcache,
 void vr4300_dcache_set_taglo(struct vr4300_dcache *dcache,
   uint64_t vaddr, uint32_t tag);
 
+cen64_cold void vr4300_dcache_invalidate_all(struct vr4300_dcache *dcache);
+cen64_cold unsigned vr4300_dcache_find_dirty(
+  const struct vr4300_dcache *dcache, uint32_t dirty[512 / 32]);
+
+// Returns the index of a line within the cache.
+static inline unsigned vr4300_dcache_line_index(
+  const struct vr4300_dcache *dcache, const struct vr4300_dcache_line *line) {
+  return line - dcache->lines;
+}
+
+// Marks the line with a cached access (read or write).
+static inline void vr4300_dcache_mark_line(struct vr4300_dcache *dcache,
+  const struct vr4300_dcache_line *line, unsigned request_type) {
+  dcache->state[vr4300_dcache_line_index(dcache, line)] |= request_type;
+}
+
 #endif
 
@@ -9,6 +9,7 @@
 //
 
 #include "common.h"
+#include "common/callgraph.h"
 #include "bus/controller.h"
 #include "mips.h"
 #include "vr4300/cp0.h"
@@ -16,6 +17,7 @@
 #include "vr4300/dcache.h"
 #include "vr4300/fault.h"
 #include "vr4300/icache.h"
+#include "vr4300/idle.h"
 #include "vr4300/pipeline.h"
 
 const char *vr4300_fault_mnemonics[NUM_VR4300_FAULTS] = {
@@ -38,10 +40,18 @@ static void vr4300_exception_epilogue(struct vr4300 *vr4300,
 
 // Sets attributes common to all interlocks.
 static void vr4300_common_interlocks(struct vr4300 *vr4300,
-  unsigned cycles_to_stall, unsigned skip_stages) {
+  unsigned cycles_to_stall, unsigned skip_stages, enum vr4300_stall cause) {
   struct vr4300_pipeline *pipeline = &vr4300->pipeline;
   pipeline->cycles_to_stall = cycles_to_stall;
   vr4300->regs[PIPELINE_CYCLE_TYPE] = skip_stages;
+
+#ifdef VR4300_DETAILED_STATS
+  // Charge the instruction in the stage that raised the interlock.
+  VR4300_STALL(vr4300, cause, cause == VR4300_STALL_ICB
+    ? pipeline->icrf_latch.common.pc : cause == VR4300_STALL_LDI
+    ? pipeline->rfex_latch.common.pc : pipeline->exdc_latch.common.pc,
+    cycles_to_stall + 1);
+#endif
 }
 
 // Raise a fault that originated in the DC stage.
@@ -190,6 +200,8 @@ void vr4300_exception_epilogue(struct vr4300 *vr4300,
   pipeline->exception_history = 0;
   pipeline->fault_present = true;
   pipeline->cycles_to_stall = 2;
+  vr4300_idle_reset(&vr4300->idle);
+  VR4300_STALL(vr4300, VR4300_STALL_EXCEPTION, epc, 3);
 
   // Set CP0 registers in accordance with the exception.
   vr4300->regs[VR4300_CP0_REGISTER_STATUS] = status | 0x2;
@@ -200,6 +212,9 @@ void vr4300_exception_epilogue(struct vr4300 *vr4300,
     ? (0xFFFFFFFFBFC00200ULL + offs)
     : (0xFFFFFFFF80000000ULL + offs)
   );
+
+  if (unlikely(vr4300->callgraph))
+    callgraph_exception(vr4300->callgraph, vr4300->pipeline.icrf_latch.pc);
 }
 
 // CPU: Coprocessor unusable exception.
@@ -222,7 +237,13 @@ void VR4300_DADE(struct vr4300 *vr4300) {
 // DCB: Data cache busy interlock.
 void VR4300_DCB(struct vr4300 *vr4300) {
   vr4300->pipeline.dcwb_latch.last_op_was_cache_store = false;
-  vr4300_common_interlocks(vr4300, 0, 1);
+  vr4300_common_interlocks(vr4300, 0, 1, VR4300_STALL_DCB);
+}
+
+// Picks up the external interrupt lines after an uncached access, as
+// devices can raise or drop them when read or written.
+static inline void vr4300_sync_interrupt_lines(struct vr4300 *vr4300) {
+  vr4300_set_interrupt_lines(vr4300, vr4300->bus->emu->CP0_Cause >> 10);
 }
 
 // DCM: Data cache busy interlock.
@@ -248,16 +269,25 @@ void VR4300_DCM(struct vr4300 *vr4300) {
       uint32_t hiword, loword;
       int64_t sdata;
 
+      VR4300_STAT(vr4300, VR4300_STAT_UNCACHED_READS, 1);
+
       if (paddr >= UARTBASE && paddr <= (UARTBASE + UARTSIZE)) {
         uint32_t uartword;
+
+        // Reading RBR pops the FIFO; polling LSR and such is fine.
+        vr4300->idle.impure |= paddr == UARTBASE;
         bus_read_word(vr4300, paddr, &uartword);
         dcwb_latch->result = uartword;
-        vr4300_common_interlocks(vr4300, MEMORY_WORD_DELAY, 2);
+        vr4300_sync_interrupt_lines(vr4300);
+        vr4300_common_interlocks(vr4300, MEMORY_WORD_DELAY, 2, VR4300_STALL_DCM);
         return;
       }
       else {
         paddr &= ~mask;
       }
+
+      // Reading the DMA engine's STATUS moves a transfer along.
+      vr4300->idle.impure |= paddr >= DMABASE && paddr < DMABASE + DMASIZE;
       bus_read_word(vr4300, paddr, &hiword);
 
       if (request->access_type != VR4300_ACCESS_DWORD)
@@ -279,9 +309,12 @@ void VR4300_DCM(struct vr4300 *vr4300) {
       uint64_t data = request->data;
       uint64_t dqm = request->wdqm;
 
+      VR4300_STAT(vr4300, VR4300_STAT_UNCACHED_WRITES, 1);
+
       if (paddr >= UARTBASE && paddr <= (UARTBASE + UARTSIZE)) {
         bus_write_word(vr4300, paddr, data >> 24, ~0);
-        vr4300_common_interlocks(vr4300, MEMORY_WORD_DELAY, 2);
+        vr4300_sync_interrupt_lines(vr4300);
+        vr4300_common_interlocks(vr4300, MEMORY_WORD_DELAY, 2, VR4300_STALL_DCM);
         return;
       } else {
         paddr &= ~mask;
@@ -292,15 +325,15 @@ void VR4300_DCM(struct vr4300 *vr4300) {
         paddr += 4;
       }
  
-      FILE *fout = fopen("out.log", "a");
-      fprintf(fout, "WRITE_SYSAD: paddr=0x%.8X, dqm=0x%.8X, data=0x%.8X\n",
-        paddr, dqm, data);
-      fclose(fout);
+      if (vr4300->log)
+        fprintf(vr4300->log, "WRITE_SYSAD: paddr=0x%.8X, dqm=0x%.8X, data=0x%.8X\n",
+          paddr, dqm, data);
       bus_write_word(vr4300, paddr, data, dqm);
       // fprintf(stderr, "WRITE DWORD: 0x%.8X\n", data);
     }
 
-    vr4300_common_interlocks(vr4300, MEMORY_WORD_DELAY, 2);
+    vr4300_sync_interrupt_lines(vr4300);
+    vr4300_common_interlocks(vr4300, MEMORY_WORD_DELAY, 2, VR4300_STALL_DCM);
     return;
   }
 
@@ -310,16 +343,18 @@ void VR4300_DCM(struct vr4300 *vr4300) {
     &vr4300->dcache, vaddr)) != NULL) {
     uint32_t bus_address;
 
-    bus_address = vr4300_dcache_get_tag(line, vaddr);
+    bus_address = vr4300_dcache_get_tag(&vr4300->dcache, line, vaddr);
     memcpy(data, line->data, sizeof(data));
 
     for (i = 0; i < 4; i++)
       bus_write_word(vr4300, bus_address + i * 4,
         data[i ^ (WORD_ADDR_XOR >> 2)], ~0);
+
+    VR4300_STAT(vr4300, VR4300_STAT_DCACHE_WRITEBACKS, 1);
   }
 
   // Raise interlock condition, get virtual address.
-  vr4300_common_interlocks(vr4300, DCACHE_ACCESS_DELAY, 1);
+  vr4300_common_interlocks(vr4300, DCACHE_ACCESS_DELAY, 1, VR4300_STALL_DCM);
   paddr &= ~0xF;
 
   // Fill the cache line.
@@ -328,6 +363,7 @@ void VR4300_DCM(struct vr4300 *vr4300) {
       data + (i ^ (WORD_ADDR_XOR >> 2)));
 
   vr4300_dcache_fill(&vr4300->dcache, vaddr, paddr, data);
+  VR4300_STAT(vr4300, VR4300_STAT_DCACHE_FILLS, 1);
 }
 
 // DTLB: Data TLB exception.
@@ -360,6 +396,18 @@ void VR4300_DTLB(struct vr4300 *vr4300, unsigned miss, unsigned inv, unsigned mo
     status, epc, offs);
 }
 
+// FPE: Floating-point exception.
+void VR4300_FPE(struct vr4300 *vr4300) {
+  struct vr4300_latch *common = &vr4300->pipeline.exdc_latch.common;
+  uint32_t cause, status;
+  uint64_t epc;
+
+  vr4300_ex_fault(vr4300, VR4300_FAULT_FPE);
+  vr4300_exception_prolog(vr4300, common, &cause, &status, &epc);
+  vr4300_exception_epilogue(vr4300, (cause & ~0xFF) | 0x3C,
+    status, epc, 0x180);
+}
+
 // IADE: Instruction address error exception.
 void VR4300_IADE(struct vr4300 *vr4300) {
   abort(); // Hammertime!
@@ -374,6 +422,7 @@ void VR4300_ICB(struct vr4300 *vr4300) {
   unsigned delay;
 
   if (!rfex_latch->cached) {
+    VR4300_STAT(vr4300, VR4300_STAT_UNCACHED_FETCHES, 1);
     bus_read_word(vr4300, paddr, &rfex_latch->iw);
     delay = MEMORY_WORD_DELAY;
   }
@@ -390,10 +439,11 @@ void VR4300_ICB(struct vr4300 *vr4300) {
 
     memcpy(&rfex_latch->iw, line + (vaddr >> 2 & 0x7), sizeof(rfex_latch->iw));
     vr4300_icache_fill(&vr4300->icache, icrf_latch->common.pc, paddr, line);
+    VR4300_STAT(vr4300, VR4300_STAT_ICACHE_FILLS, 1);
     delay = ICACHE_ACCESS_DELAY;
   }
 
-  vr4300_common_interlocks(vr4300, delay, 4);
+  vr4300_common_interlocks(vr4300, delay, 4, VR4300_STALL_ICB);
 }
 
 // INTR: Interrupt exception.
@@ -442,7 +492,7 @@ void VR4300_LDI(struct vr4300 *vr4300) {
 
   // We'll do EX again, but clear the 'busy' flag.
   exdc_latch->request.type = VR4300_BUS_REQUEST_NONE;
-  vr4300_common_interlocks(vr4300, 0, 2);
+  vr4300_common_interlocks(vr4300, 0, 2, VR4300_STALL_LDI);
 }
 
 // RST: External reset exception.
@@ -12,11 +12,13 @@
   (VR4300_##func)
 
 #include "common.h"
+#include "common/callgraph.h"
 #include "bus/controller.h"
 #include "vr4300/cp0.h"
 #include "vr4300/cp1.h"
 #include "vr4300/cpu.h"
 #include "vr4300/decoder.h"
+#include "vr4300/idle.h"
 #include "vr4300/opcodes.h"
 #include "vr4300/opcodes_priv.h"
 #include "vr4300/pipeline.h"
@@ -35,6 +37,17 @@ cen64_align(static const uint64_t vr4300_bitwise_lut[4][2], 64) = {
   { 0ULL,  0ULL}, // -
 };
 
+#ifdef VR4300_BUSY_WAIT_DETECTION
+// Hands short, taken backward branches to the idle loop detector.
+static inline void vr4300_check_idle_loop(struct vr4300 *vr4300,
+  uint64_t pc, uint64_t target) {
+  if (unlikely(pc - target <= VR4300_IDLE_MAX_LOOP_BYTES))
+    vr4300_idle_loop_branch(vr4300, pc, target);
+}
+#else
+#define vr4300_check_idle_loop(vr4300, pc, target) do {} while (0)
+#endif
+
 // Mask to kill the instruction word if "likely" branch.
 cen64_align(static const uint32_t vr4300_branch_lut[2], 8) = {
   ~0U, 0U
@@ -57,6 +70,9 @@ cen64_align(static const uint64_t vr4300_load_sex_mask[2][4], CACHE_LINE_SIZE) =
 static inline int vr4300_do_mci(struct vr4300 *vr4300, unsigned cycles) {
   vr4300->pipeline.cycles_to_stall = cycles - 1;
   vr4300->regs[PIPELINE_CYCLE_TYPE] = 3;
+
+  VR4300_STALL(vr4300, VR4300_STALL_MCI,
+    vr4300->pipeline.rfex_latch.common.pc, cycles);
   return 1;
 }
 
@@ -240,8 +256,12 @@ int VR4300_BEQ_BEQL_BNE_BNEL_BWDETECT(struct vr4300 *vr4300,
 
     exdc_latch->dest = PIPELINE_CYCLE_TYPE;
     exdc_latch->result = 5;
+    vr4300->idle.active = false;
   }
 
+  else
+    vr4300_check_idle_loop(vr4300, rfex_latch->common.pc, icrf_latch->pc);
+
   return 0;
 }
 
@@ -295,6 +315,7 @@ int VR4300_BGEZ_BGEZL_BLTZ_BLTZL(
   }
 
   icrf_latch->pc = rfex_latch->common.pc + (offset + 4);
+  vr4300_check_idle_loop(vr4300, rfex_latch->common.pc, icrf_latch->pc);
   return 0;
 }
 
@@ -349,6 +370,7 @@ int VR4300_BGTZ_BGTZL_BLEZ_BLEZL(
   }
 
   icrf_latch->pc = rfex_latch->common.pc + (offset + 4);
+  vr4300_check_idle_loop(vr4300, rfex_latch->common.pc, icrf_latch->pc);
   return 0;
 }
 
@@ -412,13 +434,15 @@ cen64_cold static int vr4300_cacheop_dc_wb_invalidate(
   if (!(line = vr4300_dcache_wb_invalidate(&vr4300->dcache, vaddr)))
     return 0;
 
-  bus_address = vr4300_dcache_get_tag(line, vaddr);
+  bus_address = vr4300_dcache_get_tag(&vr4300->dcache, line, vaddr);
   memcpy(data, line->data, sizeof(data));
 
   for (i = 0; i < 4; i++)
     bus_write_word(vr4300, bus_address + i * 4,
       data[i ^ (WORD_ADDR_XOR >> 2)], ~0);
 
+  VR4300_STAT(vr4300, VR4300_STAT_DCACHE_WRITEBACKS, 1);
+
   return DCACHE_ACCESS_DELAY;
 }
 
@@ -433,13 +457,15 @@ cen64_cold static int vr4300_cacheop_dc_create_dirty_ex(
   int delay = 0;
 
   if ((line = vr4300_dcache_should_flush_line(&vr4300->dcache, vaddr))) {
-    bus_address = vr4300_dcache_get_tag(line, vaddr);
+    bus_address = vr4300_dcache_get_tag(&vr4300->dcache, line, vaddr);
     memcpy(data, line->data, sizeof(data));
 
     for (i = 0; i < 4; i++)
       bus_write_word(vr4300, bus_address + i * 4,
         data[i ^ (WORD_ADDR_XOR >> 2)], ~0);
 
+    VR4300_STAT(vr4300, VR4300_STAT_DCACHE_WRITEBACKS, 1);
+
     delay = DCACHE_ACCESS_DELAY;
   }
 
@@ -452,7 +478,7 @@ cen64_cold static int vr4300_cacheop_dc_hit_invalidate(
   struct vr4300_dcache_line *line;
 
   if ((line = vr4300_dcache_probe(&vr4300->dcache, vaddr, paddr)))
-    vr4300_dcache_invalidate(line);
+    vr4300_dcache_invalidate(&vr4300->dcache, line);
 
   return 0;
 }
@@ -468,19 +494,21 @@ cen64_cold static int vr4300_cacheop_dc_hit_wb_invalidate(
   if (!(line = vr4300_dcache_probe(&vr4300->dcache, vaddr, paddr)))
     return 0;
 
-  if (line->metadata & 0x2) {
-    bus_address = vr4300_dcache_get_tag(line, vaddr);
+  if (vr4300_dcache_is_dirty(&vr4300->dcache, line)) {
+    bus_address = vr4300_dcache_get_tag(&vr4300->dcache, line, vaddr);
     memcpy(data, line->data, sizeof(data));
 
     for (i = 0; i < 4; i++)
       bus_write_word(vr4300, bus_address + i * 4,
         data[i ^ (WORD_ADDR_XOR >> 2)], ~0);
 
-    line->metadata &= ~0x1;
+    VR4300_STAT(vr4300, VR4300_STAT_DCACHE_WRITEBACKS, 1);
+
+    vr4300_dcache_invalidate(&vr4300->dcache, line);
     return DCACHE_ACCESS_DELAY;
   }
 
-  line->metadata &= ~0x1;
+  vr4300_dcache_invalidate(&vr4300->dcache, line);
   return 0;
 }
 
@@ -495,47 +523,65 @@ cen64_cold static int vr4300_cacheop_dc_hit_wb(
   if (!(line = vr4300_dcache_probe(&vr4300->dcache, vaddr, paddr)))
     return 0;
 
-  if (line->metadata & 0x2) {
-    bus_address = vr4300_dcache_get_tag(line, vaddr);
+  if (vr4300_dcache_is_dirty(&vr4300->dcache, line)) {
+    bus_address = vr4300_dcache_get_tag(&vr4300->dcache, line, vaddr);
     memcpy(data, line->data, sizeof(data));
 
     for (i = 0; i < 4; i++)
       bus_write_word(vr4300, bus_address + i * 4,
         data[i ^ (WORD_ADDR_XOR >> 2)], ~0);
 
-    // TODO: Technically, it's clean now...
-    line->metadata &= ~0x2;
+    VR4300_STAT(vr4300, VR4300_STAT_DCACHE_WRITEBACKS, 1);
+
+    vr4300_dcache_set_clean(&vr4300->dcache, line);
     return DCACHE_ACCESS_DELAY;
   }
 
   return 0;
 }
 
-int VR4300_CACHE(struct vr4300 *vr4300,
-  uint32_t iw, uint64_t rs, uint64_t rt) {
+cen64_align(static const vr4300_cacheop_func_t vr4300_cacheop_lut[32],
+  CACHE_LINE_SIZE) = {
+  vr4300_cacheop_ic_invalidate,     vr4300_cacheop_unimplemented,
+  vr4300_cacheop_ic_set_taglo,      vr4300_cacheop_unimplemented,
+  vr4300_cacheop_ic_invalidate_hit, vr4300_cacheop_unimplemented,
+  vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
+
+  vr4300_cacheop_dc_wb_invalidate,  vr4300_cacheop_dc_get_taglo,
+  vr4300_cacheop_dc_set_taglo,      vr4300_cacheop_dc_create_dirty_ex,
+  vr4300_cacheop_dc_hit_invalidate, vr4300_cacheop_dc_hit_wb_invalidate,
+  vr4300_cacheop_dc_hit_wb,         vr4300_cacheop_unimplemented,
+
+  vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
+  vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
+  vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
+  vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
 
-  cen64_align(static vr4300_cacheop_func_t cacheop_lut[32], CACHE_LINE_SIZE) = {
-    vr4300_cacheop_ic_invalidate,     vr4300_cacheop_unimplemented,
-    vr4300_cacheop_ic_set_taglo,      vr4300_cacheop_unimplemented,
-    vr4300_cacheop_ic_invalidate_hit, vr4300_cacheop_unimplemented,
-    vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
+  vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
+  vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
+  vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
+  vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented
+};
+
+// Returns the CACHE operation handler at a given LUT index.
+vr4300_cacheop_func_t vr4300_get_cacheop(unsigned index) {
+  return vr4300_cacheop_lut[index & 0x1F];
+}
 
-    vr4300_cacheop_dc_wb_invalidate,  vr4300_cacheop_dc_get_taglo,
-    vr4300_cacheop_dc_set_taglo,      vr4300_cacheop_dc_create_dirty_ex,
-    vr4300_cacheop_dc_hit_invalidate, vr4300_cacheop_dc_hit_wb_invalidate,
-    vr4300_cacheop_dc_hit_wb,         vr4300_cacheop_unimplemented,
+// Returns the LUT index of a CACHE operation handler.
+unsigned vr4300_get_cacheop_index(vr4300_cacheop_func_t cacheop) {
+  unsigned i;
 
-    vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
-    vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
-    vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
-    vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
+  for (i = 0; i < 32; i++) {
+    if (vr4300_cacheop_lut[i] == cacheop)
+      return i;
+  }
 
-    vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
-    vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
-    vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented,
-    vr4300_cacheop_unimplemented,     vr4300_cacheop_unimplemented 
-  };
+  return 1;
+}
 
+int VR4300_CACHE(struct vr4300 *vr4300,
+  uint32_t iw, uint64_t rs, uint64_t rt) {
   struct vr4300_exdc_latch *exdc_latch = &vr4300->pipeline.exdc_latch;
   uint64_t vaddr = rs + (int16_t) iw;
 
@@ -543,7 +589,7 @@ int VR4300_CACHE(struct vr4300 *vr4300,
   unsigned op = (iw >> 13 & 0x18) | op_type;
 
   exdc_latch->request.vaddr = vaddr;
-  exdc_latch->request.cacheop = cacheop_lut[op];
+  exdc_latch->request.cacheop = vr4300_cacheop_lut[op];
   exdc_latch->request.type = op_type > 2
     ? VR4300_BUS_REQUEST_CACHE_WRITE
     : VR4300_BUS_REQUEST_CACHE_IDX;
@@ -922,13 +968,20 @@ int VR4300_J_JAL_BWDETECT(struct vr4300 *vr4300,
 
   icrf_latch->pc = (rfex_latch->common.pc & ~0x0FFFFFFFULL) | target;
 
+  if (unlikely(vr4300->callgraph) && is_jal)
+    callgraph_call(vr4300->callgraph, icrf_latch->pc, exdc_latch->result);
+
   if (icrf_latch->pc == rfex_latch->common.pc) {
     //debug("Enter busy wait @ %llu cycles\n", vr4300->cycles);
 
     exdc_latch->dest = PIPELINE_CYCLE_TYPE;
     exdc_latch->result = 5;
+    vr4300->idle.active = false;
   }
 
+  else if (!is_jal)
+    vr4300_check_idle_loop(vr4300, rfex_latch->common.pc, icrf_latch->pc);
+
   return 0;
 }
 
@@ -951,6 +1004,9 @@ int VR4300_J_JAL(struct vr4300 *vr4300,
   exdc_latch->dest = VR4300_REGISTER_RA & ~mask;
 
   icrf_latch->pc = (rfex_latch->common.pc & ~0x0FFFFFFFULL) | target;
+
+  if (unlikely(vr4300->callgraph) && is_jal)
+    callgraph_call(vr4300->callgraph, icrf_latch->pc, exdc_latch->result);
   return 0;
 }
 #endif
@@ -973,6 +1029,14 @@ int VR4300_JALR_JR(struct vr4300 *vr4300,
   exdc_latch->dest = rd & ~mask;
 
   icrf_latch->pc = rs;
+
+  if (unlikely(vr4300->callgraph)) {
+    if (is_jalr)
+      callgraph_call(vr4300->callgraph, rs, exdc_latch->result);
+
+    else if (GET_RS(iw) == VR4300_REGISTER_RA)
+      callgraph_return(vr4300->callgraph, rs);
+  }
   return 0;
 }
 
@@ -1062,10 +1126,9 @@ cen64_hot int VR4300_LOAD_STORE(struct vr4300 *vr4300,
   exdc_latch->request.type = 1 - sel_mask;
   exdc_latch->request.size = request_size + 1;
 
-  FILE *fout = fopen("out.log", "a");
-  fprintf(fout, "LOAD_STORE: address=0x%.8X, dqm=0x%.8X, wdqm=0x%.8X, data=0x%.8X\n",
-    address, dqm, exdc_latch->request.wdqm, exdc_latch->request.data);
-  fclose(fout);
+  if (vr4300->log)
+    fprintf(vr4300->log, "LOAD_STORE: address=0x%.8X, dqm=0x%.8X, wdqm=0x%.8X, data=0x%.8X\n",
+      address, dqm, exdc_latch->request.wdqm, exdc_latch->request.data);
 
   exdc_latch->dest = ~sel_mask & GET_RT(iw);
   exdc_latch->result = 0;
@@ -10,103 +10,88 @@
 
 #include "common.h"
 #include "vr4300/icache.h"
+#include <emmintrin.h>
 
-static inline struct vr4300_icache_line* get_line(
-  struct vr4300_icache *icache, uint64_t vaddr);
-static inline const struct vr4300_icache_line* get_line_const(
-  const struct vr4300_icache *icache, uint64_t vaddr);
+static inline unsigned get_index(uint64_t vaddr);
+static inline bool is_valid(const struct vr4300_icache *icache,
+  unsigned index);
 
-static inline uint32_t get_tag(const struct vr4300_icache_line *line);
-static inline bool is_valid(const struct vr4300_icache_line *line);
+static void invalidate_line(struct vr4300_icache *icache, unsigned index);
+static void set_taglo(struct vr4300_icache *icache,
+  unsigned index, uint32_t taglo);
+static void validate_line(struct vr4300_icache *icache,
+  unsigned index, uint32_t tag);
 
-static void invalidate_line(struct vr4300_icache_line *line);
-static void set_taglo(struct vr4300_icache_line *line, uint32_t taglo);
-static void validate_line(struct vr4300_icache_line *line, uint32_t tag);
-
-// Returns the line for a given virtual address.
-struct vr4300_icache_line* get_line(
-  struct vr4300_icache *icache, uint64_t vaddr) {
-  return icache->lines + (vaddr >> 5 & 0x1FF);
-}
-
-// Returns the line for a given virtual address.
-const struct vr4300_icache_line* get_line_const(
-  const struct vr4300_icache *icache, uint64_t vaddr) {
-  return icache->lines + (vaddr >> 5 & 0x1FF);
-}
-
-// Returns the physical tag associated with the line.
-uint32_t get_tag(const struct vr4300_icache_line *line) {
-  return line->metadata & ~0xFFFU;
+// Returns the line index for a given virtual address.
+unsigned get_index(uint64_t vaddr) {
+  return vaddr >> 5 & 0x1FF;
 }
 
 // Invalidates the line, but leaves the physical tag untouched.
-void invalidate_line(struct vr4300_icache_line *line) {
-  line->metadata &= ~0x1;
+void invalidate_line(struct vr4300_icache *icache, unsigned index) {
+  icache->state[index] &= ~VR4300_ICACHE_VALID;
 }
 
 // Returns true if the line is valid, otherwise returns false.
-bool is_valid(const struct vr4300_icache_line *line) {
-  return (line->metadata & 0x1) == 0x1;
+bool is_valid(const struct vr4300_icache *icache, unsigned index) {
+  return (icache->state[index] & VR4300_ICACHE_VALID) != 0;
 }
 
 // Sets the tag of the specified line and valid bit.
-void set_taglo(struct vr4300_icache_line *line, uint32_t taglo) {
-  line->metadata = (taglo << 4 & 0xFFFFF000) | (taglo >> 7 & 0x1);
+void set_taglo(struct vr4300_icache *icache, unsigned index, uint32_t taglo) {
+  icache->tags[index] = taglo << 4 & 0xFFFFF000;
+  icache->state[index] = taglo >> 7 & VR4300_ICACHE_VALID;
 }
 
 // Sets the line's physical tag and validates the line.
-static void validate_line(struct vr4300_icache_line *line, uint32_t tag) {
-  line->metadata = tag | 0x1;
+static void validate_line(struct vr4300_icache *icache,
+  unsigned index, uint32_t tag) {
+  icache->tags[index] = tag;
+  icache->state[index] = VR4300_ICACHE_VALID;
 }
 
 // Fills an instruction cache line with data.
 void vr4300_icache_fill(struct vr4300_icache *icache,
   uint64_t vaddr, uint32_t paddr, const void *data) {
-  struct vr4300_icache_line *line = get_line(icache, vaddr);
+  unsigned index = get_index(vaddr);
 
-  memcpy(line->data, data, sizeof(line->data));
-  validate_line(line, paddr & ~0xFFFU);
+  memcpy(icache->lines[index].data, data, sizeof(icache->lines[index].data));
+  validate_line(icache, index, paddr & ~0xFFFU);
 }
 
 // Returns the tag of the line associated with vaddr.
 uint32_t vr4300_icache_get_tag(const struct vr4300_icache *icache,
   uint64_t vaddr) {
-  const struct vr4300_icache_line *line = get_line_const(icache, vaddr);
-
-  return get_tag(line) | (vaddr & 0xFE0);
+  return icache->tags[get_index(vaddr)] | (vaddr & 0xFE0);
 }
 
 // Initializes the instruction cache.
 void vr4300_icache_init(struct vr4300_icache *icache) {
+  vr4300_icache_invalidate_all(icache);
 }
 
 // Invalidates an instruction cache line (regardless if hit or miss).
 void vr4300_icache_invalidate(struct vr4300_icache *icache, uint64_t vaddr) {
-  struct vr4300_icache_line *line = get_line(icache, vaddr);
-
-  invalidate_line(line);
+  invalidate_line(icache, get_index(vaddr));
 }
 
 // Invalidates an instruction cache line (only on a hit).
 void vr4300_icache_invalidate_hit(struct vr4300_icache *icache,
   uint64_t vaddr, uint32_t paddr) {
-  struct vr4300_icache_line *line = get_line(icache, vaddr);
-  uint32_t ptag = get_tag(line);
+  unsigned index = get_index(vaddr);
 
-  if (ptag == (paddr & ~0xFFFU) && is_valid(line))
-    invalidate_line(line);
+  if (icache->tags[index] == (paddr & ~0xFFFU) && is_valid(icache, index))
+    invalidate_line(icache, index);
 }
 
 // Probes the instruction cache for a matching line.
 const struct vr4300_icache_line* vr4300_icache_probe(
   const struct vr4300_icache *icache, uint64_t vaddr, uint32_t paddr) {
-  const struct vr4300_icache_line *line = get_line_const(icache, vaddr);
-  uint32_t ptag = get_tag(line);
+  unsigned index = get_index(vaddr);
 
   // Virtually index, and physically tagged.
-  if (ptag == (paddr & ~0xFFFU) && is_valid(line))
-    return line;
+  if (icache->tags[index] == (paddr & ~0xFFFU) && is_valid(icache, index))
+    return icache->lines + index;
 
   return NULL;
 }
@@ -114,8 +99,18 @@ const struct vr4300_icache_line* vr4300_icache_probe(
 // Sets the physical tag associated with the line.
 void vr4300_icache_set_taglo(struct vr4300_icache *icache,
   uint64_t vaddr, uint32_t taglo) {
-  struct vr4300_icache_line *line = get_line(icache, vaddr);
+  set_taglo(icache, get_index(vaddr), taglo);
+}
+
+// Invalidates every line, leaving the physical tags untouched.
+void vr4300_icache_invalidate_all(struct vr4300_icache *icache) {
+  __m128i mask = _mm_set1_epi8(~VR4300_ICACHE_VALID);
+  unsigned i;
 
-  set_taglo(line, taglo);
+  for (i = 0; i < 512; i += 16) {
+    __m128i state = _mm_load_si128((__m128i *) (icache->state + i));
+    _mm_store_si128((__m128i *) (icache->state + i),
+      _mm_and_si128(state, mask));
+  }
 }
 
@@ -12,13 +12,18 @@
 #define __vr4300_icache_h__
 #include "common.h"
 
+#define VR4300_ICACHE_VALID 0x1
+
 struct vr4300_icache_line {
   uint8_t data[8 * 4];
-  uint32_t metadata;
 };
 
+// Tags and state are kept apart from the data so that probes and
+// bulk operations only walk a few dense host cache lines.
 struct vr4300_icache {
-  struct vr4300_icache_line lines[512];
+  cen64_align(uint32_t tags[512], CACHE_LINE_SIZE);
+  cen64_align(uint8_t state[512], CACHE_LINE_SIZE);
+  cen64_align(struct vr4300_icache_line lines[512], CACHE_LINE_SIZE);
 };
 
 cen64_cold void vr4300_icache_init(struct vr4300_icache *icache);
@@ -36,5 +41,7 @@ void vr4300_icache_invalidate_hit(struct vr4300_icache *icache,
 void vr4300_icache_set_taglo(struct vr4300_icache *icache,
   uint64_t vaddr, uint32_t tag);
 
+cen64_cold void vr4300_icache_invalidate_all(struct vr4300_icache *icache);
+
 #endif
 
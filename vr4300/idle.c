@@ -0,0 +1,159 @@
+//
+// vr4300/idle.c: VR4300 idle loop detection.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#include "common.h"
+#include "bus/controller.h"
+#include "mips.h"
+#include "vr4300/cp0.h"
+#include "vr4300/cpu.h"
+#include "vr4300/idle.h"
+
+// Hashes the architectural state a loop iteration can depend on,
+// leaving out the GPRs the loop reads Count into.
+static uint64_t vr4300_idle_signature(const struct vr4300 *vr4300,
+  uint32_t count_regs) {
+  uint64_t signature = 0xCBF29CE484222325ULL;
+  unsigned i;
+
+  for (i = VR4300_REGISTER_AT; i <= VR4300_REGISTER_RA; i++) {
+    if (!(count_regs & (1U << i)))
+      signature = (signature ^ vr4300->regs[i]) * 0x100000001B3ULL;
+  }
+
+  signature = (signature ^ vr4300->regs[VR4300_REGISTER_HI]) * 0x100000001B3ULL;
+  signature = (signature ^ vr4300->regs[VR4300_REGISTER_LO]) * 0x100000001B3ULL;
+  return signature;
+}
+
+// Called when a short backward branch is taken.
+//
+// A loop is considered idle once several consecutive iterations
+// neither store, touch CP0 nor pop the UART FIFO, and end with the
+// same GPR state each time. The only way such a loop can ever exit
+// is for time to pass or for a device to change state, so we stop
+// simulating it: the branch retires into the busy wait cycle type,
+// which just lets Count run until an interrupt, a device event or the
+// recheck budget ends it.
+//
+// Loops that read Count get a different value every iteration, so the
+// registers Count is read into are left out of the signature. Every
+// other register still has to come out the same each time around: a
+// loop that also counts iterations, say, is doing work, not idling.
+void vr4300_idle_loop_branch(struct vr4300 *vr4300,
+  uint64_t pc, uint64_t target) {
+  struct vr4300_exdc_latch *exdc_latch = &vr4300->pipeline.exdc_latch;
+  struct vr4300_idle *idle = &vr4300->idle;
+  uint64_t signature;
+
+  if (!idle->tracking || idle->branch_pc != pc || idle->target_pc != target) {
+    idle->branch_pc = pc;
+    idle->target_pc = target;
+    idle->count_regs = 0;
+    idle->signature = vr4300_idle_signature(vr4300, 0);
+    idle->iterations = 0;
+    idle->tracking = true;
+    idle->impure = false;
+    return;
+  }
+
+  // Don't bother hashing anything if the body had side effects.
+  if (idle->impure) {
+    idle->iterations = 0;
+    idle->impure = false;
+    return;
+  }
+
+  // The first pass through the body (and any that finds another Count
+  // read) changes which registers count, and so the signature.
+  signature = vr4300_idle_signature(vr4300, idle->count_regs);
+
+  if (signature != idle->signature) {
+    idle->signature = signature;
+    idle->iterations = 0;
+    return;
+  }
+
+  if (++idle->iterations < VR4300_IDLE_CONFIRM_ITERATIONS)
+    return;
+
+  idle->device_events = deviceEvents_mips(vr4300->bus->emu);
+  idle->budget = VR4300_IDLE_RECHECK_CYCLES;
+  idle->active = true;
+
+  exdc_latch->dest = PIPELINE_CYCLE_TYPE;
+  exdc_latch->result = 5;
+}
+
+// Called each busy wait cycle that no interrupt ended.
+void vr4300_idle_cycle(struct vr4300 *vr4300) {
+  struct vr4300_idle *idle = &vr4300->idle;
+
+  idle->idle_cycles++;
+
+  // libultra-style branches to self only end with an interrupt.
+  if (!idle->active)
+    return;
+
+  // Let the loop run once more; if nothing changed, the branch
+  // takes us right back here (it's already been confirmed).
+  if (--idle->budget == 0 ||
+    idle->device_events != deviceEvents_mips(vr4300->bus->emu)) {
+    vr4300->regs[PIPELINE_CYCLE_TYPE] = 0;
+    idle->active = false;
+  }
+}
+
+// Skips over idle pcycles up until the next timer event.
+// Returns the number of pcycles which were skipped.
+unsigned vr4300_idle_fast_forward(struct vr4300 *vr4300, unsigned max_cycles) {
+  uint32_t cp0_status = vr4300->regs[VR4300_CP0_REGISTER_STATUS];
+  uint32_t cp0_cause = vr4300->regs[VR4300_CP0_REGISTER_CAUSE];
+  struct vr4300_idle *idle = &vr4300->idle;
+  uint64_t count, compare, delta;
+
+  if (!idle->active || vr4300->regs[PIPELINE_CYCLE_TYPE] != 5 ||
+    vr4300->pipeline.cycles_to_stall)
+    return 0;
+
+  // Let vr4300_cycle_busywait handle anything that'd end the wait.
+  if (((cp0_cause & cp0_status & 0xFF00) &&
+    (cp0_status & 0x1) && !(cp0_status & 0x6)) ||
+    idle->device_events != deviceEvents_mips(vr4300->bus->emu))
+    return 0;
+
+  // Count ticks at half the pclock and is compared as 32 bits, so
+  // stop one pcycle short of (Count >> 1) == Compare and let
+  // vr4300_cycle raise the timer interrupt as usual.
+  count = vr4300->regs[VR4300_CP0_REGISTER_COUNT] & 0x1FFFFFFFFULL;
+  compare = (uint64_t) (uint32_t)
+    vr4300->regs[VR4300_CP0_REGISTER_COMPARE] << 1;
+
+  delta = ((compare - count) & 0x1FFFFFFFFULL);
+  delta = delta ? delta - 1 : 0;
+
+  if (delta > max_cycles)
+    delta = max_cycles;
+
+  if (delta >= idle->budget)
+    delta = idle->budget - 1;
+
+  vr4300->regs[VR4300_CP0_REGISTER_COUNT] += delta;
+  idle->idle_cycles += delta;
+  idle->budget -= delta;
+  return delta;
+}
+
+// Forgets about any loop that was being watched.
+void vr4300_idle_reset(struct vr4300_idle *idle) {
+  idle->tracking = false;
+  idle->active = false;
+  idle->iterations = 0;
+}
+
@@ -0,0 +1,51 @@
+//
+// vr4300/idle.h: VR4300 idle loop detection.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#ifndef __vr4300_idle_h__
+#define __vr4300_idle_h__
+#include "common.h"
+
+// Longest loop (branch target to branch, in bytes) we consider.
+#define VR4300_IDLE_MAX_LOOP_BYTES (16 * 4)
+
+// Identical, side-effect free iterations needed to confirm a loop.
+#define VR4300_IDLE_CONFIRM_ITERATIONS 4
+
+// Most pcycles we skip before running another iteration of the
+// loop to see whether whatever it's waiting on has happened.
+#define VR4300_IDLE_RECHECK_CYCLES 16384
+
+struct vr4300;
+
+struct vr4300_idle {
+  uint64_t branch_pc;
+  uint64_t target_pc;
+  uint64_t signature;
+  uint64_t idle_cycles;
+
+  uint32_t device_events;
+  uint32_t count_regs; // GPRs the loop reads Count into
+  unsigned iterations;
+  unsigned budget;
+
+  bool tracking;
+  bool impure;
+  bool active;
+};
+
+void vr4300_idle_loop_branch(struct vr4300 *vr4300,
+  uint64_t pc, uint64_t target);
+
+cen64_cold void vr4300_idle_cycle(struct vr4300 *vr4300);
+unsigned vr4300_idle_fast_forward(struct vr4300 *vr4300, unsigned max_cycles);
+void vr4300_idle_reset(struct vr4300_idle *idle);
+
+#endif
+
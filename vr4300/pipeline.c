@@ -14,6 +14,7 @@
 #include "vr4300/cpu.h"
 #include "vr4300/decoder.h"
 #include "vr4300/fault.h"
+#include "vr4300/idle.h"
 #include "vr4300/opcodes.h"
 #include "vr4300/pipeline.h"
 #include "vr4300/segment.h"
@@ -93,6 +94,9 @@ static int vr4300_rf_stage(struct vr4300 *vr4300) {
     page_mask = vr4300->cp0.page_mask[index];
     select = ((page_mask + 1) & vaddr) != 0;
 
+    VR4300_STAT(vr4300, tlb_miss
+      ? VR4300_STAT_ITLB_MISSES : VR4300_STAT_ITLB_HITS, 1);
+
     if (unlikely(tlb_miss || !(vr4300->cp0.state[index][select] & 2))) {
       VR4300_ITLB(vr4300, tlb_miss);
       return 1;
@@ -105,6 +109,10 @@ static int vr4300_rf_stage(struct vr4300 *vr4300) {
   // If not cached or we miss in the IC, it's an ICB.
   line = vr4300_icache_probe(&vr4300->icache, vaddr, paddr);
 
+  if (cached)
+    VR4300_STAT(vr4300, line
+      ? VR4300_STAT_ICACHE_HITS : VR4300_STAT_ICACHE_MISSES, 1);
+
   if (!(line && cached)) {
     rfex_latch->paddr = paddr;
     rfex_latch->cached = cached;
@@ -183,12 +191,11 @@ static int vr4300_ex_stage(struct vr4300 *vr4300) {
 
   // Finally, execute the instruction.
 #ifdef PRINT_EXEC
-  FILE *fout = fopen("out.log", "a");
-  fprintf(fout, "%.16llX: %s rd[%u] rs[%u]=0x%.8X, rt[%u]=0x%.8X, imm16=0x%.8X\n",
-    (unsigned long long) rfex_latch->common.pc,
-    vr4300_opcode_mnemonics[rfex_latch->opcode.id],
-    rd, rs, rs_reg, rt, rt_reg, (int16_t) iw);
-  fclose(fout);
+  if (vr4300->log)
+    fprintf(vr4300->log, "%.16llX: %s rd[%u] rs[%u]=0x%.8X, rt[%u]=0x%.8X, imm16=0x%.8X\n",
+      (unsigned long long) rfex_latch->common.pc,
+      vr4300_opcode_mnemonics[rfex_latch->opcode.id],
+      rd, rs, rs_reg, rt, rt_reg, (int16_t) iw);
 #endif
 
   exdc_latch->dest = VR4300_REGISTER_R0;
@@ -233,6 +240,9 @@ static int vr4300_dc_stage(struct vr4300 *vr4300) {
     struct vr4300_dcache_line *line;
     uint32_t paddr;
 
+    // Loops that store or do cache operations are never idle.
+    vr4300->idle.impure |= request->type != VR4300_BUS_REQUEST_READ;
+
     if ((vaddr - segment->start) >= segment->length) {
       if (unlikely((segment = get_segment(vaddr, cp0_status)) == NULL)) {
         VR4300_DADE(vr4300);
@@ -256,6 +266,9 @@ static int vr4300_dc_stage(struct vr4300 *vr4300) {
       page_mask = vr4300->cp0.page_mask[index];
       select = ((page_mask + 1) & vaddr) != 0;
 
+      VR4300_STAT(vr4300, tlb_miss
+        ? VR4300_STAT_DTLB_MISSES : VR4300_STAT_DTLB_HITS, 1);
+
       tlb_inv = !(vr4300->cp0.state[index][select] & 2);
 
       tlb_mod = !(vr4300->cp0.state[index][select] & 4) &&
@@ -299,6 +312,9 @@ static int vr4300_dc_stage(struct vr4300 *vr4300) {
         dcwb_latch->last_op_was_cache_store = (exdc_latch->request.type ==
           VR4300_BUS_REQUEST_WRITE);
 
+        VR4300_STAT(vr4300, line
+          ? VR4300_STAT_DCACHE_HITS : VR4300_STAT_DCACHE_MISSES, 1);
+
         if (!line) {
           request->paddr = paddr;
           exdc_latch->cached = cached;
@@ -306,6 +322,8 @@ static int vr4300_dc_stage(struct vr4300 *vr4300) {
           // Miss: stall for one cycle, then move to the DCM phase.
           vr4300->pipeline.cycles_to_stall = 0;
           vr4300->regs[PIPELINE_CYCLE_TYPE] = 6;
+          VR4300_STALL(vr4300, VR4300_STALL_DCM,
+            exdc_latch->common.pc, 1);
           return 1;
         }
 
@@ -346,11 +364,12 @@ static int vr4300_dc_stage(struct vr4300 *vr4300) {
       memcpy(line->data + paddr, &dword, sizeof(dword));
 
       // We need to mark the line dirty if it's write.
-      // Fortunately, metadata & 0x2 == dirty, and
-      // metadata 0x1 == valid. Our requests values are
+      // Fortunately, state & 0x2 == dirty, and
+      // state & 0x1 == valid. Our requests values are
       // read (0x1) and write (0x2), so we can just do
       // a simple OR here without impacting anything.
-      line->metadata |= exdc_latch->request.type;
+      vr4300_dcache_mark_line(&vr4300->dcache, line,
+        exdc_latch->request.type);
     }
 
     // Not a load/store, so execute cache operation.
@@ -360,6 +379,8 @@ static int vr4300_dc_stage(struct vr4300 *vr4300) {
       if ((delay = request->cacheop(vr4300, vaddr, paddr))) {
         vr4300->pipeline.cycles_to_stall = delay - 1;
         vr4300->regs[PIPELINE_CYCLE_TYPE] = 2;
+        VR4300_STALL(vr4300, VR4300_STALL_CACHEOP,
+          exdc_latch->common.pc, delay);
         return 1;
       }
     }
@@ -374,6 +395,7 @@ static int vr4300_wb_stage(struct vr4300 *vr4300) {
 
   vr4300->regs[dcwb_latch->dest] = dcwb_latch->result;
   vr4300->pipeline.last_pipe_result = dcwb_latch->common;
+  vr4300->pipeline.retired_instructions++;
   return 0;
 }
 
@@ -486,6 +508,9 @@ void vr4300_cycle_busywait(struct vr4300 *vr4300) {
 
     VR4300_INTR(vr4300);
   }
+
+  else
+    vr4300_idle_cycle(vr4300);
 }
 
 // LUT of stages for fault handling.
@@ -528,20 +553,26 @@ void vr4300_cycle_(struct vr4300 *vr4300) {
   }
 }
 
-// Collects additional information about the pipeline each cycle.
-void vr4300_cycle_extra(struct vr4300 *vr4300, struct vr4300_stats *stats) {
+// Collects additional information about the pipeline. Called for a
+// sample of the pcycles, each standing in for weight pcycles; the
+// caller keeps total_cycles.
+void vr4300_cycle_extra(struct vr4300 *vr4300,
+  struct vr4300_stats *stats, unsigned weight) {
   struct vr4300_dcwb_latch *dcwb_latch = &vr4300->pipeline.dcwb_latch;
   struct vr4300_rfex_latch *rfex_latch = &vr4300->pipeline.rfex_latch;
 
-  // Collect information for CPI.
-  stats->executed_instructions +=
-    !dcwb_latch->common.fault &&
-    !vr4300->pipeline.cycles_to_stall;
+  // Collect information for CPI. The instruction in DC/WB retires
+  // next pcycle unless we're stalling, resuming past WB after an
+  // interlock, or parked in a busy wait loop.
+  if (!dcwb_latch->common.fault &&
+    !vr4300->pipeline.cycles_to_stall &&
+    !vr4300->regs[PIPELINE_CYCLE_TYPE])
+    stats->executed_instructions += weight;
 
-  stats->total_cycles++;
+  stats->sampled_cycles++;
 
   // Collect information about executed instructions.
-  stats->opcode_counts[rfex_latch->opcode.id]++;
+  stats->opcode_counts[rfex_latch->opcode.id] += weight;
 }
 
 // Initializes the pipeline with default values.
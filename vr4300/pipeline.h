@@ -84,19 +84,26 @@ struct vr4300_dcwb_latch {
   bool last_op_was_cache_store;
 };
 
+// Checked at the top of every cycle, so the stall/fault state leads
+// and the latches follow in the order the stages consume them.
 struct vr4300_pipeline {
-  struct vr4300_latch last_pipe_result;
+  unsigned exception_history;
+  unsigned cycles_to_stall;
+  bool fault_present;
+
   struct vr4300_dcwb_latch dcwb_latch;
   struct vr4300_exdc_latch exdc_latch;
   struct vr4300_rfex_latch rfex_latch;
   struct vr4300_icrf_latch icrf_latch;
 
-  unsigned exception_history;
-  unsigned cycles_to_stall;
-  bool fault_present;
+  struct vr4300_latch last_pipe_result;
+  uint64_t retired_instructions;
 };
 
 cen64_cold void vr4300_pipeline_init(struct vr4300_pipeline *pipeline);
 
+cen64_cold vr4300_cacheop_func_t vr4300_get_cacheop(unsigned index);
+cen64_cold unsigned vr4300_get_cacheop_index(vr4300_cacheop_func_t cacheop);
+
 #endif
 
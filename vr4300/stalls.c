@@ -0,0 +1,172 @@
+//
+// vr4300/stalls.c: VR4300 stall cycle attribution.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#include "common.h"
+#include "vr4300/cpu.h"
+#include "vr4300/stalls.h"
+#include <inttypes.h>
+
+#ifdef VR4300_DETAILED_STATS
+static const char *vr4300_stall_names[NUM_VR4300_STALLS] = {
+  "ICB",
+  "DCM",
+  "DCB",
+  "LDI",
+  "MCI",
+  "CACHE op",
+  "Exception",
+};
+
+// Hashes a site down to a slot in the table.
+static unsigned vr4300_stall_hash(enum vr4300_stall cause, uint64_t pc) {
+  uint64_t key = (pc >> 2) ^ ((uint64_t) cause << 56);
+  return (key * 0x9E3779B97F4A7C15ULL) >> 52;
+}
+
+// Charges a number of stalled pcycles to a cause and guest PC.
+void vr4300_record_stall(struct vr4300_stall_profile *profile,
+  enum vr4300_stall cause, uint64_t pc, unsigned cycles) {
+  unsigned i = vr4300_stall_hash(cause, pc);
+  struct vr4300_stall_site *site;
+
+  profile->cycles[cause] += cycles;
+
+  // Open addressing; stop taking new sites once the table is
+  // 7/8 full so that probe sequences stay short.
+  for (;; i = (i + 1) & (VR4300_STALL_SITES - 1)) {
+    site = profile->sites + i;
+
+    if (site->pc == pc && site->cause == cause && site->events)
+      break;
+
+    if (!site->events) {
+      if (profile->num_sites >= VR4300_STALL_SITES / 8 * 7) {
+        profile->unattributed += cycles;
+        return;
+      }
+
+      site->pc = pc;
+      site->cause = cause;
+      profile->num_sites++;
+      break;
+    }
+  }
+
+  site->cycles += cycles;
+  site->events++;
+}
+
+// Finds the sites with the most stalled pcycles for a cause.
+static unsigned vr4300_stall_top_sites(
+  const struct vr4300_stall_profile *profile, enum vr4300_stall cause,
+  const struct vr4300_stall_site **top) {
+  unsigned i, j, count = 0;
+
+  for (i = 0; i < VR4300_STALL_SITES; i++) {
+    const struct vr4300_stall_site *site = profile->sites + i;
+
+    if (!site->events || site->cause != cause)
+      continue;
+
+    if (count == VR4300_STALL_TOP_SITES &&
+      site->cycles <= top[count - 1]->cycles)
+      continue;
+
+    if (count < VR4300_STALL_TOP_SITES)
+      count++;
+
+    for (j = count - 1; j > 0 && top[j - 1]->cycles < site->cycles; j--)
+      top[j] = top[j - 1];
+
+    top[j] = site;
+  }
+
+  return count;
+}
+
+// Prints the CPI stack, run total and since the previous summary,
+// followed by the worst offending guest PCs for each cause.
+void vr4300_print_stall_profile(const struct vr4300 *vr4300,
+  struct vr4300_stats *stats) {
+  const struct vr4300_stall_profile *profile = &vr4300->stalls;
+  const struct vr4300_stall_site *top[VR4300_STALL_TOP_SITES];
+  uint64_t run_stalls, interval_stalls, run_idle, interval_idle;
+  uint64_t run_cycles, interval_cycles, run_insns, interval_insns;
+  unsigned i, j, count;
+
+  run_cycles = stats->total_cycles;
+  run_insns = stats->executed_instructions;
+  interval_cycles = run_cycles - stats->last_total_cycles;
+  interval_insns = run_insns - stats->last_executed_instructions;
+
+  run_idle = vr4300->idle.idle_cycles;
+  interval_idle = run_idle - stats->last_idle_cycles;
+  run_stalls = interval_stalls = 0;
+
+  for (i = 0; i < NUM_VR4300_STALLS; i++) {
+    run_stalls += profile->cycles[i];
+    interval_stalls += profile->cycles[i] - stats->last_stall_cycles[i];
+  }
+
+#define CPI(cycles, insns) ((insns) ? (double) (cycles) / (insns) : 0.0)
+
+  printf(" * CPI stack:\n\n"
+         "   %16s  %16s  %16s\n"
+         "   %16s: %16.3f  %16.3f\n",
+
+    "", "Run", "Interval",
+    "Base", CPI((int64_t) (run_cycles - run_stalls - run_idle), run_insns),
+    CPI((int64_t) (interval_cycles - interval_stalls - interval_idle),
+      interval_insns)
+  );
+
+  for (i = 0; i < NUM_VR4300_STALLS; i++) {
+    printf("   %16s: %16.3f  %16.3f\n", vr4300_stall_names[i],
+      CPI(profile->cycles[i], run_insns),
+      CPI(profile->cycles[i] - stats->last_stall_cycles[i], interval_insns));
+  }
+
+  printf("   %16s: %16.3f  %16.3f\n"
+         "   %16s: %16.3f  %16.3f\n"
+         "\n",
+
+    "Idle", CPI(run_idle, run_insns), CPI(interval_idle, interval_insns),
+    "Total", CPI(run_cycles, run_insns), CPI(interval_cycles, interval_insns)
+  );
+
+#undef CPI
+
+  // Per-site figures are only given for the whole run.
+  printf(" * Top stall sites (pcycles, events):\n\n");
+
+  for (i = 0; i < NUM_VR4300_STALLS; i++) {
+    if ((count = vr4300_stall_top_sites(profile, i, top)) == 0)
+      continue;
+
+    for (j = 0; j < count; j++) {
+      printf("   %16s: 0x%016" PRIx64 " %16" PRIu64 " %10" PRIu32 "\n",
+        j == 0 ? vr4300_stall_names[i] : "", top[j]->pc,
+        top[j]->cycles, top[j]->events);
+    }
+  }
+
+  if (profile->unattributed) {
+    printf("   %16s: %18s %16" PRIu64 "\n",
+      "(table full)", "", profile->unattributed);
+  }
+
+  printf("\n\n");
+
+  memcpy(stats->last_stall_cycles, profile->cycles,
+    sizeof(stats->last_stall_cycles));
+  stats->last_idle_cycles = run_idle;
+}
+#endif
+
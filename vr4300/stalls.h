@@ -0,0 +1,68 @@
+//
+// vr4300/stalls.h: VR4300 stall cycle attribution.
+//
+// CEN64: Cycle-Accurate Nintendo 64 Emulator.
+// Copyright (C) 2015, Tyler J. Stachecki.
+//
+// This file is subject to the terms and conditions defined in
+// 'LICENSE', which is part of this source code package.
+//
+
+#ifndef __vr4300_stalls_h__
+#define __vr4300_stalls_h__
+#include "common.h"
+
+// Sites (cause and guest PC pairs) we keep track of; stalls at
+// sites that don't fit are still counted against their cause.
+#define VR4300_STALL_SITES 4096
+
+// Sites listed per cause in the summary.
+#define VR4300_STALL_TOP_SITES 8
+
+struct vr4300;
+struct vr4300_stats;
+
+// Everything that keeps an instruction from retiring in a pcycle.
+enum vr4300_stall {
+  VR4300_STALL_ICB,
+  VR4300_STALL_DCM,
+  VR4300_STALL_DCB,
+  VR4300_STALL_LDI,
+  VR4300_STALL_MCI,
+  VR4300_STALL_CACHEOP,
+  VR4300_STALL_EXCEPTION,
+  NUM_VR4300_STALLS
+};
+
+struct vr4300_stall_site {
+  uint64_t pc;
+  uint64_t cycles;
+  uint32_t events;
+  uint32_t cause;
+};
+
+struct vr4300_stall_profile {
+  uint64_t cycles[NUM_VR4300_STALLS];
+  uint64_t unattributed;
+  unsigned num_sites;
+
+  struct vr4300_stall_site sites[VR4300_STALL_SITES];
+};
+
+// Only maintained when built with VR4300_DETAILED_STATS. Each stall
+// is charged the pcycle that raised it plus the pcycles it stalls.
+#ifdef VR4300_DETAILED_STATS
+#define VR4300_STALL(vr4300, cause, pc, n) \
+  vr4300_record_stall(&(vr4300)->stalls, cause, pc, n)
+#else
+#define VR4300_STALL(vr4300, cause, pc, n) do {} while (0)
+#endif
+
+void vr4300_record_stall(struct vr4300_stall_profile *profile,
+  enum vr4300_stall cause, uint64_t pc, unsigned cycles);
+
+cen64_cold void vr4300_print_stall_profile(const struct vr4300 *vr4300,
+  struct vr4300_stats *stats);
+
+#endif
+